@@ -10,10 +10,12 @@ LOCAL_C_INCLUDES := $(LOCAL_PATH)/$(SDL_PATH)/include
 
 # Add your application source files here...
 LOCAL_SRC_FILES := $(SDL_PATH)/src/main/android/SDL_android_main.c \
-	SDL.cpp Tetris.cpp TetrisSDL.cpp
+	SDL.cpp Tetris.cpp TetrisStat.cpp TetrisLog.cpp TetrisTrace.cpp \
+	TetrisVersus.cpp TetrisAutoplay.cpp TetrisPlugin.cpp TetrisBot.cpp \
+	TetrisCapture.cpp TetrisSDL.cpp
 
 LOCAL_SHARED_LIBRARIES := SDL2 SDL2_ttf
 
-LOCAL_LDLIBS := -lGLESv1_CM -lGLESv2 -llog
+LOCAL_LDLIBS := -lGLESv1_CM -lGLESv2 -llog -ldl
 
 include $(BUILD_SHARED_LIBRARY)
@@ -6,6 +6,21 @@
 
 int main(int argc, char *argv[])
 {
-  TetrisSDL().run();
+  int row = TETRIS_FIELD_ROW;
+  int col = TETRIS_FIELD_COL;
+  int boards = 1;
+
+  /**
+   * Usage: sdl [row col [boards]]
+   * Boards after the first are played by the computer.
+   */
+  if (argc >= 3) {
+    row = atoi(argv[1]);
+    col = atoi(argv[2]);
+  }
+  if (argc >= 4)
+    boards = atoi(argv[3]);
+
+  TetrisSDL(row, col, boards).run();
   return 0;
 }
@@ -5,43 +5,253 @@
 #include <Tetris.h>
 
 TetrisBar::TetrisBar(BarType type, const char *str,
-                     TetrisIndex rotStart, int rotSize)
-  : mType(type), mRotSize(rotSize)
+                     TetrisIndex rotStart, int rotSize,
+                     const TetrisKickTable &kick)
+  : TetrisBar(type, str, TETRIS_BAR_ROW, TETRIS_BAR_COL, rotStart, rotSize,
+              kick)
 {
-  mIndexSize = countNotEmptyGrid(type, str);
-  mIndex = new TetrisIndex* [mRotSize];
-  for (int rot = 0; rot < mRotSize; ++rot) {
-    mIndex[rot] = new TetrisIndex[mIndexSize];
-    for (int idx = 0; idx < mIndexSize; ++idx)
-      mIndex[rot][idx] = new TetrisIndex();
-  }
 
-  int idx = 0;
-  for (int r = 0; r < TETRIS_BAR_ROW; ++r)
-    for (int c = 0; c < TETRIS_BAR_COL; ++c)
-      if (str[rc2point(r, c)] == type) {
-        mIndex[0][idx].c = c - rotStart.c;
-        mIndex[0][idx].r = r - rotStart.r;
-        idx++;
+}
+
+TetrisBar::TetrisBar(BarType type, const char *str, int row, int col,
+                     TetrisIndex rotStart, int rotSize,
+                     const TetrisKickTable &kick)
+  : mType(type), mIndexSize(0), mRotSize(rotSize), mKick(&kick)
+{
+  for (int r = 0; r < row; ++r)
+    for (int c = 0; c < col; ++c)
+      if (str[r * col + c] == type) {
+        mIndex[0][mIndexSize].c = c - rotStart.c;
+        mIndex[0][mIndexSize].r = r - rotStart.r;
+        mIndexSize++;
       }
 
   for (int rot = 1; rot < mRotSize; ++rot)
     for (int idx = 0; idx < mIndexSize; ++idx)
       mIndex[rot][idx] = TetrisIndex::rotate(mIndex[rot - 1][idx]);
+  initShape();
+}
+
+TetrisBar::TetrisBar(BarType type, const char *str, int box, int rotSize,
+                     const TetrisKickTable &kick)
+  : mType(type), mIndexSize(0), mRotSize(rotSize), mKick(&kick)
+{
+  for (int r = 0; r < box; ++r)
+    for (int c = 0; c < box; ++c)
+      if (str[r * TETRIS_BAR_COL + c] == type) {
+        mIndex[0][mIndexSize].c = c;
+        mIndex[0][mIndexSize].r = r;
+        mIndexSize++;
+      }
+
+  /** Clockwise around the middle of the box. */
+  for (int rot = 1; rot < mRotSize; ++rot)
+    for (int idx = 0; idx < mIndexSize; ++idx) {
+      const TetrisIndex &prev = mIndex[rot - 1][idx];
+      mIndex[rot][idx] = TetrisIndex(box - 1 - prev.r, prev.c);
+    }
+  initShape();
+}
+
+void TetrisBar::initShape()
+{
+  for (int rot = 0; rot < mRotSize; ++rot) {
+    TetrisBarShape &shape = mShape[rot];
+    int minR = INT_MAX, maxR = INT_MIN;
+    int minC = INT_MAX, maxC = INT_MIN;
+    for (int idx = 0; idx < mIndexSize; ++idx) {
+      TetrisIndex index = mIndex[rot][idx];
+      minR = std::min(minR, index.r);
+      maxR = std::max(maxR, index.r);
+      minC = std::min(minC, index.c);
+      maxC = std::max(maxC, index.c);
+    }
+
+    shape.r = mIndexSize ? minR : 0;
+    shape.c = mIndexSize ? minC : 0;
+    shape.row = mIndexSize ? maxR - minR + 1 : 0;
+    shape.col = mIndexSize ? maxC - minC + 1 : 0;
+    for (int r = 0; r < TETRIS_BAR_MAX; ++r)
+      shape.mask[r] = 0;
+    for (int idx = 0; idx < mIndexSize; ++idx) {
+      TetrisIndex index = mIndex[rot][idx];
+      shape.mask[index.r - minR] |= 1U << (index.c - minC);
+    }
+  }
+}
+
+static bool isSameShape(const TetrisBarShape &a, const TetrisBarShape &b)
+{
+  if (a.row != b.row || a.col != b.col)
+    return false;
+  for (int r = 0; r < a.row; ++r)
+    if (a.mask[r] != b.mask[r])
+      return false;
+  return true;
 }
 
-TetrisField::TetrisField()
-  : mRow(TETRIS_FIELD_ROW), mCol(TETRIS_FIELD_COL),
-    mScore(0), mLines(0)
+bool TetrisBarSet::load(const char *path)
 {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    std::cerr << "<error> fopen(" << path << ")\n";
+    return false;
+  }
+
+  std::vector<TetrisBar> bars;
+  char line[256];
+  int lineNr = 0;
+  bool ret = true;
+  /** Bar being read: its letter, pivot and rows. */
+  int type = 0;
+  TetrisIndex pivot(-1, -1);
+  char cell[TETRIS_BAR_MAX * TETRIS_BAR_MAX];
+  int row = 0;
+  int col = 0;
+
+  while (ret) {
+    bool end = !fgets(line, sizeof(line), fp);
+    lineNr++;
+    size_t size = end ? 0 : strcspn(line, "\r\n");
+    /** A row of one cell has the letter of the bar read. */
+    bool header = size && line[0] != '.' && line[0] != '#' &&
+      (line[1] == ' ' || (size == 1 && line[0] != type));
+
+    /** A new letter or the end of the file closes the bar read. */
+    if (type && (end || header)) {
+      if (!row) {
+        std::cerr << path << ":" << lineNr << ": bar " << (char) type
+                  << " has no rows\n";
+        ret = false;
+        break;
+      }
+      if (pivot.r < 0)
+        pivot = TetrisIndex((col - 1) / 2, (row - 1) / 2);
+
+      /** Count the distinct rotations from the shapes of all four. */
+      TetrisBar bar((BarType) type, cell, row, TETRIS_BAR_MAX, pivot,
+                    TETRIS_ROT_NR, TetrisKickJLSTZ);
+      int rotSize = TETRIS_ROT_NR;
+      if (isSameShape(bar.getShape(0), bar.getShape(1)))
+        rotSize = 1;
+      else if (isSameShape(bar.getShape(0), bar.getShape(2)))
+        rotSize = 2;
+      bars.push_back(TetrisBar((BarType) type, cell, row, TETRIS_BAR_MAX,
+                               pivot, rotSize, TetrisKickJLSTZ));
+      type = 0;
+    }
+    if (end)
+      break;
+    if (!size || line[0] == '#')
+      continue;
+
+    if (header) {
+      int r = -1, c = -1;
+      type = (unsigned char) line[0];
+      if (sscanf(line + 1, "%d %d", &r, &c) == 2)
+        pivot = TetrisIndex(c, r);
+      else
+        pivot = TetrisIndex(-1, -1);
+      row = col = 0;
+      for (size_t i = 0; i < bars.size(); ++i)
+        if (bars[i].getType() == type)
+          type = 0;
+      if (!type || type == BAR_TYPE_E || type == BAR_TYPE_G ||
+          type == '#') {
+        std::cerr << path << ":" << lineNr << ": bad or repeated letter\n";
+        ret = false;
+      }
+      continue;
+    }
+
+    if (!type || row == TETRIS_BAR_MAX || size > TETRIS_BAR_MAX) {
+      std::cerr << path << ":" << lineNr << ": rows exceed "
+                << TETRIS_BAR_MAX << "x" << TETRIS_BAR_MAX
+                << " or have no letter\n";
+      ret = false;
+      continue;
+    }
+    for (size_t c = 0; c < size; ++c) {
+      if (line[c] != '.' && line[c] != type) {
+        std::cerr << path << ":" << lineNr << ": '" << line[c]
+                  << "' is neither '.' nor " << (char) type << "\n";
+        ret = false;
+      }
+      cell[row * TETRIS_BAR_MAX + c] = line[c];
+    }
+    for (int c = size; c < TETRIS_BAR_MAX; ++c)
+      cell[row * TETRIS_BAR_MAX + c] = '.';
+    col = std::max(col, (int) size);
+    row++;
+  }
+  fclose(fp);
+
+  if (ret && bars.empty()) {
+    std::cerr << path << ": no bars\n";
+    ret = false;
+  }
+  if (ret)
+    mBar.swap(bars);
+  return ret;
+}
+
+const TetrisBar *TetrisBarSet::find(BarType type) const
+{
+  int index = getIndex(type);
+  return index < 0 ? NULL : &mBar[index];
+}
+
+int TetrisBarSet::getIndex(BarType type) const
+{
+  for (size_t i = 0; i < mBar.size(); ++i)
+    if (mBar[i].getType() == type)
+      return i;
+  return -1;
+}
+
+static std::atomic<unsigned> fieldCount(0);
+
+TetrisField::TetrisField(int row, int col)
+  : mId(fieldCount++), mRow(row), mCol(col), mScore(0), mLines(0),
+    mPieces(0), mGarbage(0), mGameOver(false), mHeight(col, 0),
+    mRandState(1),
+    mRotation(TETRIS_ROTATION_CLASSIC), mKick(-1), mSnapshotRow(0),
+    mSnapshotCol(0), mListener(NULL), mBarSet(NULL)
+{
+
+}
+
+void TetrisField::init()
+{
+  reset(((unsigned long long) time(NULL) << 20) ^ getpid() ^
+        (unsigned long long) (size_t) this);
+}
+
+void TetrisField::setSeed(unsigned long long seed)
+{
+  /** splitmix64 spreads close seeds over the whole state. */
+  seed += 0x9e3779b97f4a7c15ULL;
+  seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+  mRandState = (seed ^ (seed >> 31)) | 1;
+}
+
+void TetrisField::reset(unsigned long long seed)
+{
+  std::lock_guard<std::mutex> lock(mLock);
   clear();
-  srand((unsigned) time(NULL));
-  /** Ignore some ::rand() */
-  for (int i = 0, r = rand(1024); i < r; ++i)
-    rand();
+  setSeed(seed);
+  mScore = 0;
+  mLines = 0;
+  mPieces = 0;
+  std::fill(mClears, mClears + TETRIS_BAR_MAX + 1, 0);
+  mGarbage = 0;
+  mKick = -1;
+  mGameOver = false;
   mNextBar = getRandBar();
   mNextBarRot = getRandBarRot(mNextBar);
   setBar();
+  publish();
 }
 
 TetrisField::~TetrisField()
@@ -49,19 +259,17 @@ TetrisField::~TetrisField()
 
 }
 
-bool TetrisField::checkLocatable(TetrisIndex &next, int rot)
+TetrisField *TetrisField::create(int row, int col)
 {
-  int indexSize = mBar->getIndexSize();
-  for (int pos = 0; pos < indexSize; ++pos) {
-    TetrisIndex index = mBar->getIndex(pos, rot);
-    int c = next.c + index.c;
-    int r = next.r + index.r;
-    if (c < 0 || c >= mCol || r < 0 || r >= mRow)
-      return false;
-    if (getGrid(r, c) != BAR_TYPE_E)
-      return false;
-  }
-  return true;
+  if (row < TETRIS_BAR_ROW)
+    row = TETRIS_BAR_ROW;
+  if (col < TETRIS_BAR_COL)
+    col = TETRIS_BAR_COL;
+  if (row == TETRIS_FIELD_ROW && col == TETRIS_FIELD_COL)
+    return new TetrisFieldStandard();
+  if (col <= TETRIS_FIELD_WORD_COL)
+    return new TetrisFieldWord(row, col);
+  return new TetrisFieldDynamic(row, col);
 }
 
 bool TetrisField::moveBar(int dx, int dy)
@@ -74,20 +282,92 @@ bool TetrisField::moveBar(int dx, int dy)
   return true;
 }
 
+int TetrisField::tryRotate(const TetrisBar *bar, TetrisIndex &index,
+                           int &rot, int dr)
+{
+  static const TetrisKick inPlace = { 0, 0 };
+  int rotSize = bar->getRotSize();
+  int next = (rotSize + rot + dr) % rotSize;
+  int k;
+
+  if (mRotation == TETRIS_ROTATION_SRS && rotSize > 1) {
+    const TetrisKick *kicks = bar->getKick(rot, dr);
+    k = kick(bar, index, next, kicks, TETRIS_KICK_NR);
+    if (k < 0)
+      return -1;
+    index.c += kicks[k].c;
+    index.r += kicks[k].r;
+  } else {
+    k = kick(bar, index, next, &inPlace, 1);
+    if (k < 0)
+      return -1;
+  }
+  rot = next;
+  return k;
+}
+
 bool TetrisField::rotBar(int dr)
 {
-  int rotSize = mBar->getRotSize();
-  int next = (rotSize + mBarRot + dr) % rotSize;
-  if (!checkLocatable(mBarIndex, next))
+  int k = tryRotate(mBar, mBarIndex, mBarRot, dr);
+  if (k < 0)
     return false;
-  mBarRot = next;
-  return false;
+  mKick = k;
+  return true;
 }
 
-bool TetrisField::input(InputType inputType)
+int TetrisField::getDropRow(const TetrisBar *bar, TetrisIndex index,
+                            int rot)
+{
+  int drop = INT_MAX;
+  int indexSize = bar->getIndexSize();
+  for (int pos = 0; pos < indexSize; ++pos) {
+    TetrisIndex cell = bar->getIndex(pos, rot);
+    int c = index.c + cell.c;
+    int r = index.r + cell.r;
+    int free = mRow - mHeight[c] - 1 - r;
+    if (free < 0) {
+      /** Below the surface of this column. */
+      drop = -1;
+      break;
+    }
+    if (free < drop)
+      drop = free;
+  }
+
+  if (drop >= 0)
+    return index.r + drop;
+
+  TetrisIndex next = TetrisIndex(index.c, index.r + 1);
+  while (checkLocatable(bar, next, rot))
+    next.r++;
+  return next.r - 1;
+}
+
+bool TetrisField::lockBar()
+{
+  TETRIS_LOG(TETRIS_LOG_LOCK, mId, mBar->getType(), mBarIndex.c,
+             mBarIndex.r, mBarRot);
+  putBar();
+  mPieces++;
+  /** Listeners of the spawn see the board without its full lines. */
+  deleteLine();
+  if (!setBar()) {
+    mGameOver = true;
+    TETRIS_LOG(TETRIS_LOG_GAMEOVER, mId, mScore, mLines, mPieces);
+    return false;
+  }
+  return true;
+}
+
+bool TetrisField::dropBar()
+{
+  mBarIndex.r = getDropRow(mBar, mBarIndex, mBarRot);
+  return lockBar();
+}
+
+bool TetrisField::apply(InputType inputType)
 {
   bool ret = false;
-  // TODO: lock
   switch (inputType) {
 #define CASE(type, func) case type: { ret = func(); break;}
     CASE(INPUT_TYPE_UP, moveUpBar);
@@ -96,6 +376,8 @@ bool TetrisField::input(InputType inputType)
     CASE(INPUT_TYPE_RIGHT, moveRightBar);
     CASE(INPUT_TYPE_ROT_LEFT, rotLeftBar);
     CASE(INPUT_TYPE_ROT_RIGHT, rotRightBar);
+    CASE(INPUT_TYPE_DROP, dropBar);
+    CASE(INPUT_TYPE_TIMER, fall);
 #undef CASE
   default:
     {
@@ -103,81 +385,200 @@ bool TetrisField::input(InputType inputType)
       break;
     }
   }
-  // TODO: unlock
   return ret;
 }
 
-void TetrisField::putBar()
+bool TetrisField::input(InputType inputType)
 {
-  BarType type = mBar->getType();
-  int indexSize = mBar->getIndexSize();
-  for (int pos = 0; pos < indexSize; ++pos) {
-    TetrisIndex index = mBar->getIndex(pos, mBarRot);
-    setGrid(mBarIndex.r + index.r, mBarIndex.c + index.c, type);
-  }
+  TETRIS_ALLOC_SCOPE(TETRIS_ALLOC_FIELD);
+  std::lock_guard<std::mutex> lock(mLock);
+  bool ret = apply(inputType);
+  if (ret || mGameOver)
+    publish();
+  return ret;
 }
 
-bool TetrisField::checkLine(int row)
+static int clamp(int value, int min, int max)
 {
-  for (int col = 0; col < mCol; ++col)
-    if (getGrid(row, col) == BAR_TYPE_E)
-      return false;
-  return true;
+  return value < min ? min : value > max ? max : value;
 }
 
-void TetrisField::deleteLine(int row)
+void TetrisField::enableSnapshot(int viewRow, int viewCol)
 {
-  for (int r = row - 1; r >= 0; --r)
-    for (int c = 0; c < mCol; ++c)
-      setGrid(r + 1, c, getGrid(r, c));
-  for (int c = 0; c < mCol; ++c)
-    setGrid(0, c, BAR_TYPE_E);
+  std::lock_guard<std::mutex> lock(mLock);
+  mSnapshotRow = mRow < viewRow ? mRow : viewRow;
+  mSnapshotCol = mCol < viewCol ? mCol : viewCol;
+  for (int i = 0; i < 3; ++i)
+    mSnapshot.slot(i).mCell.resize((size_t) mSnapshotRow * mSnapshotCol);
+  publish();
 }
 
-void TetrisField::deleteLine()
+void TetrisField::save(TetrisFieldState &state)
 {
-  unsigned lines = 0;
-  for (int row = mRow - 1; row >= 0; --row)
-    if (checkLine(row)) {
-      deleteLine(row++); //TODO: O(n^2) -> O(n)
-      lines++;
-    }
+  std::lock_guard<std::mutex> lock(mLock);
+  state.mNextBar = mNextBar;
+  state.mNextBarRot = mNextBarRot;
+  state.mBar = mBar;
+  state.mBarIndex = mBarIndex;
+  state.mBarRot = mBarRot;
+  state.mScore = mScore;
+  state.mLines = mLines;
+  state.mPieces = mPieces;
+  std::copy(mClears, mClears + TETRIS_BAR_MAX + 1, state.mClears);
+  state.mGarbage = mGarbage;
+  state.mGameOver = mGameOver;
+  state.mHeight = mHeight;
+  state.mRandState = mRandState;
+  state.mKick = mKick;
+  saveGrid(state.mGrid);
+}
 
-  if (lines) {
-    mScore += lines;
-    mLines += lines;
+void TetrisField::restore(const TetrisFieldState &state)
+{
+  std::lock_guard<std::mutex> lock(mLock);
+  mNextBar = state.mNextBar;
+  mNextBarRot = state.mNextBarRot;
+  mBar = state.mBar;
+  mBarIndex = state.mBarIndex;
+  mBarRot = state.mBarRot;
+  mScore = state.mScore;
+  mLines = state.mLines;
+  mPieces = state.mPieces;
+  std::copy(state.mClears, state.mClears + TETRIS_BAR_MAX + 1, mClears);
+  mGarbage = state.mGarbage;
+  mGameOver = state.mGameOver;
+  mHeight = state.mHeight;
+  mRandState = state.mRandState;
+  mKick = state.mKick;
+  restoreGrid(state.mGrid);
+  publish();
+}
+
+void TetrisField::addGarbage(int lines, int hole)
+{
+  std::lock_guard<std::mutex> lock(mLock);
+  if (mGameOver || lines <= 0)
+    return;
+  bool ret = raiseGrid(lines, hole);
+
+  /** Lift the falling bar, as far as its top row may go. */
+  while (!checkLocatable(mBarIndex, mBarRot) &&
+         mBarIndex.r + mBar->getShape(mBarRot).r > 0)
+    mBarIndex.r--;
+  if (!ret || !checkLocatable(mBarIndex, mBarRot)) {
+    mGameOver = true;
+    TETRIS_LOG(TETRIS_LOG_GAMEOVER, mId, mScore, mLines, mPieces);
   }
+  publish();
 }
 
-void TetrisDrawer::draw(TetrisField *field, int baseCol)
+void TetrisField::publish()
 {
-  drawFrame(field, baseCol);
-  drawField(field, baseCol);
-  drawBar(field, baseCol);
-  drawScore(field, baseCol);
-  drawNextBar(field, baseCol);
+  if (!mSnapshotRow)
+    return;
+
+  TetrisSnapshot &snapshot = mSnapshot.back();
+  TetrisViewport &view = snapshot.mView;
+  view.row = mSnapshotRow;
+  view.col = mSnapshotCol;
+  view.r = clamp(mBarIndex.r - view.row / 2, 0, mRow - view.row);
+  view.c = clamp(mBarIndex.c - view.col / 2, 0, mCol - view.col);
+
+  BarType *cell = &snapshot.mCell[0];
+  for (int r = 0; r < view.row; ++r)
+    for (int c = 0; c < view.col; ++c)
+      *cell++ = getGrid(view.r + r, view.c + c);
+
+  snapshot.mRow = mRow;
+  snapshot.mCol = mCol;
+  snapshot.mBar = mBar;
+  snapshot.mBarIndex = mBarIndex;
+  snapshot.mBarRot = mBarRot;
+  snapshot.mGhostIndex = getGhostIndex();
+  snapshot.mNextBar = mNextBar;
+  snapshot.mNextBarRot = mNextBarRot;
+  snapshot.mScore = mScore;
+  snapshot.mLines = mLines;
+  snapshot.mGameOver = mGameOver;
+  mSnapshot.publish();
+}
+
+void TetrisDrawer::draw(const TetrisSnapshot *snapshot, int baseCol)
+{
+  mView = snapshot->getView();
+  {
+    TETRIS_TRACE_ZONE("drawFrame");
+    drawFrame(snapshot, baseCol);
+  }
+  {
+    TETRIS_TRACE_ZONE("drawField");
+    drawField(snapshot, baseCol);
+  }
+  {
+    TETRIS_TRACE_ZONE("drawGhostBar");
+    drawGhostBar(snapshot, baseCol);
+  }
+  {
+    TETRIS_TRACE_ZONE("drawBar");
+    drawBar(snapshot, baseCol);
+  }
+  {
+    TETRIS_TRACE_ZONE("drawScore");
+    drawScore(snapshot, baseCol);
+  }
+  {
+    TETRIS_TRACE_ZONE("drawNextBar");
+    drawNextBar(snapshot, baseCol);
+  }
+}
+
+void TetrisDrawer::layout()
+{
+  int size = mTetris->getBoardSize();
+  int col = mTetris->getField()->getCol() + mMarginCol;
+
+  mBoardLine = std::max(1, std::min(size, mScreenCol / col));
+  mBoardRow = mScreenRow / ((size + mBoardLine - 1) / mBoardLine);
+  mBoardCol = mScreenCol / mBoardLine;
+  mViewRow = std::max(1, mBoardRow - mMarginRow);
+  mViewCol = std::max(1, mBoardCol - mMarginCol);
 }
 
 void TetrisDrawer::draw()
 {
-  erase();
-  draw(mTetris->getField(), 0);
-  update();
+  if (!mTetris->isVisible())
+    return;
+  TETRIS_TRACE_ZONE("draw");
+
+  /** All boards go into one frame, erased and updated once. */
+  {
+    TETRIS_TRACE_ZONE("erase");
+    erase();
+  }
+  for (int board = 0; board < mTetris->getBoardSize(); ++board) {
+    mBaseRow = board / mBoardLine * mBoardRow;
+    draw(mTetris->getBoard(board)->getSnapshot(),
+         board % mBoardLine * mBoardCol);
+  }
+  mBaseRow = 0;
+  {
+    TETRIS_TRACE_ZONE("update");
+    update();
+  }
+  mTetris->getLatency()->present(TetrisClock::nsec());
+}
+
+bool TetrisField::fall()
+{
+  if (!moveDownBar())
+    return lockBar();
+  return true;
 }
 
 bool TetrisField::timer()
 {
-  bool ret = true;
-  /* TODO: lock */
-  if (!moveDownBar()) {
-    putBar();
-    if (!setBar())
-      ret = false;
-    else
-      deleteLine();
-  }
-  /* TODO: unlock */
-  return ret;
+  TETRIS_TRACE_ZONE("timer");
+  return input(INPUT_TYPE_TIMER);
 }
 
 void *TetrisTimerPthread::threadFunction(void *data)
@@ -187,9 +588,23 @@ void *TetrisTimerPthread::threadFunction(void *data)
     return NULL;
 
   Tetris *tetris = threadData->tetris;
-  int usec = threadData->msec * 1000;
+  TETRIS_TRACE_THREAD("TetrisTimerPthread");
+  TETRIS_ALLOC_SCOPE(TETRIS_ALLOC_TIMER);
+  unsigned long long interval = threadData->msec * 1000000ULL;
+  unsigned long long deadline = TetrisClock::nsec();
   while (!threadData->stop) {
-    usleep (usec);
+    deadline += interval;
+    unsigned long long now = TetrisClock::nsec();
+    if (deadline > now)
+      usleep((deadline - now) / 1000);
+
+    /** A late tick is logged, and the next one is not hurried. */
+    now = TetrisClock::nsec();
+    if (now > deadline + TIMER_OVERRUN_MSEC * 1000000ULL) {
+      TETRIS_LOG(TETRIS_LOG_TIMER_OVERRUN, tetris->getField()->getId(),
+                 (now - deadline) / 1000);
+      deadline = now;
+    }
     if (!tetris->getField()->timer()) {
       threadData->interrupt = true;
       return NULL;
@@ -219,18 +634,159 @@ bool TetrisTimerPthread::stop()
   return true;
 }
 
+Tetris::~Tetris()
+{
+  if (mSession) {
+    mSession->print(std::cerr);
+    delete mSession;
+  }
+  TetrisLog::instance().close();
+  TetrisTrace::instance().close();
+#ifdef TETRIS_ALLOC
+  TetrisAlloc::print(std::cerr);
+#endif
+  if (getenv("TETRIS_STAT")) {
+    mStartup.print(std::cerr);
+    mLatency.print(std::cerr);
+  }
+  for (size_t i = 0; i < mBoards.size(); ++i) {
+    delete mBoards[i].inputer;
+    delete mBoards[i].field;
+  }
+  delete mField;
+}
+
+void TetrisField::setRotation(TetrisRotation rotation)
+{
+  std::lock_guard<std::mutex> lock(mLock);
+  mRotation = rotation;
+  if (mBarSet)
+    return;
+  mNextBar = findBar(mNextBar->getType());
+  mNextBarRot %= mNextBar->getRotSize();
+  mBar = findBar(mBar->getType());
+  mBarRot %= mBar->getRotSize();
+  mBarIndex = TetrisIndex(mCol / 2 - TETRIS_BAR_COL / 2,
+                          -mBar->getShape(mBarRot).r);
+  publish();
+}
+
+void TetrisField::setBarSet(const TetrisBarSet *set)
+{
+  std::lock_guard<std::mutex> lock(mLock);
+  mBarSet = set;
+  mNextBar = getRandBar();
+  mNextBarRot = getRandBarRot(mNextBar);
+  setBar();
+  publish();
+}
+
+void Tetris::addBoard(TetrisField *field, TetrisInputer *inputer)
+{
+  TetrisBoard board = { field, inputer };
+  field->setRotation(mField->getRotation());
+  if (mField->getBarSet())
+    field->setBarSet(mField->getBarSet());
+  mBoards.push_back(board);
+}
+
+void Tetris::registerSession(TetrisSession *session)
+{
+  if (!session)
+    return;
+  mSession = session;
+  if (session->getRemote())
+    addBoard(session->getRemote(), NULL);
+  mStartup.mark("session");
+}
+
+/**
+ * The fields only change in the frames of the session, so neither
+ * gravity nor the player's inputs go to the field directly.
+ */
+void Tetris::runSession()
+{
+  for (unsigned long long frame = 1; ; ++frame) {
+    TETRIS_TRACE_ZONE("run");
+    {
+      TETRIS_ALLOC_SCOPE(TETRIS_ALLOC_DRAWER);
+      mDrawer->draw();
+    }
+
+    for (size_t i = 0; i < mBoards.size(); ++i) {
+      if (!mBoards[i].inputer)
+        continue;
+      TetrisInputEvent boardEvent;
+      while ((boardEvent = input(mBoards[i].inputer)).type !=
+             INPUT_TYPE_EMPTY)
+        mBoards[i].field->input(boardEvent.type);
+    }
+
+    TetrisInputEvent event;
+    while ((event = input(mInputer)).type != INPUT_TYPE_EMPTY) {
+      if (event.type == INPUT_TYPE_QUIT)
+        break;
+      mSession->push(event.type);
+    }
+
+    if (event.type == INPUT_TYPE_QUIT || !mSession->update())
+      break;
+    usleep(mSession->getTimeout());
+    TETRIS_ALLOC_FRAME();
+    if (frame == mFrames)
+      break;
+  }
+  mDrawer->gameover();
+}
+
 void Tetris::run()
 {
-  InputType inputType;
+  for (int board = 0; board < getBoardSize(); ++board)
+    getBoard(board)->enableSnapshot(mDrawer->getViewRow(),
+                                    mDrawer->getViewCol());
+  TETRIS_TRACE_THREAD("render");
+  if (mSession) {
+    runSession();
+    return;
+  }
   mTimer->start();
-  while (1) {
-    mDrawer->draw();
-    inputType = mInputer->input();
-    if (!mField->input(inputType))
-      ; // TODO:
-    if (inputType == INPUT_TYPE_QUIT)
+  for (unsigned long long frame = 1; ; ++frame) {
+    TETRIS_TRACE_ZONE("run");
+    {
+      TETRIS_ALLOC_SCOPE(TETRIS_ALLOC_DRAWER);
+      mDrawer->draw();
+    }
+
+    for (size_t i = 0; i < mBoards.size(); ++i) {
+      if (!mBoards[i].inputer)
+        continue;
+      TetrisInputEvent boardEvent;
+      while ((boardEvent = input(mBoards[i].inputer)).type !=
+             INPUT_TYPE_EMPTY)
+        mBoards[i].field->input(boardEvent.type);
+    }
+
+    /** Apply every pending input before drawing the next frame. */
+    TetrisInputEvent event;
+    while ((event = input(mInputer)).type != INPUT_TYPE_EMPTY) {
+      if (event.type == INPUT_TYPE_QUIT)
+        break;
+      if (event.type == INPUT_TYPE_TIMER)
+        mField->input(event.type);
+      else if (mField->input(event.type))
+        mLatency.input(event.time, true);
+      else {
+        mLatency.input(event.time, false);
+        TETRIS_LOG(TETRIS_LOG_INPUT_DROPPED, mField->getId(), event.type);
+      }
+    }
+
+    if (event.type == INPUT_TYPE_QUIT)
+      break;
+    if (mTimer->isInterrupted() || mField->isGameOver())
       break;
-    if (mTimer->isInterrupted())
+    TETRIS_ALLOC_FRAME();
+    if (frame == mFrames)
       break;
   }
   mTimer->stop();
@@ -7,9 +7,18 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <climits>
 #include <ctime>
 #include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <TetrisStat.h>
+#include <TetrisTriple.h>
+#include <TetrisLog.h>
+#include <TetrisTrace.h>
+#include <TetrisAlloc.h>
 
 class TetrisIndex {
  public:
@@ -30,12 +39,6 @@ class TetrisIndex {
     return *this;
   }
 
-  TetrisIndex &operator=(const TetrisIndex *index) {
-    c = index->c;
-    r = index->r;
-    return *this;
-  }
-
   static TetrisIndex rotate(const TetrisIndex &index) {
     TetrisIndex rotateIndex = TetrisIndex(-index.r, index.c);
     return rotateIndex;
@@ -57,18 +60,22 @@ enum BarType {
   BAR_TYPE_S = 'S',
   BAR_TYPE_T = 'T',
   BAR_TYPE_Z = 'Z',
+  /** Row sent by the opponent in versus, see TetrisVersus. */
+  BAR_TYPE_G = 'G',
 };
 
 enum {
   TETRIS_BAR_ROW = 4,
   TETRIS_BAR_COL = 4,
   TETRIS_BAR_NR = 7,
+  /** Largest side of a bar, including the bars of a TetrisBarSet. */
+  TETRIS_BAR_MAX = 5,
   TETRIS_BAR_START_COL = 1,
   TETRIS_BAR_START_ROW = 1,
   TETRIS_FIELD_ROW = 20,
   TETRIS_FIELD_COL = 10,
-  TETRIS_FIELD_START_COL = 3,
-  TETRIS_FIELD_START_ROW = TETRIS_BAR_ROW - 1,
+  /** Widest field whose rows are kept as one machine word bitmask. */
+  TETRIS_FIELD_WORD_COL = 64,
 };
 
 enum InputType {
@@ -79,32 +86,90 @@ enum InputType {
   INPUT_TYPE_LEFT,
   INPUT_TYPE_ROT_RIGHT,
   INPUT_TYPE_ROT_LEFT,
+  INPUT_TYPE_DROP,
   INPUT_TYPE_QUIT,
+  INPUT_TYPE_TIMER,
+};
+
+/** An input stamped with the time the inputer received it. */
+struct TetrisInputEvent {
+  InputType type;
+  unsigned long long time;
+
+  TetrisInputEvent(InputType type = INPUT_TYPE_EMPTY)
+    : type(type), time(type == INPUT_TYPE_EMPTY ? 0 : TetrisClock::nsec()) {}
+  TetrisInputEvent(InputType type, unsigned long long time)
+    : type(type), time(time) {}
+};
+
+#include <Tetris.def>
+
+/** Offset tried when a bar turns, see TETRIS_KICK_JLSTZ. */
+struct TetrisKick {
+  signed char c;
+  signed char r;
+};
+
+enum {
+  TETRIS_KICK_NR = 5,
+  TETRIS_ROT_NR = 4,
+};
+
+typedef TetrisKick TetrisKickTable[TETRIS_ROT_NR][2][TETRIS_KICK_NR];
+
+static const TetrisKickTable TetrisKickJLSTZ = TETRIS_KICK_JLSTZ;
+static const TetrisKickTable TetrisKickI = TETRIS_KICK_I;
+
+/** Rule used to turn the falling bar. */
+enum TetrisRotation {
+  /** Turn in place only. */
+  TETRIS_ROTATION_CLASSIC = 0,
+  /**
+   * Turn the bars of the standard rotation system inside their box,
+   * with its wall kicks, see BAR_TYPE_I_SRS_STRING.
+   */
+  TETRIS_ROTATION_SRS,
+};
+
+/**
+ * Cells of a bar in one rotation as row bitmasks. Bit j of mask[i] is
+ * the cell at row r + i and column c + j relative to the bar index, so
+ * that collisions with a grid are a few word operations.
+ */
+struct TetrisBarShape {
+  int r;
+  int c;
+  int row;
+  int col;
+  unsigned mask[TETRIS_BAR_MAX];
 };
 
 class TetrisBar {
  private:
   BarType mType;
-  TetrisIndex **mIndex;
+  /** Cells of each rotation, held inline so bars never allocate. */
+  TetrisIndex mIndex[TETRIS_ROT_NR][TETRIS_BAR_MAX * TETRIS_BAR_MAX];
   int mIndexSize;
   int mRotSize;
+  TetrisBarShape mShape[TETRIS_ROT_NR];
+  const TetrisKickTable *mKick;
 
-  static inline int rc2point(int r, int c) {
-    return TETRIS_BAR_COL * (r) + (c);
-  }
-
-  int countNotEmptyGrid(BarType type, const char *grid) {
-    int ret = 0;
-    for (int r = 0; r < TETRIS_BAR_ROW; ++r)
-      for (int c = 0; c < TETRIS_BAR_COL; ++c)
-        if (grid[rc2point(r, c)] == type)
-          ret++;
-    return ret;
-  }
+  /** Fill the shapes from the cells of every rotation. */
+  void initShape();
 
  public:
   explicit TetrisBar(BarType type, const char *str,
-                     TetrisIndex rotStart, int rotSize);
+                     TetrisIndex rotStart, int rotSize,
+                     const TetrisKickTable &kick);
+  /** Bar drawn with type in the row x col cells of str. */
+  TetrisBar(BarType type, const char *str, int row, int col,
+            TetrisIndex rotStart, int rotSize, const TetrisKickTable &kick);
+  /**
+   * Bar turning inside the top left box x box cells of str, indexed
+   * from the corner of the box, as in the standard rotation system.
+   */
+  TetrisBar(BarType type, const char *str, int box, int rotSize,
+            const TetrisKickTable &kick);
 
   BarType getType() const { return mType; }
   int getIndexSize() const { return mIndexSize; }
@@ -114,14 +179,21 @@ class TetrisBar {
     return mIndex[rot][bar];
   }
 
-#include <Tetris.def>
+  const TetrisBarShape &getShape(int rot) const { return mShape[rot]; }
+
+  /** Kicks tried turning from rot, clockwise if dr > 0. */
+  const TetrisKick *getKick(int rot, int dr) const {
+    return (*mKick)[rot][dr > 0 ? 0 : 1];
+  }
+
 #define DEFINE_GET_BAR(type)                       \
   static const TetrisBar *getBar##type() {         \
     static const TetrisBar                         \
       TetrisBar##type(BAR_TYPE_##type,             \
                       BAR_TYPE_##type##_STRING,    \
                       BAR_TYPE_##type##_ROT_START, \
-                      BAR_TYPE_##type##_ROT_SIZE); \
+                      BAR_TYPE_##type##_ROT_SIZE,  \
+                      BAR_TYPE_##type##_KICK);     \
       return &TetrisBar##type;                     \
   }
   DEFINE_GET_BAR(E);
@@ -135,11 +207,445 @@ class TetrisBar {
 #undef DEFINE_GET_BAR
 #define getBar(type) getBar##type()
 
+#define DEFINE_GET_SRS_BAR(type)                          \
+  static const TetrisBar *getSrsBar##type() {             \
+    static const TetrisBar                                \
+      TetrisSrsBar##type(BAR_TYPE_##type,                 \
+                         BAR_TYPE_##type##_SRS_STRING,    \
+                         BAR_TYPE_##type##_SRS_BOX,       \
+                         BAR_TYPE_##type##_SRS_ROT_SIZE,  \
+                         BAR_TYPE_##type##_KICK);         \
+      return &TetrisSrsBar##type;                         \
+  }
+  DEFINE_GET_SRS_BAR(I);
+  DEFINE_GET_SRS_BAR(J);
+  DEFINE_GET_SRS_BAR(L);
+  DEFINE_GET_SRS_BAR(O);
+  DEFINE_GET_SRS_BAR(S);
+  DEFINE_GET_SRS_BAR(T);
+  DEFINE_GET_SRS_BAR(Z);
+#undef DEFINE_GET_SRS_BAR
+#define getSrsBar(type) getSrsBar##type()
+
 };
 
-class TetrisField {
+/**
+ * Bars loaded from a file in place of the built-in seven, like
+ *
+ *   # P pentomino turning around row 1, column 0
+ *   P 1 0
+ *   PP
+ *   PP
+ *   P.
+ *
+ * A bar is a line with its letter and optionally the row and column it
+ * turns around, followed by its rows with '.' for empty cells, up to
+ * TETRIS_BAR_MAX x TETRIS_BAR_MAX. Blank lines and lines starting with
+ * '#' are skipped. The rotations and row bitmasks of every bar are
+ * built once in load(), so the bars collide as fast as the built-in
+ * ones; the number of rotations is the number of distinct ones.
+ */
+class TetrisBarSet {
+ private:
+  std::vector<TetrisBar> mBar;
+
+ public:
+  /** Replace the bars. Fields using the set must not play meanwhile. */
+  bool load(const char *path);
+
+  int getSize() const { return mBar.size(); }
+  const TetrisBar *getBarAt(int n) const { return &mBar[n]; }
+
+  /** Bar of type, or NULL. */
+  const TetrisBar *find(BarType type) const;
+  /** Position of the bar of type, or -1. */
+  int getIndex(BarType type) const;
+};
+
+/**
+ * Row bitmask type for a field of Col columns. The narrowest unsigned
+ * integer holding one bit per column is used, so the standard 10 column
+ * field keeps a row in 16 bits.
+ */
+template <int Col, int Bits = (Col <= 16 ? 16 : Col <= 32 ? 32 : 64)>
+struct TetrisRowMask;
+
+template <int Col>
+struct TetrisRowMask<Col, 16> { typedef unsigned short Type; };
+template <int Col>
+struct TetrisRowMask<Col, 32> { typedef unsigned int Type; };
+template <int Col>
+struct TetrisRowMask<Col, 64> { typedef unsigned long long Type; };
+
+/** Collision of a shape with a grid that has no row bitmasks. */
+template <class Grid>
+static inline bool fitsCells(const Grid &grid, const TetrisBarShape &shape,
+                             int r, int c)
+{
+  r += shape.r;
+  c += shape.c;
+  if (r < 0 || c < 0 || r + shape.row > grid.getRow() ||
+      c + shape.col > grid.getCol())
+    return false;
+  for (int i = 0; i < shape.row; ++i)
+    for (unsigned mask = shape.mask[i]; mask; mask &= mask - 1)
+      if (!grid.isEmpty(r + i, c + __builtin_ctz(mask)))
+        return false;
+  return true;
+}
+
+/**
+ * Grid storage with compile-time dimensions, up to TETRIS_FIELD_WORD_COL
+ * columns. An occupancy bitmask per row is kept next to the cells, so
+ * that emptiness and full line checks are a single word operation.
+ */
+template <int Row, int Col>
+class TetrisGrid {
+ private:
+  typedef typename TetrisRowMask<Col>::Type Mask;
+
+  BarType mCell[Row][Col];
+  Mask mMask[Row];
+
+  static Mask bit(int c) { return (Mask) 1 << c; }
+  static Mask full() { return (Mask) (~0ULL >> (64 - Col)); }
+
+ public:
+  enum { ROW = Row, COL = Col };
+
+  TetrisGrid() { clear(); }
+
+  int getRow() const { return Row; }
+  int getCol() const { return Col; }
+
+  BarType get(int r, int c) const { return mCell[r][c]; }
+
+  void set(int r, int c, BarType t) {
+    mCell[r][c] = t;
+    if (t == BAR_TYPE_E)
+      mMask[r] &= ~bit(c);
+    else
+      mMask[r] |= bit(c);
+  }
+
+  bool isEmpty(int r, int c) const { return !(mMask[r] & bit(c)); }
+  bool isFull(int r) const { return mMask[r] == full(); }
+  Mask getMask(int r) const { return mMask[r]; }
+
+  /** True if shape placed at r, c is inside and overlaps nothing. */
+  bool fits(const TetrisBarShape &shape, int r, int c) const {
+    r += shape.r;
+    c += shape.c;
+    if (r < 0 || c < 0 || r + shape.row > Row || c + shape.col > Col)
+      return false;
+    Mask hit = 0;
+    for (int i = 0; i < shape.row; ++i)
+      hit |= mMask[r + i] & ((Mask) shape.mask[i] << c);
+    return !hit;
+  }
+
+  /** Row dst takes over the content of row src. Row src is undefined. */
+  void moveRow(int dst, int src) {
+    for (int c = 0; c < Col; ++c)
+      mCell[dst][c] = mCell[src][c];
+    mMask[dst] = mMask[src];
+  }
+
+  void clearRow(int r) {
+    for (int c = 0; c < Col; ++c)
+      mCell[r][c] = BAR_TYPE_E;
+    mMask[r] = 0;
+  }
+
+  void clear() {
+    for (int r = 0; r < Row; ++r)
+      clearRow(r);
+  }
+
+  /** The grid is plain data, copied as bytes by TetrisFieldState. */
+  void save(std::vector<unsigned char> &bytes) const {
+    bytes.resize(sizeof(*this));
+    memcpy(&bytes[0], this, sizeof(*this));
+  }
+  void restore(const std::vector<unsigned char> &bytes) {
+    memcpy(this, &bytes[0], sizeof(*this));
+  }
+};
+
+/**
+ * Grid storage with runtime dimensions and the row bitmasks of
+ * TetrisGrid, for fields up to TETRIS_FIELD_WORD_COL columns. Rows are
+ * reached through an index table, so deleting lines on a tall field
+ * moves row indices instead of cells.
+ */
+class TetrisGridWord {
+ private:
+  int mRow;
+  int mCol;
+  unsigned long long mFull;
+  std::vector<BarType> mCell;
+  std::vector<unsigned long long> mMask;
+  std::vector<int> mIndex;
+
+  BarType *row(int r) { return &mCell[(size_t) mIndex[r] * mCol]; }
+  const BarType *row(int r) const { return &mCell[(size_t) mIndex[r] * mCol]; }
+  unsigned long long &mask(int r) { return mMask[mIndex[r]]; }
+  unsigned long long mask(int r) const { return mMask[mIndex[r]]; }
+
+ public:
+  TetrisGridWord(int row, int col)
+    : mRow(row), mCol(col), mFull(~0ULL >> (64 - col)),
+      mCell((size_t) row * col, BAR_TYPE_E), mMask(row, 0), mIndex(row) {
+    for (int r = 0; r < mRow; ++r)
+      mIndex[r] = r;
+  }
+
+  int getRow() const { return mRow; }
+  int getCol() const { return mCol; }
+
+  BarType get(int r, int c) const { return row(r)[c]; }
+
+  void set(int r, int c, BarType t) {
+    row(r)[c] = t;
+    if (t == BAR_TYPE_E)
+      mask(r) &= ~(1ULL << c);
+    else
+      mask(r) |= 1ULL << c;
+  }
+
+  bool isEmpty(int r, int c) const { return !(mask(r) & (1ULL << c)); }
+  bool isFull(int r) const { return mask(r) == mFull; }
+
+  bool fits(const TetrisBarShape &shape, int r, int c) const {
+    r += shape.r;
+    c += shape.c;
+    if (r < 0 || c < 0 || r + shape.row > mRow || c + shape.col > mCol)
+      return false;
+    unsigned long long hit = 0;
+    for (int i = 0; i < shape.row; ++i)
+      hit |= mask(r + i) & ((unsigned long long) shape.mask[i] << c);
+    return !hit;
+  }
+
+  void moveRow(int dst, int src) { std::swap(mIndex[dst], mIndex[src]); }
+
+  void clearRow(int r) {
+    std::fill(row(r), row(r) + mCol, BAR_TYPE_E);
+    mask(r) = 0;
+  }
+
+  void clear() {
+    for (int r = 0; r < mRow; ++r)
+      clearRow(r);
+  }
+
+  void save(std::vector<unsigned char> &bytes) const {
+    size_t cell = mCell.size() * sizeof(BarType);
+    size_t mask = mMask.size() * sizeof(unsigned long long);
+    size_t index = mIndex.size() * sizeof(int);
+    bytes.resize(cell + mask + index);
+    memcpy(&bytes[0], &mCell[0], cell);
+    memcpy(&bytes[cell], &mMask[0], mask);
+    memcpy(&bytes[cell + mask], &mIndex[0], index);
+  }
+  void restore(const std::vector<unsigned char> &bytes) {
+    size_t cell = mCell.size() * sizeof(BarType);
+    size_t mask = mMask.size() * sizeof(unsigned long long);
+    size_t index = mIndex.size() * sizeof(int);
+    memcpy(&mCell[0], &bytes[0], cell);
+    memcpy(&mMask[0], &bytes[cell], mask);
+    memcpy(&mIndex[0], &bytes[cell + mask], index);
+  }
+};
+
+/**
+ * Grid storage with runtime dimensions for fields wider than
+ * TETRIS_FIELD_WORD_COL, which count the filled cells per row. Rows are
+ * reached through an index table, so deleting lines moves row indices
+ * instead of cells.
+ */
+class TetrisGridDynamic {
  private:
-  BarType mGrid[TETRIS_FIELD_ROW][TETRIS_FIELD_COL];
+  int mRow;
+  int mCol;
+  std::vector<BarType> mCell;
+  std::vector<int> mCount;
+  std::vector<int> mIndex;
+
+  BarType *row(int r) { return &mCell[(size_t) mIndex[r] * mCol]; }
+  const BarType *row(int r) const { return &mCell[(size_t) mIndex[r] * mCol]; }
+
+ public:
+  TetrisGridDynamic(int row, int col)
+    : mRow(row), mCol(col), mCell((size_t) row * col, BAR_TYPE_E),
+      mCount(row, 0), mIndex(row) {
+    for (int r = 0; r < mRow; ++r)
+      mIndex[r] = r;
+  }
+
+  int getRow() const { return mRow; }
+  int getCol() const { return mCol; }
+
+  BarType get(int r, int c) const { return row(r)[c]; }
+
+  void set(int r, int c, BarType t) {
+    BarType *cell = &row(r)[c];
+    mCount[mIndex[r]] += (t != BAR_TYPE_E) - (*cell != BAR_TYPE_E);
+    *cell = t;
+  }
+
+  bool isEmpty(int r, int c) const { return row(r)[c] == BAR_TYPE_E; }
+  bool isFull(int r) const { return mCount[mIndex[r]] == mCol; }
+
+  bool fits(const TetrisBarShape &shape, int r, int c) const {
+    return fitsCells(*this, shape, r, c);
+  }
+
+  void moveRow(int dst, int src) { std::swap(mIndex[dst], mIndex[src]); }
+
+  void clearRow(int r) {
+    std::fill(row(r), row(r) + mCol, BAR_TYPE_E);
+    mCount[mIndex[r]] = 0;
+  }
+
+  void clear() {
+    for (int r = 0; r < mRow; ++r)
+      clearRow(r);
+  }
+
+  void save(std::vector<unsigned char> &bytes) const {
+    size_t cell = mCell.size() * sizeof(BarType);
+    size_t count = mCount.size() * sizeof(int);
+    bytes.resize(cell + 2 * count);
+    memcpy(&bytes[0], &mCell[0], cell);
+    memcpy(&bytes[cell], &mCount[0], count);
+    memcpy(&bytes[cell + count], &mIndex[0], count);
+  }
+  void restore(const std::vector<unsigned char> &bytes) {
+    size_t cell = mCell.size() * sizeof(BarType);
+    size_t count = mCount.size() * sizeof(int);
+    memcpy(&mCell[0], &bytes[0], cell);
+    memcpy(&mCount[0], &bytes[cell], count);
+    memcpy(&mIndex[0], &bytes[cell + count], count);
+  }
+};
+
+/** Part of a field visible on screen, in field coordinates. */
+struct TetrisViewport {
+  int r;
+  int c;
+  int row;
+  int col;
+
+  TetrisViewport() : r(0), c(0), row(0), col(0) {}
+
+  bool contains(int fr, int fc) const {
+    return fr >= r && fr < r + row && fc >= c && fc < c + col;
+  }
+};
+
+/**
+ * Copy of the field state which a drawer needs for one frame. Only the
+ * viewport part of the grid is copied, so that snapshots of very large
+ * fields stay small.
+ */
+class TetrisSnapshot {
+  friend class TetrisField;
+
+ private:
+  int mRow;
+  int mCol;
+  TetrisViewport mView;
+  std::vector<BarType> mCell;
+
+  const TetrisBar *mBar;
+  TetrisIndex mBarIndex;
+  int mBarRot;
+  TetrisIndex mGhostIndex;
+
+  const TetrisBar *mNextBar;
+  int mNextBarRot;
+
+  unsigned mScore;
+  unsigned mLines;
+  bool mGameOver;
+
+ public:
+  TetrisSnapshot()
+    : mRow(0), mCol(0), mBar(NULL), mBarRot(0), mNextBar(NULL),
+      mNextBarRot(0), mScore(0), mLines(0), mGameOver(false) {}
+
+  int getRow() const { return mRow; }
+  int getCol() const { return mCol; }
+  const TetrisViewport &getView() const { return mView; }
+
+  /** Cell in field coordinates, which must lie in the viewport. */
+  BarType getGrid(int r, int c) const {
+    return mCell[(r - mView.r) * mView.col + (c - mView.c)];
+  }
+
+  const TetrisBar *getBar() const { return mBar; }
+  TetrisIndex getBarIndex() const { return mBarIndex; }
+  int getBarRot() const { return mBarRot; }
+  TetrisIndex getGhostIndex() const { return mGhostIndex; }
+
+  const TetrisBar *getNextBar() const { return mNextBar; }
+  int getNextBarRot() const { return mNextBarRot; }
+
+  unsigned getScore() const { return mScore; }
+  unsigned getLines() const { return mLines; }
+  bool isGameOver() const { return mGameOver; }
+};
+
+/**
+ * Everything deciding the future of a field, for rollback. The field
+ * itself holds a lock and snapshots and is not copied. Saving into a
+ * state reuses its buffers, so it does not allocate once the state has
+ * been used.
+ */
+class TetrisFieldState {
+  friend class TetrisField;
+
+ private:
+  const TetrisBar *mNextBar;
+  int mNextBarRot;
+  const TetrisBar *mBar;
+  TetrisIndex mBarIndex;
+  int mBarRot;
+  unsigned mScore;
+  unsigned mLines;
+  unsigned mPieces;
+  unsigned mClears[TETRIS_BAR_MAX + 1];
+  unsigned mGarbage;
+  bool mGameOver;
+  std::vector<int> mHeight;
+  unsigned long long mRandState;
+  int mKick;
+  std::vector<unsigned char> mGrid;
+
+ public:
+  TetrisFieldState()
+    : mNextBar(NULL), mNextBarRot(0), mBar(NULL), mBarRot(0), mScore(0),
+      mLines(0), mPieces(0), mGarbage(0), mGameOver(false),
+      mRandState(0), mKick(-1) {}
+
+  unsigned getPieces() const { return mPieces; }
+  bool isGameOver() const { return mGameOver; }
+};
+
+class TetrisField;
+
+/** Told of every bar spawned in a field, with the field locked. */
+class TetrisFieldListener {
+ public:
+  virtual ~TetrisFieldListener() {}
+  virtual void spawn(TetrisField *field) = 0;
+};
+
+class TetrisField {
+ protected:
+  /** Numbers the fields of the process in TetrisLog records. */
+  unsigned mId;
   int mRow;
   int mCol;
 
@@ -152,21 +658,136 @@ class TetrisField {
 
   unsigned mScore;
   unsigned mLines;
+  unsigned mPieces;
+  /** Number of deletions of 1 to TETRIS_BAR_MAX lines at once. */
+  unsigned mClears[TETRIS_BAR_MAX + 1];
+  /** Lines to send to the opponent, see takeGarbage(). */
+  unsigned mGarbage;
+
+  bool mGameOver;
+
+  /**
+   * Column heights, counted from the bottom up to the topmost filled
+   * cell. Kept up to date by putBar, deleteLine and setGrid.
+   */
+  std::vector<int> mHeight;
+
+  /** xorshift64* state, so that a seed reproduces a game. */
+  unsigned long long mRandState;
+
+  TetrisRotation mRotation;
+  /** Kick used by the last successful rotation. */
+  int mKick;
+
+  /** Serializes inputs and timer ticks coming from different threads. */
+  std::mutex mLock;
+
+  /**
+   * Snapshots published after every change for the drawer. Largest
+   * viewport, 0 while no drawer has asked for snapshots.
+   */
+  TetrisTriple<TetrisSnapshot> mSnapshot;
+  int mSnapshotRow;
+  int mSnapshotCol;
+
+  TetrisFieldListener *mListener;
+  /** Bars drawn at random, the built-in seven if NULL. */
+  const TetrisBarSet *mBarSet;
+
+  TetrisField(int row, int col);
+
+  /** Called by the grid specialization once its grid exists. */
+  void init();
+
+  /** Apply an input, mLock must be held. */
+  bool apply(InputType inputType);
+  bool fall();
+
+  /** Copy the state into a snapshot, mLock must be held. */
+  void publish();
+
+  virtual void saveGrid(std::vector<unsigned char> &bytes) = 0;
+  virtual void restoreGrid(const std::vector<unsigned char> &bytes) = 0;
+  /**
+   * Push the grid up by lines rows and fill the bottom ones except
+   * column hole with BAR_TYPE_G. Return false if filled cells were
+   * pushed out of the top.
+   */
+  virtual bool raiseGrid(int lines, int hole) = 0;
 
  public:
-  TetrisField();
-  ~TetrisField();
+  virtual ~TetrisField();
+
+  /**
+   * Create a field. The standard size uses the compile-time
+   * specialization, other sizes up to TETRIS_FIELD_WORD_COL columns
+   * the row bitmasks of TetrisGridWord, wider ones TetrisGridDynamic.
+   * Sizes below TETRIS_BAR_ROW x TETRIS_BAR_COL are enlarged to it.
+   */
+  static TetrisField *create(int row = TETRIS_FIELD_ROW,
+                             int col = TETRIS_FIELD_COL);
 
   int getRow() { return mRow; }
   int getCol() { return mCol; }
 
-  void setRow(int row) { mRow = row; }
-  void setCol(int col) { mCol = col; }
+  /** Start a new game whose bar sequence is given by seed. */
+  void reset(unsigned long long seed);
+  void setSeed(unsigned long long seed);
 
   bool input(InputType inputType);
   bool timer();
 
-  bool checkLocatable(TetrisIndex &next, int rot);
+  /** Copy the state for restore(), in a few hundred bytes. */
+  void save(TetrisFieldState &state);
+  void restore(const TetrisFieldState &state);
+
+  /**
+   * Lines earned against the opponent since the last call. Deleting
+   * 2, 3 and 4 lines at once sends 1, 2 and 4 lines.
+   */
+  unsigned takeGarbage() {
+    unsigned ret = mGarbage;
+    mGarbage = 0;
+    return ret;
+  }
+
+  /**
+   * Receive lines from the opponent, with the empty cell at column
+   * hole. The falling bar is lifted if the rows reach it; the game is
+   * over if it cannot be, or if the stack is pushed out of the top.
+   */
+  void addGarbage(int lines, int hole);
+
+  /**
+   * Start publishing snapshots whose viewport is at most viewRow x
+   * viewCol. Called before the threads changing the field start.
+   */
+  void enableSnapshot(int viewRow, int viewCol);
+
+  /** Set before the threads changing the field start. */
+  void setListener(TetrisFieldListener *listener) { mListener = listener; }
+
+  /**
+   * Draw bars from set, or from the built-in seven if it is NULL. The
+   * falling and next bars are drawn again; called before playing.
+   */
+  void setBarSet(const TetrisBarSet *set);
+  const TetrisBarSet *getBarSet() { return mBarSet; }
+
+  /**
+   * Latest complete snapshot, without waiting for the threads changing
+   * the field. Called by the drawing thread only; the snapshot stays
+   * valid until the next call.
+   */
+  const TetrisSnapshot *getSnapshot() { return &mSnapshot.read(); }
+
+  bool isGameOver() { return mGameOver; }
+
+  virtual bool checkLocatable(const TetrisBar *bar, TetrisIndex &next,
+                              int rot) = 0;
+  bool checkLocatable(TetrisIndex &next, int rot) {
+    return checkLocatable(mBar, next, rot);
+  }
 
   bool moveBar(int dx, int dy);
   bool moveUpBar() { return moveBar(0, -1); }
@@ -174,27 +795,65 @@ class TetrisField {
   bool moveLeftBar() { return moveBar(-1, 0); }
   bool moveRightBar() { return moveBar(+1, 0); }
 
+  /**
+   * The built-in falling and next bars are replaced by the ones of
+   * rotation, as if spawned again; called before playing.
+   */
+  void setRotation(TetrisRotation rotation);
+  TetrisRotation getRotation() { return mRotation; }
+
+  /**
+   * First kick of the rotation system letting bar turn by dr at index.
+   * Return its number after updating index and rot, or -1 if the bar
+   * cannot turn.
+   */
+  int tryRotate(const TetrisBar *bar, TetrisIndex &index, int &rot, int dr);
+
+  /** First of size kicks for which bar fits at index with rot, or -1. */
+  virtual int kick(const TetrisBar *bar, TetrisIndex index, int rot,
+                   const TetrisKick *kicks, int size) = 0;
+
   bool rotBar(int dr);
   bool rotLeftBar() { return rotBar(-1); }
   bool rotRightBar() { return rotBar(+1); }
+  int getKick() { return mKick; }
+
+  int getHeight(int col) { return mHeight[col]; }
+
+  /**
+   * Row where a bar dropped from index comes to rest. Resolved from
+   * the column heights when the bar is above the surface, probing is
+   * only needed for a bar tucked below an overhang.
+   */
+  int getDropRow(const TetrisBar *bar, TetrisIndex index, int rot);
+  TetrisIndex getGhostIndex() {
+    return TetrisIndex(mBarIndex.c, getDropRow(mBar, mBarIndex, mBarRot));
+  }
 
-  void putBar();
-  bool checkLine(int row);
-  void deleteLine(int row);
-  void deleteLine();
+  /** Put the bar, delete lines and spawn the next bar. */
+  bool lockBar();
+  bool dropBar();
 
-  BarType getGrid(int r, int c) { return mGrid[r][c]; }
-  void setGrid(int r, int c, BarType t) { mGrid[r][c] = t; }
+  virtual void putBar() = 0;
+  virtual bool checkLine(int row) = 0;
+  virtual void deleteLine(int row) = 0;
+  virtual void deleteLine() = 0;
 
-  void clear() {
-    for (int r = 0; r < mRow; ++r)
-      for (int c = 0; c < mCol; ++c)
-        setGrid(r, c, BAR_TYPE_E);
-  }
+  virtual BarType getGrid(int r, int c) = 0;
+  virtual void setGrid(int r, int c, BarType t) = 0;
+  /** One byte per cell of rows r to r + row - 1, 1 if filled. */
+  virtual void getOccupancy(int r, int row, unsigned char *cell) = 0;
+  virtual void clear() = 0;
 
-  const TetrisBar *getBarFromType(int type) {
+  /** The built-in bars differ between the rotation systems. */
+  static const TetrisBar *getBarFromType(
+    int type, TetrisRotation rotation = TETRIS_ROTATION_CLASSIC) {
     switch (type) {
-#define CASE(n, type) case n: { return TetrisBar::getBar(type); }
+#define CASE(n, type)                                           \
+      case n: {                                                 \
+        return rotation == TETRIS_ROTATION_SRS ?                \
+          TetrisBar::getSrsBar(type) : TetrisBar::getBar(type); \
+      }
       CASE(0, I);
       CASE(1, J);
       CASE(2, L);
@@ -209,46 +868,79 @@ class TetrisField {
     return NULL;
   }
 
+  static const TetrisBar *getBarFromBarType(
+    BarType type, TetrisRotation rotation = TETRIS_ROTATION_CLASSIC) {
+    switch (type) {
+#define CASE(type)                                              \
+      case BAR_TYPE_##type: {                                   \
+        return rotation == TETRIS_ROTATION_SRS ?                \
+          TetrisBar::getSrsBar(type) : TetrisBar::getBar(type); \
+      }
+      CASE(I);
+      CASE(J);
+      CASE(L);
+      CASE(O);
+      CASE(S);
+      CASE(T);
+      CASE(Z);
+#undef CASE
+    default:
+      break;
+    }
+    return NULL;
+  }
+
   const TetrisBar *getNextBar() { return mNextBar; }
   int getNextBarRot() { return mNextBarRot; }
 
-  void setNextBar(BarType type) { mNextBar = getBarFromType(type); }
+  /** Bar of type in the bars of the field, or NULL. */
+  const TetrisBar *findBar(BarType type) {
+    return mBarSet ? mBarSet->find(type) : getBarFromBarType(type, mRotation);
+  }
+
+  void setNextBar(BarType type) { mNextBar = findBar(type); }
   void setNextBarRot(int rot) { mNextBarRot = rot; }
 
   const TetrisBar *getBar() { return mBar; }
   TetrisIndex getBarIndex() { return mBarIndex; }
   int getBarRot() { return mBarRot; }
 
-  void setBar(BarType type) { mBar = getBarFromType(type); }
+  void setBar(BarType type) { mBar = findBar(type); }
   void setBarIndex(TetrisIndex index) { mBarIndex = index; }
   void setBarRot(int rot) { mBarRot = rot; }
 
   int rand(int max = 1) {
-    return (int) (max * (::rand() / (RAND_MAX + 1.0f)));
+    mRandState ^= mRandState >> 12;
+    mRandState ^= mRandState << 25;
+    mRandState ^= mRandState >> 27;
+    unsigned long long value = (mRandState * 2685821657736338717ULL) >> 32;
+    return (int) ((value * max) >> 32);
   }
 
   const TetrisBar *getRandBar() {
-    return getBarFromType(rand(TETRIS_BAR_NR));
+    if (!mBarSet)
+      return getBarFromType(rand(TETRIS_BAR_NR), mRotation);
+    return mBarSet->getBarAt(rand(mBarSet->getSize()));
   }
 
   int getRandBarRot(const TetrisBar *bar) { return rand(bar->getRotSize()); }
 
   bool setBar() {
     mBar = getNextBar();
-    mBarIndex = TetrisIndex(TETRIS_FIELD_START_COL,
-                            TETRIS_FIELD_START_ROW);
     mBarRot = getNextBarRot();
+    /** The top cell of the bar spawns on the top row. */
+    mBarIndex = TetrisIndex(mCol / 2 - TETRIS_BAR_COL / 2,
+                            -mBar->getShape(mBarRot).r);
 
     mNextBar = getRandBar();
     mNextBarRot = getRandBarRot(mNextBar);
-
-    /** BUG: If There is a bar at an upper place, moveUpBar will
-        be failed */
-    /** When rotating Tetris bar, there will be some upper spaces
-        which should be deleted. */
-    for (int r = 0; r < TETRIS_FIELD_START_ROW; ++r)
-      moveUpBar();
-    return checkLocatable(mBarIndex, mBarRot);
+    TETRIS_LOG(TETRIS_LOG_SPAWN, mId, mBar->getType(), mBarIndex.c,
+               mBarIndex.r, mBarRot);
+    if (!checkLocatable(mBarIndex, mBarRot))
+      return false;
+    if (mListener)
+      mListener->spawn(this);
+    return true;
   }
 
   void setBarIndex(int x, int y) {
@@ -256,34 +948,229 @@ class TetrisField {
     mBarIndex.r = y;
   }
 
+  unsigned getId() { return mId; }
   unsigned getScore() { return mScore; }
   unsigned getLines() { return mLines; }
+  unsigned getPieces() { return mPieces; }
+  unsigned getClears(int lines) { return mClears[lines]; }
 
   void setScore(int score) { mScore = score; }
   void setLines(int lines) { mLines = lines; }
 };
 
+/**
+ * Field logic specialized on its grid storage. Collision and line
+ * checks are resolved against the concrete grid without indirection.
+ */
+template <class Grid>
+class TetrisFieldT : public TetrisField {
+ private:
+  Grid mGrid;
+
+ public:
+  TetrisFieldT() : TetrisField(Grid::ROW, Grid::COL) { init(); }
+  TetrisFieldT(int row, int col)
+    : TetrisField(row, col), mGrid(row, col) { init(); }
+
+  Grid &grid() { return mGrid; }
+
+  using TetrisField::checkLocatable;
+
+  bool checkLocatable(const TetrisBar *bar, TetrisIndex &next, int rot) {
+    return mGrid.fits(bar->getShape(rot), next.r, next.c);
+  }
+
+  /** Every kick is tested, the first fitting one is picked from a mask. */
+  int kick(const TetrisBar *bar, TetrisIndex index, int rot,
+           const TetrisKick *kicks, int size) {
+    const TetrisBarShape &shape = bar->getShape(rot);
+    unsigned fit = 0;
+    for (int k = 0; k < size; ++k)
+      fit |= (unsigned) mGrid.fits(shape, index.r + kicks[k].r,
+                                   index.c + kicks[k].c) << k;
+    return fit ? __builtin_ctz(fit) : -1;
+  }
+
+  void putBar() {
+    TETRIS_TRACE_ZONE("putBar");
+    BarType type = mBar->getType();
+    int indexSize = mBar->getIndexSize();
+    for (int pos = 0; pos < indexSize; ++pos) {
+      TetrisIndex index = mBar->getIndex(pos, mBarRot);
+      int r = mBarIndex.r + index.r;
+      int c = mBarIndex.c + index.c;
+      mGrid.set(r, c, type);
+      if (mRow - r > mHeight[c])
+        mHeight[c] = mRow - r;
+    }
+  }
+
+  /** Lower a column height until it reaches a filled cell. */
+  void settleHeight(int c) {
+    while (mHeight[c] > 0 && mGrid.isEmpty(mRow - mHeight[c], c))
+      mHeight[c]--;
+  }
+
+  bool checkLine(int row) { return mGrid.isFull(row); }
+
+  void deleteLine(int row) {
+    for (int r = row; r > 0; --r)
+      mGrid.moveRow(r, r - 1);
+    mGrid.clearRow(0);
+
+    for (int c = 0; c < mCol; ++c)
+      if (mHeight[c] >= mRow - row) {
+        mHeight[c]--;
+        settleHeight(c);
+      }
+  }
+
+  /** Compact the remaining rows downward in one pass. */
+  void deleteLine() {
+    TETRIS_TRACE_ZONE("deleteLine");
+    int dst = mRow - 1;
+    for (int src = mRow - 1; src >= 0; --src) {
+      if (mGrid.isFull(src))
+        continue;
+      if (dst != src)
+        mGrid.moveRow(dst, src);
+      dst--;
+    }
+
+    unsigned lines = dst + 1;
+    if (!lines)
+      return;
+
+    for (; dst >= 0; --dst)
+      mGrid.clearRow(dst);
+
+    /** Every full line was below the top of every column. */
+    for (int c = 0; c < mCol; ++c) {
+      mHeight[c] -= lines;
+      settleHeight(c);
+    }
+
+    static const unsigned garbage[TETRIS_BAR_MAX + 1] = {
+      0, 0, 1, 2, 4, 6,
+    };
+    mScore += lines;
+    mLines += lines;
+    mClears[lines]++;
+    mGarbage += garbage[lines];
+    TETRIS_LOG(TETRIS_LOG_LINES, mId, lines, mLines, mScore);
+  }
+
+  BarType getGrid(int r, int c) { return mGrid.get(r, c); }
+
+  void getOccupancy(int r, int row, unsigned char *cell) {
+    for (int end = r + row; r < end; ++r)
+      for (int c = 0; c < mCol; ++c)
+        *cell++ = !mGrid.isEmpty(r, c);
+  }
+
+  void setGrid(int r, int c, BarType t) {
+    mGrid.set(r, c, t);
+    if (t != BAR_TYPE_E && mRow - r > mHeight[c])
+      mHeight[c] = mRow - r;
+    else if (t == BAR_TYPE_E && mRow - r == mHeight[c])
+      settleHeight(c);
+  }
+
+  void clear() {
+    mGrid.clear();
+    std::fill(mHeight.begin(), mHeight.end(), 0);
+  }
+
+  void saveGrid(std::vector<unsigned char> &bytes) { mGrid.save(bytes); }
+  void restoreGrid(const std::vector<unsigned char> &bytes) {
+    mGrid.restore(bytes);
+  }
+
+  bool raiseGrid(int lines, int hole) {
+    lines = std::min(lines, mRow);
+    bool ret = true;
+    for (int c = 0; c < mCol; ++c)
+      ret = ret && mHeight[c] <= mRow - lines;
+
+    for (int r = 0; r < mRow - lines; ++r)
+      mGrid.moveRow(r, r + lines);
+    for (int r = mRow - lines; r < mRow; ++r) {
+      mGrid.clearRow(r);
+      for (int c = 0; c < mCol; ++c)
+        if (c != hole)
+          mGrid.set(r, c, BAR_TYPE_G);
+    }
+
+    for (int c = 0; c < mCol; ++c) {
+      if (mHeight[c])
+        mHeight[c] = std::min(mHeight[c] + lines, mRow);
+      else if (c != hole)
+        mHeight[c] = lines;
+    }
+    return ret;
+  }
+};
+
+typedef TetrisFieldT<TetrisGrid<TETRIS_FIELD_ROW, TETRIS_FIELD_COL> >
+  TetrisFieldStandard;
+typedef TetrisFieldT<TetrisGridWord> TetrisFieldWord;
+typedef TetrisFieldT<TetrisGridDynamic> TetrisFieldDynamic;
+
 class Tetris;
 
 class TetrisDrawer {
  protected:
   Tetris *mTetris;
 
-  virtual void drawFrame(TetrisField * field, int baseCol) = 0;
-  virtual void drawField(TetrisField *field, int baseCol) = 0;
-  virtual void drawBar(TetrisField *field, int baseCol) = 0;
-  virtual void drawScore(TetrisField *field, int baseCol) = 0;
-  virtual void drawNextBar(TetrisField *field, int baseCol) = 0;
+  /**
+   * Size of the screen and the room a board needs around its field
+   * for the frame, the score and the next bar, in the units of the
+   * backend. Set by subclasses before calling layout().
+   */
+  int mScreenRow;
+  int mScreenCol;
+  int mMarginRow;
+  int mMarginCol;
+  /** Boards are placed in cells of mBoardRow x mBoardCol. */
+  int mBoardRow;
+  int mBoardCol;
+  int mBoardLine;
+  /** Top row of the board being drawn, added by the backends. */
+  int mBaseRow;
+  /** Largest field area one board can show. */
+  int mViewRow;
+  int mViewCol;
+  /** Area drawn in the current frame, following the falling bar. */
+  TetrisViewport mView;
+
+  virtual void drawFrame(const TetrisSnapshot *snapshot, int baseCol) = 0;
+  virtual void drawField(const TetrisSnapshot *snapshot, int baseCol) = 0;
+  virtual void drawBar(const TetrisSnapshot *snapshot, int baseCol) = 0;
+  virtual void drawGhostBar(const TetrisSnapshot *snapshot, int baseCol) = 0;
+  virtual void drawScore(const TetrisSnapshot *snapshot, int baseCol) = 0;
+  virtual void drawNextBar(const TetrisSnapshot *snapshot, int baseCol) = 0;
   virtual void erase() = 0;
   virtual void update() = 0;
 
-  void draw(TetrisField *field, int baseCol);
+  void draw(const TetrisSnapshot *snapshot, int baseCol);
+
+  /**
+   * Split the screen into cells for every board of mTetris, as many
+   * per line as fit, and derive the viewport of one board.
+   */
+  void layout();
 
  public:
-  TetrisDrawer(Tetris *tetris) : mTetris(tetris) {}
+  TetrisDrawer(Tetris *tetris)
+    : mTetris(tetris), mScreenRow(0), mScreenCol(0), mMarginRow(0),
+      mMarginCol(0), mBoardRow(0), mBoardCol(0), mBoardLine(1),
+      mBaseRow(0), mViewRow(INT_MAX), mViewCol(INT_MAX) {}
   virtual ~TetrisDrawer() {}
   virtual void gameover() = 0;
 
+  int getViewRow() { return mViewRow; }
+  int getViewCol() { return mViewCol; }
+
   void draw();
 };
 
@@ -295,7 +1182,8 @@ class TetrisInputer {
   TetrisInputer(Tetris *tetris) : mTetris(tetris) {}
   virtual ~TetrisInputer() {}
 
-  virtual InputType input() = 0;
+  /** Return the next pending input, or INPUT_TYPE_EMPTY if none. */
+  virtual TetrisInputEvent input() = 0;
 };
 
 class TetrisTimer {
@@ -312,6 +1200,8 @@ class TetrisTimer {
 };
 
 #define TIMER_INTERVAL_MSEC (500)
+/** A tick later than this is logged as TETRIS_LOG_TIMER_OVERRUN. */
+#define TIMER_OVERRUN_MSEC (10)
 
 struct ThreadData {
 public:
@@ -341,29 +1231,113 @@ class TetrisTimerPthread : public TetrisTimer {
   bool isInterrupted() { return mData.interrupt; }
 };
 
+/**
+ * Game loop which replaces the one of Tetris::run(), like TetrisVersus.
+ * The fields only change in update(), which gets the player's inputs
+ * through push().
+ */
+class TetrisSession {
+ public:
+  virtual ~TetrisSession() {}
+
+  /** Field played by someone else, shown as a board, or NULL. */
+  virtual TetrisField *getRemote() = 0;
+  /** Queue an input of the player. */
+  virtual void push(InputType type) = 0;
+  /** Run the frames which are due. Return false once it is over. */
+  virtual bool update() = 0;
+  /** Microseconds until the next frame is due. */
+  virtual unsigned getTimeout() = 0;
+  virtual void print(std::ostream &os) = 0;
+};
+
+/** Field shown next to the player's, driven by its own inputer. */
+struct TetrisBoard {
+  TetrisField *field;
+  TetrisInputer *inputer;
+};
+
 class Tetris {
  private:
+  TetrisStartup mStartup;
   TetrisField *mField;
+  std::vector<TetrisBoard> mBoards;
   TetrisDrawer *mDrawer;
   TetrisInputer *mInputer;
   TetrisTimer *mTimer;
+  TetrisSession *mSession;
+  TetrisBarSet mBarSet;
+  TetrisLatency mLatency;
+  bool mVisible;
+  /** Iterations of the game loop before it quits, 0 for no limit. */
+  unsigned long long mFrames;
+
+  void runSession();
 
  protected:
-  Tetris() : mDrawer(NULL), mInputer(NULL), mTimer(NULL) {
-    mField = new TetrisField();
+  Tetris(int row = TETRIS_FIELD_ROW, int col = TETRIS_FIELD_COL)
+    : mDrawer(NULL), mInputer(NULL), mTimer(NULL), mSession(NULL),
+      mVisible(true), mFrames(0) {
+    if (getenv("TETRIS_LOG"))
+      TetrisLog::instance().open(getenv("TETRIS_LOG"));
+#ifdef TETRIS_TRACE
+    if (getenv("TETRIS_TRACE"))
+      TetrisTrace::instance().open(getenv("TETRIS_TRACE"));
+#endif
+#ifdef TETRIS_ALLOC
+    TetrisAlloc::open();
+#endif
+    mField = TetrisField::create(row, col);
+    if (getenv("TETRIS_ROTATION") &&
+        !strcmp(getenv("TETRIS_ROTATION"), "srs"))
+      mField->setRotation(TETRIS_ROTATION_SRS);
+    if (getenv("TETRIS_BARS") && mBarSet.load(getenv("TETRIS_BARS")))
+      mField->setBarSet(&mBarSet);
+    if (getenv("TETRIS_FRAMES"))
+      mFrames = strtoull(getenv("TETRIS_FRAMES"), NULL, 0);
+    mStartup.mark("field");
   }
 
-  virtual ~Tetris() {
-    delete mField;
-  }
+  virtual ~Tetris();
 
   void registerDrawer(TetrisDrawer *drawer) { mDrawer = drawer; }
   void registerInputer(TetrisInputer *inputer) { mInputer = inputer; }
   void registerTimer(TetrisTimer *timer) { mTimer = timer; }
 
+  /**
+   * Let session run the game instead of the timer, and add its remote
+   * field as a board. Tetris owns session, which may be NULL.
+   */
+  void registerSession(TetrisSession *session);
+
+  /**
+   * Add a board before the drawer is created. Tetris owns field and
+   * inputer. Gravity only applies to the player's field. A board
+   * without inputer is changed by someone else, like a TetrisSession.
+   */
+  void addBoard(TetrisField *field, TetrisInputer *inputer);
+
+  static TetrisInputEvent input(TetrisInputer *inputer) {
+    TETRIS_TRACE_ZONE("input");
+    TETRIS_ALLOC_SCOPE(TETRIS_ALLOC_INPUTER);
+    return inputer->input();
+  }
+
  public:
   void run();
   TetrisField *getField() { return mField; }
+
+  /** Board 0 is the player's field. */
+  int getBoardSize() { return mBoards.size() + 1; }
+  TetrisField *getBoard(int board) {
+    return board ? mBoards[board - 1].field : mField;
+  }
+  TetrisLatency *getLatency() { return &mLatency; }
+  TetrisStartup *getStartup() { return &mStartup; }
+
+  /** Drawing is skipped while the output is not visible. */
+  bool isVisible() { return mVisible; }
+  void setVisible(bool visible) { mVisible = visible; }
 };
 
 #endif /* __TETRIS_H */
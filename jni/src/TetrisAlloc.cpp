@@ -0,0 +1,169 @@
+/**
+ * @file TetrisAlloc.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ *
+ * Linked only with make ALLOC=1. The wrappers replace the allocation
+ * functions of glibc for the whole process, so everything here runs
+ * inside malloc: no locks, no allocation and no iostream.
+ */
+#include <TetrisAlloc.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execinfo.h>
+#include <unistd.h>
+
+#define ALLOC_BACKTRACE_NR (32)
+
+static std::atomic<bool> counting(false);
+static std::atomic<bool> steady(false);
+static bool check = false;
+static std::atomic<int> reported(0);
+static std::atomic<unsigned long long> calls[2][TETRIS_ALLOC_NR];
+static std::atomic<unsigned long long> bytes[2][TETRIS_ALLOC_NR];
+static unsigned long long frames = 0;
+static unsigned long long allocFrames = 0;
+static unsigned long long lastSteady = 0;
+
+static __thread int scope = TETRIS_ALLOC_OTHER;
+/** Set while reporting, whose own allocations are not counted. */
+static __thread bool inside = false;
+
+static const char *scopeName(int scope)
+{
+  static const char *name[] = {
+    "other", "field", "drawer", "inputer", "timer",
+  };
+  return name[scope];
+}
+
+static void report(int scope, size_t size)
+{
+  char line[128];
+  int len = snprintf(line, sizeof(line),
+                     "<error> %zu bytes allocated by %s after warm-up\n",
+                     size, scopeName(scope));
+  if (write(2, line, len) < 0)
+    return;
+
+  void *frame[ALLOC_BACKTRACE_NR];
+  int depth = backtrace(frame, ALLOC_BACKTRACE_NR);
+  backtrace_symbols_fd(frame, depth, 2);
+}
+
+static void count(size_t size)
+{
+  if (!counting.load(std::memory_order_relaxed) || inside)
+    return;
+
+  int phase = steady.load(std::memory_order_relaxed);
+  calls[phase][scope].fetch_add(1, std::memory_order_relaxed);
+  bytes[phase][scope].fetch_add(size, std::memory_order_relaxed);
+  if (!phase || (reported++ >= ALLOC_REPORT_MAX && !check))
+    return;
+
+  inside = true;
+  report(scope, size);
+  inside = false;
+  if (check)
+    abort();
+}
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+  count(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  count(nmemb * size);
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  count(size);
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+  count(size);
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+  count(size);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+  count(size);
+  *ptr = __libc_memalign(alignment, size);
+  return *ptr ? 0 : ENOMEM;
+}
+
+}
+
+void TetrisAlloc::open()
+{
+  const char *mode = getenv("TETRIS_ALLOC");
+  check = mode && !strcmp(mode, "check");
+
+  /** The first backtrace() loads libgcc, which allocates. */
+  void *frame[1];
+  backtrace(frame, 1);
+  counting = true;
+}
+
+void TetrisAlloc::frame()
+{
+  unsigned long long now = getSteady();
+  if (now != lastSteady)
+    allocFrames++;
+  lastSteady = now;
+  if (++frames == ALLOC_WARMUP_FRAMES)
+    steady = true;
+}
+
+int TetrisAlloc::getScope()
+{
+  return scope;
+}
+
+void TetrisAlloc::setScope(int value)
+{
+  scope = value;
+}
+
+unsigned long long TetrisAlloc::getSteady()
+{
+  unsigned long long ret = 0;
+  for (int i = 0; i < TETRIS_ALLOC_NR; ++i)
+    ret += calls[1][i].load(std::memory_order_relaxed);
+  return ret;
+}
+
+void TetrisAlloc::print(std::ostream &os)
+{
+  /** Printing may allocate. */
+  counting = false;
+  for (int i = 0; i < TETRIS_ALLOC_NR; ++i)
+    os << "alloc " << scopeName(i) << ": warm-up " << calls[0][i] << " ("
+       << bytes[0][i] << "B) steady " << calls[1][i] << " ("
+       << bytes[1][i] << "B)\n";
+  os << "alloc frames " << frames << ", " << allocFrames
+     << " allocating after " << ALLOC_WARMUP_FRAMES << "\n";
+}
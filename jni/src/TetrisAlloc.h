@@ -0,0 +1,71 @@
+/**
+ * @file TetrisAlloc.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISALLOC_H
+#define __TETRISALLOC_H
+
+#include <iostream>
+
+/** Part of the loop an allocation is charged to. */
+enum TetrisAllocScope {
+  TETRIS_ALLOC_OTHER = 0,
+  TETRIS_ALLOC_FIELD,
+  TETRIS_ALLOC_DRAWER,
+  TETRIS_ALLOC_INPUTER,
+  TETRIS_ALLOC_TIMER,
+  TETRIS_ALLOC_NR,
+};
+
+/** Loop iterations allowed to allocate, filling caches and buffers. */
+#define ALLOC_WARMUP_FRAMES (100)
+/** Steady allocations reported with a backtrace. */
+#define ALLOC_REPORT_MAX (8)
+
+/**
+ * Allocation counter. Built with -DTETRIS_ALLOC (make ALLOC=1), malloc
+ * and friends of glibc are wrapped to count the calls and bytes of
+ * every scope, operator new included. After ALLOC_WARMUP_FRAMES calls
+ * of frame() the loop is expected not to allocate any more: each
+ * allocation is then reported with a backtrace, and with
+ * TETRIS_ALLOC=check the process aborts on the first one.
+ */
+class TetrisAlloc {
+ public:
+  /** Start counting, reading TETRIS_ALLOC. */
+  static void open();
+  /** One loop iteration is over. */
+  static void frame();
+  /** Stop counting and print the counts. */
+  static void print(std::ostream &os);
+
+  static int getScope();
+  static void setScope(int scope);
+  /** Allocations after warm-up. */
+  static unsigned long long getSteady();
+};
+
+/** Charge allocations to scope until the end of the enclosing block. */
+class TetrisAllocScopeGuard {
+ private:
+  int mScope;
+
+ public:
+  TetrisAllocScopeGuard(int scope) : mScope(TetrisAlloc::getScope()) {
+    TetrisAlloc::setScope(scope);
+  }
+  ~TetrisAllocScopeGuard() { TetrisAlloc::setScope(mScope); }
+};
+
+#ifdef TETRIS_ALLOC
+#define TETRIS_ALLOC_JOIN(a, b) a##b
+#define TETRIS_ALLOC_NAME(line) TETRIS_ALLOC_JOIN(allocScope, line)
+#define TETRIS_ALLOC_SCOPE(scope) \
+  TetrisAllocScopeGuard TETRIS_ALLOC_NAME(__LINE__)(scope)
+#define TETRIS_ALLOC_FRAME() TetrisAlloc::frame()
+#else
+#define TETRIS_ALLOC_SCOPE(scope)
+#define TETRIS_ALLOC_FRAME()
+#endif
+
+#endif /* __TETRISALLOC_H */
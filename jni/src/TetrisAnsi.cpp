@@ -0,0 +1,397 @@
+/**
+ * @file TetrisAnsi.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisAnsi.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+
+enum {
+  ANSI_DEFAULT_ROW = 24,
+  ANSI_DEFAULT_COL = 80,
+  ANSI_COLOR_DEFAULT = 39,
+};
+
+static int type2color(BarType type)
+{
+  switch (type) {
+#define CASE(type, color) case type: { return color; }
+    CASE(BAR_TYPE_I, 36);
+    CASE(BAR_TYPE_J, 34);
+    CASE(BAR_TYPE_L, 37);
+    CASE(BAR_TYPE_O, 33);
+    CASE(BAR_TYPE_S, 32);
+    CASE(BAR_TYPE_T, 35);
+    CASE(BAR_TYPE_Z, 31);
+#undef CASE
+  default:
+    break;
+  }
+  return ANSI_COLOR_DEFAULT;
+}
+
+TetrisDrawerAnsi::TetrisDrawerAnsi(Tetris *tetris)
+  : TetrisDrawer(tetris), mRow(ANSI_DEFAULT_ROW), mCol(ANSI_DEFAULT_COL),
+    mCursorRow(0), mCursorCol(0), mColor(ANSI_COLOR_DEFAULT)
+{
+  struct winsize ws;
+  if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) && ws.ws_row && ws.ws_col) {
+    mRow = ws.ws_row;
+    mCol = ws.ws_col;
+  }
+
+  AnsiCell blank = { ' ', ANSI_COLOR_DEFAULT };
+  mBack.assign(mRow * mCol, blank);
+  mFront.assign(mRow * mCol, blank);
+  mOutput.reserve(mRow * mCol * 8);
+
+  /** Keep room for the frame, the score line and the next bar. */
+  mScreenRow = mRow;
+  mScreenCol = mCol;
+  mMarginRow = 4;
+  mMarginCol = 10;
+  layout();
+
+  /** Alternate screen, hidden cursor, cleared screen at home. */
+  append("\033[?1049h\033[?25l\033[0m\033[2J\033[H");
+  flush();
+}
+
+TetrisDrawerAnsi::~TetrisDrawerAnsi()
+{
+  append("\033[0m\033[?25h\033[?1049l");
+  flush();
+  if (getenv("TETRIS_STAT"))
+    mBytes.print(std::cerr, "bytes per frame", "B");
+}
+
+void TetrisDrawerAnsi::append(const char *str)
+{
+  while (*str)
+    mOutput.push_back(*str++);
+}
+
+void TetrisDrawerAnsi::appendNumber(unsigned value)
+{
+  char digit[16];
+  int size = 0;
+  do {
+    digit[size++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (size)
+    append(digit[--size]);
+}
+
+/**
+ * Pick the shortest way to reach a cell. Short gaps on the same row
+ * are filled by writing the unchanged cells again.
+ */
+void TetrisDrawerAnsi::moveCursor(int row, int col)
+{
+  if (row == mCursorRow && col == mCursorCol)
+    return;
+
+  if (row == mCursorRow && col > mCursorCol) {
+    int gap = col - mCursorCol;
+    bool rewrite = gap <= 3;
+    for (int c = mCursorCol; rewrite && c < col; ++c)
+      rewrite = mBack[row * mCol + c].color == mColor;
+    if (rewrite) {
+      for (int c = mCursorCol; c < col; ++c)
+        append(mBack[row * mCol + c].ch);
+    } else {
+      append("\033[");
+      appendNumber(gap);
+      append('C');
+    }
+  } else {
+    append("\033[");
+    appendNumber(row + 1);
+    append(';');
+    appendNumber(col + 1);
+    append('H');
+  }
+  mCursorRow = row;
+  mCursorCol = col;
+}
+
+void TetrisDrawerAnsi::setColor(int color)
+{
+  if (color == mColor)
+    return;
+  append("\033[");
+  appendNumber(color);
+  append('m');
+  mColor = color;
+}
+
+void TetrisDrawerAnsi::flush()
+{
+  size_t size = mOutput.size();
+  size_t done = 0;
+  while (done < size) {
+    ssize_t ret = write(STDOUT_FILENO, &mOutput[done], size - done);
+    if (ret <= 0)
+      break;
+    done += ret;
+  }
+  mOutput.clear();
+}
+
+void TetrisDrawerAnsi::erase()
+{
+  AnsiCell blank = { ' ', ANSI_COLOR_DEFAULT };
+  std::fill(mBack.begin(), mBack.end(), blank);
+}
+
+void TetrisDrawerAnsi::update()
+{
+  for (int r = 0; r < mRow; ++r)
+    for (int c = 0; c < mCol; ++c) {
+      int pos = r * mCol + c;
+      if (mBack[pos] == mFront[pos])
+        continue;
+      moveCursor(r, c);
+      setColor(mBack[pos].color);
+      append(mBack[pos].ch);
+      mFront[pos] = mBack[pos];
+      /** The cursor does not move past the last column. */
+      mCursorCol = c + 1 < mCol ? c + 1 : -1;
+    }
+
+  mBytes.add(mOutput.size());
+  flush();
+}
+
+void TetrisDrawerAnsi::drawGrid(int x, int y, const char *dot, int color)
+{
+  while (*dot)
+    drawGrid(x, y++, *dot++, color);
+}
+
+void TetrisDrawerAnsi::drawGrid(int x, int y, char dot, int color)
+{
+  x += mBaseRow;
+  if (x < 0 || x >= mRow || y < 0 || y >= mCol)
+    return;
+  AnsiCell cell = { dot, (unsigned char) (color ? color : ANSI_COLOR_DEFAULT) };
+  mBack[x * mCol + y] = cell;
+}
+
+void TetrisDrawerAnsi::drawGrid(int x, int y, unsigned value)
+{
+  static const char number[] = "0123456789";
+  int digit = 0;
+  unsigned remain = value;
+
+  while (remain >= 10) {
+    remain /= 10;
+    digit++;
+  }
+
+  while (digit >= 1) {
+    drawGrid(x, y + digit, number[value % 10]);
+    value /= 10;
+    digit--;
+  }
+
+  drawGrid(x, y, number[value % 10]);
+}
+
+void TetrisDrawerAnsi::drawFrameTopOrButtom(int row, int col, int baseCol)
+{
+  drawGrid(row, baseCol, "+");
+  for (int c = 1; c < col + 1; ++c)
+    drawGrid(row, baseCol + c, "-");
+  drawGrid(row, baseCol + col + 1, "+");
+}
+
+void TetrisDrawerAnsi::drawFrameInner(int row, int col, int baseCol)
+{
+  drawGrid(row, baseCol, "|");
+  drawGrid(row, baseCol + col + 1, "|");
+}
+
+void TetrisDrawerAnsi::drawFrame(const TetrisSnapshot *snapshot, int baseCol)
+{
+  int row = mView.row;
+  int col = mView.col;
+  drawFrameTopOrButtom(0, col, baseCol);
+  for (int r = 1; r < row + 1; ++r)
+    drawFrameInner(r, col, baseCol);
+  drawFrameTopOrButtom(row + 1, col, baseCol);
+}
+
+void TetrisDrawerAnsi::drawField(const TetrisSnapshot *snapshot, int baseCol)
+{
+  for (int r = 0; r < mView.row; ++r)
+    for (int c = 0; c < mView.col; ++c) {
+      BarType type = snapshot->getGrid(mView.r + r, mView.c + c);
+      drawGrid(r + 1, baseCol + c + 1, (char) type, type2color(type));
+    }
+}
+
+void TetrisDrawerAnsi::drawBar(const TetrisBar *bar, int rot, int r, int c)
+{
+  BarType type = bar->getType();
+  int indexSize = bar->getIndexSize();
+  for (int pos = 0; pos < indexSize; ++pos) {
+    TetrisIndex index = bar->getIndex(pos, rot);
+    drawGrid(r + index.r, c + index.c, (char) type, type2color(type));
+  }
+}
+
+void TetrisDrawerAnsi::drawFieldBar(const TetrisBar *bar, int rot,
+                                    TetrisIndex barIndex, char dot,
+                                    int baseCol)
+{
+  int color = dot == '.' ? ANSI_COLOR_DEFAULT : type2color(bar->getType());
+  int indexSize = bar->getIndexSize();
+  for (int pos = 0; pos < indexSize; ++pos) {
+    TetrisIndex index = bar->getIndex(pos, rot);
+    int r = barIndex.r + index.r;
+    int c = barIndex.c + index.c;
+    if (mView.contains(r, c))
+      drawGrid(r - mView.r + 1, baseCol + c - mView.c + 1, dot, color);
+  }
+}
+
+void TetrisDrawerAnsi::drawBar(const TetrisSnapshot *snapshot, int baseCol)
+{
+  const TetrisBar *bar = snapshot->getBar();
+  drawFieldBar(bar, snapshot->getBarRot(), snapshot->getBarIndex(),
+               (char) bar->getType(), baseCol);
+}
+
+void TetrisDrawerAnsi::drawGhostBar(const TetrisSnapshot *snapshot, int baseCol)
+{
+  drawFieldBar(snapshot->getBar(), snapshot->getBarRot(),
+               snapshot->getGhostIndex(), '.', baseCol);
+}
+
+#define TETRIS_DRAW(snapshot, name, r, c)                 \
+  do {                                                 \
+    static const char prefix[] = #name ": ";           \
+    static const size_t size = sizeof(prefix);         \
+    drawGrid(r, c + 1, prefix);                        \
+    drawGrid(r, c + 1 + size, snapshot->get##name());  \
+  } while (0)
+
+void TetrisDrawerAnsi::drawScore(const TetrisSnapshot *snapshot, int baseCol)
+{
+  TETRIS_DRAW(snapshot, Score, mView.row + 3, baseCol);
+}
+
+#undef TETRIS_DRAW
+
+void TetrisDrawerAnsi::drawNextBar(const TetrisSnapshot *snapshot, int baseCol)
+{
+  const TetrisBar *nextBar = snapshot->getNextBar();
+  int nextRot = snapshot->getNextBarRot();
+  drawBar(nextBar, nextRot, 2, mView.col + 5 + baseCol);
+}
+
+void TetrisDrawerAnsi::gameover()
+{
+  erase();
+  drawGrid(10, 3, "Game Over");
+  update();
+}
+
+TetrisInputerAnsi::TetrisInputerAnsi(Tetris *tetris)
+  : TetrisInputer(tetris), mSize(0), mPos(0), mFilled(false)
+{
+  struct termios raw;
+  tcgetattr(STDIN_FILENO, &mTermios);
+  raw = mTermios;
+  raw.c_lflag &= ~(ICANON | ECHO);
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+TetrisInputerAnsi::~TetrisInputerAnsi()
+{
+  tcsetattr(STDIN_FILENO, TCSANOW, &mTermios);
+}
+
+/** Wait briefly for keys so that an idle game does not spin. */
+bool TetrisInputerAnsi::fill()
+{
+  struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+  if (poll(&fd, 1, ANSI_INPUT_WAIT_MSEC) <= 0)
+    return false;
+  ssize_t ret = read(STDIN_FILENO, mBuffer, sizeof(mBuffer));
+  if (ret <= 0)
+    return false;
+  mSize = ret;
+  mPos = 0;
+  return true;
+}
+
+TetrisInputEvent TetrisInputerAnsi::input()
+{
+  if (!mFilled) {
+    fill();
+    mFilled = true;
+  }
+
+  while (mPos < mSize) {
+    char ch = mBuffer[mPos++];
+
+    /** Arrow keys are ESC [ x or ESC O x. */
+    if (ch == '\033' && mPos + 1 < mSize &&
+        (mBuffer[mPos] == '[' || mBuffer[mPos] == 'O')) {
+      ch = mBuffer[mPos + 1];
+      mPos += 2;
+      switch (ch) {
+#define CASE(key, type) case key: { return type; }
+        CASE('A', INPUT_TYPE_UP);
+        CASE('B', INPUT_TYPE_DOWN);
+        CASE('C', INPUT_TYPE_RIGHT);
+        CASE('D', INPUT_TYPE_LEFT);
+#undef CASE
+      default:
+        break;
+      }
+      continue;
+    }
+
+    switch (ch) {
+#define CASE(key, type) case key: { return type; }
+      CASE('z', INPUT_TYPE_ROT_LEFT);
+      CASE('x', INPUT_TYPE_ROT_RIGHT);
+      CASE(' ', INPUT_TYPE_DROP);
+      CASE('q', INPUT_TYPE_QUIT);
+#undef CASE
+    default:
+      break;
+    }
+  }
+
+  mSize = 0;
+  mPos = 0;
+  mFilled = false;
+  return INPUT_TYPE_EMPTY;
+}
+
+TetrisAnsi::TetrisAnsi(int row, int col, int boards)
+  : Tetris(row, col)
+{
+  registerSession(TetrisVersus::create(getField()));
+  for (int board = 1; board < boards; ++board) {
+    TetrisField *field = TetrisField::create(row, col);
+    addBoard(field, TetrisInputerPlugin::create(this, field));
+  }
+  registerDrawer(mDrawer = new TetrisDrawerAnsi(this));
+  registerInputer(mInputer = new TetrisInputerAnsi(this));
+  registerTimer(mTimer = new TetrisTimerPthread(this));
+}
+
+TetrisAnsi::~TetrisAnsi()
+{
+  delete mDrawer;
+  delete mInputer;
+  delete mTimer;
+}
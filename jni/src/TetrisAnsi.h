@@ -0,0 +1,107 @@
+/**
+ * @file TetrisAnsi.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISANSI_H
+#define __TETRISANSI_H
+
+#include <Tetris.h>
+#include <TetrisPlugin.h>
+#include <TetrisVersus.h>
+#include <termios.h>
+
+/** One character cell of the terminal. */
+struct AnsiCell {
+  char ch;
+  unsigned char color;
+
+  bool operator==(const AnsiCell &cell) const {
+    return ch == cell.ch && color == cell.color;
+  }
+  bool operator!=(const AnsiCell &cell) const { return !(*this == cell); }
+};
+
+/**
+ * Drawer which writes VT100/ANSI sequences without terminfo. Frames
+ * are drawn into a back buffer, compared with the front buffer, and
+ * only the changed cells are sent with a single write().
+ */
+class TetrisDrawerAnsi : public TetrisDrawer {
+ private:
+  int mRow;
+  int mCol;
+  std::vector<AnsiCell> mBack;
+  std::vector<AnsiCell> mFront;
+  std::vector<char> mOutput;
+
+  /** Where the terminal cursor is and which color is set. */
+  int mCursorRow;
+  int mCursorCol;
+  int mColor;
+
+  TetrisHistogram mBytes;
+
+  void append(const char *str);
+  void append(char ch) { mOutput.push_back(ch); }
+  void appendNumber(unsigned value);
+  void moveCursor(int row, int col);
+  void setColor(int color);
+  void flush();
+
+ protected:
+  void drawFrame(const TetrisSnapshot *snapshot, int baseCol);
+  void drawField(const TetrisSnapshot *snapshot, int baseCol);
+  void drawBar(const TetrisSnapshot *snapshot, int baseCol);
+  void drawGhostBar(const TetrisSnapshot *snapshot, int baseCol);
+  void drawScore(const TetrisSnapshot *snapshot, int baseCol);
+  void drawNextBar(const TetrisSnapshot *snapshot, int baseCol);
+  void erase();
+  void update();
+
+  void drawGrid(int x, int y, const char *dot, int color = 0);
+  void drawGrid(int x, int y, char dot, int color = 0);
+  void drawGrid(int x, int y, unsigned value);
+  void drawFrameTopOrButtom(int row, int col, int baseCol);
+  void drawFrameInner(int row, int col, int baseCol);
+  void drawBar(const TetrisBar *bar, int rot, int r, int c);
+  void drawFieldBar(const TetrisBar *bar, int rot, TetrisIndex barIndex,
+                    char dot, int baseCol);
+
+ public:
+  TetrisDrawerAnsi(Tetris *tetris);
+  ~TetrisDrawerAnsi();
+  void gameover();
+};
+
+#define ANSI_INPUT_WAIT_MSEC (16)
+
+class TetrisInputerAnsi : public TetrisInputer {
+ private:
+  struct termios mTermios;
+  char mBuffer[64];
+  int mSize;
+  int mPos;
+  bool mFilled;
+
+  bool fill();
+
+ public:
+  TetrisInputerAnsi(Tetris *tetris);
+  ~TetrisInputerAnsi();
+  TetrisInputEvent input();
+};
+
+class TetrisAnsi : public Tetris {
+ private:
+  TetrisDrawerAnsi *mDrawer;
+  TetrisInputerAnsi *mInputer;
+  TetrisTimerPthread *mTimer;
+
+ public:
+  /** Boards other than the player's are played by TetrisAutoplay. */
+  TetrisAnsi(int row = TETRIS_FIELD_ROW, int col = TETRIS_FIELD_COL,
+             int boards = 1);
+  ~TetrisAnsi();
+};
+
+#endif /* __TETRISANSI_H */
@@ -0,0 +1,321 @@
+/**
+ * @file TetrisAutoplay.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisAutoplay.h>
+#include <cfloat>
+
+/** Pierre Dellacherie's features with the weights tuned by El-Tetris. */
+static const double defaultWeight[TETRIS_FEATURE_NR] = {
+  -4.500158825082766,
+  3.4181268101392694,
+  -3.2178882868487753,
+  -9.348695305445199,
+  -7.899265427351652,
+  -3.3855972247263626,
+};
+
+TetrisAutoplay::TetrisAutoplay()
+  : mSurface(NULL), mSurfaceWeight(0)
+{
+  setWeight(defaultWeight);
+}
+
+void TetrisAutoplay::setWeight(const double *weight)
+{
+  for (int i = 0; i < TETRIS_FEATURE_NR; ++i)
+    mWeight[i] = weight[i];
+}
+
+void TetrisAutoplay::feature(TetrisField *field, const TetrisBar *bar,
+                             TetrisIndex index, int rot, double *value)
+{
+  int row = field->getRow();
+  int col = field->getCol();
+  int indexSize = bar->getIndexSize();
+
+  /** Only the rows up to the highest column and the bar matter. */
+  int top = row;
+  for (int c = 0; c < col; ++c)
+    if (row - field->getHeight(c) < top)
+      top = row - field->getHeight(c);
+  int landing = 0;
+  for (int pos = 0; pos < indexSize; ++pos) {
+    int r = index.r + bar->getIndex(pos, rot).r;
+    if (r < top)
+      top = r;
+    landing += row - r;
+  }
+
+  int height = row - top;
+  mCell.resize((size_t) height * col);
+  field->getOccupancy(top, height, &mCell[0]);
+  for (int pos = 0; pos < indexSize; ++pos) {
+    TetrisIndex cell = bar->getIndex(pos, rot);
+    mCell[(index.r + cell.r - top) * col + index.c + cell.c] = 1;
+  }
+
+  /** Delete full lines, counting the bar cells they take away. */
+  int lines = 0;
+  int eroded = 0;
+  int dst = height - 1;
+  for (int src = height - 1; src >= 0; --src) {
+    unsigned char *line = &mCell[src * col];
+    int filled = 0;
+    for (int c = 0; c < col; ++c)
+      filled += line[c];
+    if (filled == col) {
+      lines++;
+      for (int pos = 0; pos < indexSize; ++pos)
+        eroded += index.r + bar->getIndex(pos, rot).r == top + src;
+      continue;
+    }
+    if (dst != src)
+      std::copy(line, line + col, &mCell[dst * col]);
+    dst--;
+  }
+  int first = dst + 1;
+
+  int rowTransitions = 0;
+  for (int r = first; r < height; ++r) {
+    const unsigned char *line = &mCell[r * col];
+    unsigned char prev = 1;
+    for (int c = 0; c < col; ++c) {
+      rowTransitions += line[c] != prev;
+      prev = line[c];
+    }
+    rowTransitions += !prev;
+  }
+
+  int colTransitions = 0;
+  int holes = 0;
+  int wells = 0;
+  mHeight.assign(col, 0);
+  for (int c = 0; c < col; ++c) {
+    unsigned char prev = 0;
+    bool covered = false;
+    int depth = 0;
+    for (int r = first; r < height; ++r) {
+      unsigned char cell = mCell[r * col + c];
+      colTransitions += cell != prev;
+      prev = cell;
+      if (cell) {
+        if (!covered)
+          mHeight[c] = height - r;
+        covered = true;
+        depth = 0;
+        continue;
+      }
+      if (covered)
+        holes++;
+      bool left = c == 0 || mCell[r * col + c - 1];
+      bool right = c == col - 1 || mCell[r * col + c + 1];
+      if (left && right && !covered)
+        wells += ++depth;
+      else
+        depth = 0;
+    }
+    colTransitions += !prev;
+  }
+
+  value[TETRIS_FEATURE_LANDING_HEIGHT] = (double) landing / indexSize;
+  value[TETRIS_FEATURE_ERODED_CELLS] = lines * eroded;
+  value[TETRIS_FEATURE_ROW_TRANSITIONS] = rowTransitions;
+  value[TETRIS_FEATURE_COL_TRANSITIONS] = colTransitions;
+  value[TETRIS_FEATURE_HOLES] = holes;
+  value[TETRIS_FEATURE_WELLS] = wells;
+}
+
+double TetrisAutoplay::evaluate(TetrisField *field, const TetrisBar *bar,
+                                TetrisIndex index, int rot)
+{
+  double value[TETRIS_FEATURE_NR];
+  feature(field, bar, index, rot, value);
+
+  double score = 0;
+  for (int i = 0; i < TETRIS_FEATURE_NR; ++i)
+    score += mWeight[i] * value[i];
+  if (mSurface && mSurface->getCol() == field->getCol())
+    score += mSurfaceWeight *
+      mSurface->lookup(&mHeight[0], field->getNextBar()->getType());
+  return score;
+}
+
+/**
+ * Lower index until bar turns clockwise from rot there, as a player
+ * holding down before rotating near the ceiling. turned is where the
+ * bar ends up after any kick. Return false if it never turns.
+ */
+static bool lowerToRotate(TetrisField *field, const TetrisBar *bar,
+                          TetrisIndex &index, TetrisIndex &turned, int rot)
+{
+  while (1) {
+    int next = rot;
+    turned = index;
+    if (field->tryRotate(bar, turned, next, +1) >= 0)
+      return true;
+    TetrisIndex below(index.c, index.r + 1);
+    if (!field->checkLocatable(bar, below, rot))
+      return false;
+    index = below;
+  }
+}
+
+bool TetrisAutoplay::search(TetrisField *field, TetrisMove &move)
+{
+  const TetrisBar *bar = field->getBar();
+  TetrisIndex spawn = field->getBarIndex();
+  int rotSize = bar->getRotSize();
+  int rot = field->getBarRot();
+  bool found = false;
+
+  /** Sized for the highest stack once, feature() only resizes within. */
+  mCell.reserve((size_t) (field->getRow() + TETRIS_BAR_MAX) *
+                field->getCol());
+  mHeight.reserve(field->getCol());
+
+  move.score = -DBL_MAX;
+  for (int step = 0; step < rotSize; ++step) {
+    if (step) {
+      TetrisIndex turned;
+      if (!lowerToRotate(field, bar, spawn, turned, rot))
+        break;
+      spawn = turned;
+      rot = (rot + 1) % rotSize;
+    }
+
+    /** Slide left first, then right, as far as the bar goes. */
+    for (int dir = -1; dir <= 1; dir += 2) {
+      TetrisIndex index = spawn;
+      if (dir > 0)
+        index.c++;
+      while (field->checkLocatable(bar, index, rot)) {
+        TetrisIndex drop(index.c, field->getDropRow(bar, index, rot));
+        double score = evaluate(field, bar, drop, rot);
+        if (score > move.score) {
+          move.rot = rot;
+          move.index = drop;
+          move.score = score;
+          found = true;
+        }
+        index.c += dir;
+      }
+    }
+  }
+  return found;
+}
+
+bool TetrisAutoplay::reach(TetrisField *field, int rot, int col,
+                           TetrisIndex &drop)
+{
+  const TetrisBar *bar = field->getBar();
+  TetrisIndex index = field->getBarIndex();
+  int now = field->getBarRot();
+  if (rot < 0 || rot >= bar->getRotSize())
+    return false;
+
+  while (now != rot) {
+    TetrisIndex turned;
+    if (!lowerToRotate(field, bar, index, turned, now))
+      return false;
+    index = turned;
+    now = (now + 1) % bar->getRotSize();
+  }
+
+  int dir = col < index.c ? -1 : 1;
+  while (index.c != col) {
+    TetrisIndex side(index.c + dir, index.r);
+    if (!field->checkLocatable(bar, side, rot))
+      return false;
+    index = side;
+  }
+  drop = TetrisIndex(col, field->getDropRow(bar, index, rot));
+  return true;
+}
+
+bool TetrisAutoplay::apply(TetrisField *field, const TetrisMove &move)
+{
+  const TetrisBar *bar = field->getBar();
+  while (field->getBarRot() != move.rot) {
+    TetrisIndex index = field->getBarIndex();
+    TetrisIndex turned;
+    if (!lowerToRotate(field, bar, index, turned, field->getBarRot()))
+      break;
+    while (field->getBarIndex().r < index.r)
+      field->input(INPUT_TYPE_DOWN);
+    field->input(INPUT_TYPE_ROT_RIGHT);
+  }
+
+  int dx = move.index.c - field->getBarIndex().c;
+  InputType shift = dx < 0 ? INPUT_TYPE_LEFT : INPUT_TYPE_RIGHT;
+  for (int i = dx < 0 ? -dx : dx; i > 0; --i)
+    field->input(shift);
+
+  field->input(INPUT_TYPE_DROP);
+  return !field->isGameOver();
+}
+
+InputType TetrisAutoplay::step(TetrisField *field, const TetrisMove &move)
+{
+  /** Same moves as apply(), one at a time. */
+  const TetrisBar *bar = field->getBar();
+  TetrisIndex index = field->getBarIndex();
+  int rot = field->getBarRot();
+  if (rot != move.rot) {
+    TetrisIndex turned = index;
+    int next = rot;
+    if (field->tryRotate(bar, turned, next, +1) >= 0)
+      return INPUT_TYPE_ROT_RIGHT;
+    TetrisIndex below(index.c, index.r + 1);
+    if (field->checkLocatable(bar, below, rot))
+      return INPUT_TYPE_DOWN;
+    return INPUT_TYPE_DROP;
+  }
+
+  if (index.c != move.index.c) {
+    int dir = index.c < move.index.c ? 1 : -1;
+    TetrisIndex side(index.c + dir, index.r);
+    if (field->checkLocatable(bar, side, rot))
+      return dir > 0 ? INPUT_TYPE_RIGHT : INPUT_TYPE_LEFT;
+  }
+  return INPUT_TYPE_DROP;
+}
+
+bool TetrisAutoplay::play(TetrisField *field)
+{
+  TetrisMove move;
+  if (field->isGameOver() || !search(field, move))
+    return false;
+  return apply(field, move);
+}
+
+TetrisInputerAutoplay::TetrisInputerAutoplay(Tetris *tetris,
+                                             TetrisField *field)
+  : TetrisInputer(tetris), mField(field), mPieces(0), mSearched(false),
+    mNext(0)
+{
+
+}
+
+TetrisInputEvent TetrisInputerAutoplay::input()
+{
+  unsigned long long now = TetrisClock::nsec();
+  if (now < mNext)
+    return INPUT_TYPE_EMPTY;
+  mNext = now + AUTOPLAY_INPUT_MSEC * 1000000ULL;
+
+  if (mField->isGameOver()) {
+    mField->reset(now ^ (unsigned long long) (size_t) mField);
+    mSearched = false;
+    return INPUT_TYPE_EMPTY;
+  }
+
+  if (!mSearched || mField->getPieces() != mPieces) {
+    mPieces = mField->getPieces();
+    mSearched = true;
+    if (!mAutoplay.search(mField, mMove))
+      return INPUT_TYPE_DROP;
+  }
+
+  return TetrisAutoplay::step(mField, mMove);
+}
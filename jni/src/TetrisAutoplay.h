@@ -0,0 +1,116 @@
+/**
+ * @file TetrisAutoplay.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISAUTOPLAY_H
+#define __TETRISAUTOPLAY_H
+
+#include <Tetris.h>
+#include <TetrisSurface.h>
+
+/** Board features scored for a placement, after full lines are removed. */
+enum TetrisFeature {
+  TETRIS_FEATURE_LANDING_HEIGHT = 0,
+  TETRIS_FEATURE_ERODED_CELLS,
+  TETRIS_FEATURE_ROW_TRANSITIONS,
+  TETRIS_FEATURE_COL_TRANSITIONS,
+  TETRIS_FEATURE_HOLES,
+  TETRIS_FEATURE_WELLS,
+  TETRIS_FEATURE_NR,
+};
+
+#define AUTOPLAY_SURFACE_WEIGHT (-2.0)
+
+/** Placement of the falling bar: rotation, column and landing row. */
+struct TetrisMove {
+  int rot;
+  TetrisIndex index;
+  double score;
+
+  TetrisMove() : rot(0), score(0) {}
+};
+
+/**
+ * Heuristic player. Every rotation and column the falling bar reaches
+ * by rotating at its spawn and sliding sideways is dropped on the
+ * field and scored by a weighted sum of board features.
+ */
+class TetrisAutoplay {
+ private:
+  double mWeight[TETRIS_FEATURE_NR];
+
+  /** Scratch occupancy of the field, row major. */
+  std::vector<unsigned char> mCell;
+  /** Column heights left by the last feature() call. */
+  std::vector<int> mHeight;
+
+  const TetrisSurface *mSurface;
+  double mSurfaceWeight;
+
+ public:
+  TetrisAutoplay();
+
+  void setWeight(const double *weight);
+  const double *getWeight() const { return mWeight; }
+
+  /**
+   * Also score a placement by how well the next bar fits the surface
+   * it leaves, looked up in surface instead of searched. Fields of
+   * another width than the table ignore it.
+   */
+  void setSurface(const TetrisSurface *surface,
+                  double weight = AUTOPLAY_SURFACE_WEIGHT) {
+    mSurface = surface;
+    mSurfaceWeight = weight;
+  }
+
+  /** Features of the field with bar put at index and rot. */
+  void feature(TetrisField *field, const TetrisBar *bar, TetrisIndex index,
+               int rot, double *value);
+  double evaluate(TetrisField *field, const TetrisBar *bar,
+                  TetrisIndex index, int rot);
+
+  /** Best placement of the falling bar. Return false if none. */
+  bool search(TetrisField *field, TetrisMove &move);
+
+  /**
+   * Landing index of the falling bar when apply() turns it to rot and
+   * moves it to column col. Return false if it cannot get there.
+   */
+  static bool reach(TetrisField *field, int rot, int col,
+                    TetrisIndex &drop);
+
+  /** Move the falling bar to move through inputs and drop it. */
+  static bool apply(TetrisField *field, const TetrisMove &move);
+
+  /** Next input of apply() from where the falling bar is now. */
+  static InputType step(TetrisField *field, const TetrisMove &move);
+
+  /** Search and apply. Return false once the game is over. */
+  bool play(TetrisField *field);
+};
+
+#define AUTOPLAY_INPUT_MSEC (50)
+
+/**
+ * Inputer for a board played by TetrisAutoplay. One input is sent
+ * every AUTOPLAY_INPUT_MSEC toward the best placement, so the moves
+ * can be followed on screen, and a new game starts when one is over.
+ */
+class TetrisInputerAutoplay : public TetrisInputer {
+ private:
+  TetrisField *mField;
+  TetrisAutoplay mAutoplay;
+  TetrisMove mMove;
+  /** Pieces locked when mMove was searched. */
+  unsigned mPieces;
+  bool mSearched;
+  unsigned long long mNext;
+
+ public:
+  TetrisInputerAutoplay(Tetris *tetris, TetrisField *field);
+  ~TetrisInputerAutoplay() {}
+  TetrisInputEvent input();
+};
+
+#endif /* __TETRISAUTOPLAY_H */
@@ -0,0 +1,166 @@
+/**
+ * @file TetrisBot.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisBot.h>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+static void wake(uint32_t *word)
+{
+#ifdef __linux__
+  /** Not FUTEX_PRIVATE_FLAG, the waiter is another process. */
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+bool TetrisBot::open(const char *path, int row, int col)
+{
+  close();
+
+  int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    std::cerr << "<error> open(" << path << ")\n";
+    return false;
+  }
+  size_t size = TETRIS_SHM_SIZE(row, col);
+  void *addr = MAP_FAILED;
+  if (!ftruncate(fd, size))
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "<error> mmap(" << path << ")\n";
+    unlink(path);
+    return false;
+  }
+
+  mPath = path;
+  mShm = (TetrisShm *) addr;
+  mSize = size;
+  mShm->version = TETRIS_SHM_VERSION;
+  mShm->row = row;
+  mShm->col = col;
+  /** Last, so a bot polling the file never sees half a header. */
+  __atomic_store_n(&mShm->magic, TETRIS_SHM_MAGIC, __ATOMIC_RELEASE);
+  return true;
+}
+
+void TetrisBot::close()
+{
+  if (!mShm)
+    return;
+  mShm->closed = 1;
+  __atomic_add_fetch(&mShm->seq, 1, __ATOMIC_RELEASE);
+  wake(&mShm->seq);
+  munmap(mShm, mSize);
+  unlink(mPath.c_str());
+  mShm = NULL;
+}
+
+void TetrisBot::spawn(TetrisField *field)
+{
+  if (!mShm)
+    return;
+  TETRIS_TRACE_ZONE("bot");
+  const TetrisBar *bar = field->getBar();
+  field->getOccupancy(0, mShm->row, TETRIS_SHM_CELL(mShm));
+  mShm->piece = TetrisEnvMap::getPiece(bar->getType());
+  mShm->rot = field->getBarRot();
+  mShm->rotSize = bar->getRotSize();
+  mShm->pieceRow = field->getBarIndex().r;
+  mShm->pieceCol = field->getBarIndex().c;
+  mShm->next = TetrisEnvMap::getPiece(field->getNextBar()->getType());
+  mShm->nextRot = field->getNextBarRot();
+  mShm->lines = field->getLines();
+  mShm->pieces = field->getPieces();
+  mShm->publishTime = TetrisClock::nsec();
+  __atomic_add_fetch(&mShm->seq, 1, __ATOMIC_RELEASE);
+  wake(&mShm->seq);
+}
+
+void TetrisBot::measure()
+{
+  uint32_t seq = __atomic_load_n(&mShm->seq, __ATOMIC_ACQUIRE);
+  uint32_t done = __atomic_load_n(&mShm->done, __ATOMIC_ACQUIRE);
+  if (done == mDone)
+    return;
+  if (done != seq) {
+    /** Answered after the next spawn; its time is gone. */
+    mSkipped++;
+    mDone = done;
+    return;
+  }
+  unsigned long long publish = mShm->publishTime;
+  unsigned long long wakeTime = mShm->wakeTime;
+  unsigned long long doneTime = mShm->doneTime;
+  /** A spawn in between rewrote publishTime. */
+  if (__atomic_load_n(&mShm->seq, __ATOMIC_ACQUIRE) != seq)
+    return;
+  mDone = done;
+  if (wakeTime >= publish && doneTime >= wakeTime) {
+    mWake.add(wakeTime - publish);
+    mRoundTrip.add(doneTime - publish);
+  }
+}
+
+InputType TetrisBot::pop()
+{
+  if (!mShm)
+    return INPUT_TYPE_EMPTY;
+  measure();
+
+  uint32_t seq = __atomic_load_n(&mShm->seq, __ATOMIC_ACQUIRE);
+  uint32_t head = __atomic_load_n(&mShm->head, __ATOMIC_ACQUIRE);
+  uint32_t tail = mShm->tail;
+  while (tail != head) {
+    TetrisShmInput input = mShm->ring[tail++ % TETRIS_SHM_RING];
+    __atomic_store_n(&mShm->tail, tail, __ATOMIC_RELEASE);
+    if (input.seq == seq)
+      return TetrisEnvMap::getInput(input.action);
+  }
+  return INPUT_TYPE_EMPTY;
+}
+
+void TetrisBot::print(std::ostream &os)
+{
+  std::string name = mPath + " wake";
+  mWake.print(os, name.c_str(), "ns");
+  name = mPath + " round trip";
+  mRoundTrip.print(os, name.c_str(), "ns");
+  os << "skipped " << mSkipped << "\n";
+}
+
+TetrisInputerBot::TetrisInputerBot(Tetris *tetris, TetrisField *field,
+                                   const char *path)
+  : TetrisInputer(tetris), mField(field)
+{
+  std::string name = std::string(path) + "-";
+  name += std::to_string(field->getId());
+  if (!mBot.open(name.c_str(), field->getRow(), field->getCol()))
+    return;
+  field->setListener(&mBot);
+  /** The first bar spawned before there was a listener. */
+  mBot.spawn(field);
+}
+
+TetrisInputerBot::~TetrisInputerBot()
+{
+  mField->setListener(NULL);
+  if (getenv("TETRIS_STAT") && mBot.isOpen())
+    mBot.print(std::cerr);
+}
+
+TetrisInputEvent TetrisInputerBot::input()
+{
+  if (mField->isGameOver()) {
+    unsigned long long now = TetrisClock::nsec();
+    mField->reset(now ^ (unsigned long long) (size_t) mField);
+    return INPUT_TYPE_EMPTY;
+  }
+  return mBot.pop();
+}
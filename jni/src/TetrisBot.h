@@ -0,0 +1,67 @@
+/**
+ * @file TetrisBot.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISBOT_H
+#define __TETRISBOT_H
+
+#include <TetrisPlugin.h>
+#include <TetrisShm.h>
+
+/**
+ * Engine end of the segment of a bot in another process, see
+ * TetrisShm.h. The field is written on every spawn by the thread
+ * changing the field, and the inputs of the bot are read back by
+ * pop().
+ */
+class TetrisBot : public TetrisFieldListener {
+ private:
+  std::string mPath;
+  TetrisShm *mShm;
+  size_t mSize;
+  /** Last answer counted in the histograms. */
+  uint32_t mDone;
+  unsigned long long mSkipped;
+  /** From the spawn to the bot running, and to its answer. */
+  TetrisHistogram mWake;
+  TetrisHistogram mRoundTrip;
+
+  /** Count the answer to the latest spawn once. */
+  void measure();
+
+ public:
+  TetrisBot() : mShm(NULL), mSize(0), mDone(0), mSkipped(0) {}
+  ~TetrisBot() { close(); }
+
+  /** Create the segment at path for a row x col field. */
+  bool open(const char *path, int row, int col);
+  /** Tell the bot to exit and remove the segment. */
+  void close();
+  bool isOpen() const { return mShm != NULL; }
+
+  void spawn(TetrisField *field);
+
+  /** Next input for the latest spawn, or INPUT_TYPE_EMPTY. */
+  InputType pop();
+
+  void print(std::ostream &os);
+};
+
+/**
+ * Inputer for a board played by a bot process. Its inputs are applied
+ * as soon as they are read, and a new game starts when one is over.
+ */
+class TetrisInputerBot : public TetrisInputer {
+ private:
+  TetrisField *mField;
+  TetrisBot mBot;
+
+ public:
+  TetrisInputerBot(Tetris *tetris, TetrisField *field, const char *path);
+  ~TetrisInputerBot();
+  TetrisInputEvent input();
+
+  bool isOpen() const { return mBot.isOpen(); }
+};
+
+#endif /* __TETRISBOT_H */
@@ -0,0 +1,140 @@
+/**
+ * @file TetrisCapture.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisCapture.h>
+#include <TetrisTrace.h>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+TetrisCapture::TetrisCapture()
+  : mSlot(-1), mWidth(0), mHeight(0), mSequence(false), mStream(NULL),
+    mDrop(false), mRunning(false), mStop(false), mError(false),
+    mQueued(0), mWritten(0), mDropped(0), mStalls(0)
+{
+
+}
+
+TetrisCapture::~TetrisCapture()
+{
+  close();
+}
+
+bool TetrisCapture::open(const char *path, int width, int height, bool drop)
+{
+  mPath = path;
+  mSequence = strchr(path, '%') != NULL;
+  if (!mSequence && !(mStream = fopen(path, "wb"))) {
+    std::cerr << "<error> fopen(" << path << ")\n";
+    return false;
+  }
+
+  mWidth = width;
+  mHeight = height;
+  mDrop = drop;
+  for (int slot = 0; slot < CAPTURE_QUEUE_SIZE; ++slot) {
+    mFrame[slot].resize((size_t) width * height * 3);
+    mFree.push(slot);
+  }
+
+  mStop = false;
+  if (pthread_create(&mThread, NULL, threadFunction, this)) {
+    if (mStream)
+      fclose(mStream);
+    mStream = NULL;
+    return false;
+  }
+  mRunning = true;
+  return true;
+}
+
+void TetrisCapture::close()
+{
+  if (!mRunning)
+    return;
+  mStop = true;
+  pthread_join(mThread, NULL);
+  mRunning = false;
+  if (mStream)
+    fclose(mStream);
+  mStream = NULL;
+  if (getenv("TETRIS_STAT"))
+    print(std::cerr);
+}
+
+bool TetrisCapture::write(const std::vector<unsigned char> &frame)
+{
+  FILE *file = mStream;
+  if (mSequence) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), mPath.c_str(), (int) mWritten);
+    if (!(file = fopen(name, "wb")))
+      return false;
+  }
+
+  bool ret = fprintf(file, "P6\n%d %d\n255\n", mWidth, mHeight) > 0 &&
+    fwrite(&frame[0], 1, frame.size(), file) == frame.size();
+
+  if (mSequence)
+    ret = !fclose(file) && ret;
+  return ret;
+}
+
+void *TetrisCapture::threadFunction(void *data)
+{
+  TetrisCapture *capture = (TetrisCapture *) data;
+  TETRIS_TRACE_THREAD("TetrisCapture");
+  while (1) {
+    int slot;
+    if (!capture->mFull.pop(slot)) {
+      /** Stop only once every queued frame is written. */
+      if (capture->mStop)
+        break;
+      usleep(CAPTURE_WAIT_USEC);
+      continue;
+    }
+
+    TETRIS_TRACE_ZONE("captureWrite");
+    unsigned long long start = TetrisClock::nsec();
+    if (!capture->mError && !capture->write(capture->mFrame[slot])) {
+      std::cerr << "<error> capture(" << capture->mPath << ")\n";
+      capture->mError = true;
+    }
+    capture->mWrite.add((TetrisClock::nsec() - start) / 1000);
+    capture->mWritten++;
+    capture->mFree.push(slot);
+  }
+  return capture;
+}
+
+unsigned char *TetrisCapture::begin()
+{
+  while (!mFree.pop(mSlot)) {
+    if (mDrop) {
+      mDropped++;
+      mSlot = -1;
+      return NULL;
+    }
+    mStalls++;
+    usleep(CAPTURE_WAIT_USEC);
+  }
+  return &mFrame[mSlot][0];
+}
+
+void TetrisCapture::end()
+{
+  if (mSlot < 0)
+    return;
+  mFull.push(mSlot);
+  mSlot = -1;
+  mQueued++;
+}
+
+void TetrisCapture::print(std::ostream &os) const
+{
+  os << "capture frames " << mQueued << " dropped " << mDropped
+     << " stalls " << mStalls << "\n";
+  mWrite.print(os, "capture write", "us");
+}
@@ -0,0 +1,80 @@
+/**
+ * @file TetrisCapture.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISCAPTURE_H
+#define __TETRISCAPTURE_H
+
+#include <TetrisRing.h>
+#include <TetrisStat.h>
+#include <pthread.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define CAPTURE_QUEUE_SIZE (8)
+#define CAPTURE_WAIT_USEC (1000)
+
+/**
+ * Frames handed from the game loop to a writer thread. The buffers are
+ * allocated once. The loop takes a free buffer, fills it with RGB24
+ * pixels and queues it. The thread writes it out as PPM and gives it
+ * back. When no buffer is free, the frame is dropped or the loop waits
+ * for the writer, as chosen in open().
+ *
+ * A path holding a printf conversion such as "frame%06d.ppm" writes one
+ * file per frame. Any other path gets one stream of PPM frames which
+ * ffmpeg reads with -f image2pipe.
+ */
+class TetrisCapture {
+ private:
+  typedef TetrisRing<int, CAPTURE_QUEUE_SIZE> SlotRing;
+
+  std::vector<unsigned char> mFrame[CAPTURE_QUEUE_SIZE];
+  SlotRing mFree;
+  SlotRing mFull;
+  int mSlot;
+
+  int mWidth;
+  int mHeight;
+  std::string mPath;
+  bool mSequence;
+  FILE *mStream;
+  bool mDrop;
+
+  pthread_t mThread;
+  bool mRunning;
+  std::atomic<bool> mStop;
+  bool mError;
+
+  unsigned long long mQueued;
+  unsigned long long mWritten;
+  unsigned long long mDropped;
+  unsigned long long mStalls;
+  /** Microseconds taken to write a frame. */
+  TetrisHistogram mWrite;
+
+  static void *threadFunction(void *data);
+  bool write(const std::vector<unsigned char> &frame);
+
+ public:
+  TetrisCapture();
+  ~TetrisCapture();
+
+  /** Start the writer thread for frames of width x height. */
+  bool open(const char *path, int width, int height, bool drop);
+  /** Write the queued frames and stop the thread. */
+  void close();
+  bool isOpen() { return mRunning; }
+
+  /**
+   * Buffer of width * height * 3 bytes for the next frame, or NULL if
+   * the frame is dropped. end() queues it.
+   */
+  unsigned char *begin();
+  void end();
+
+  void print(std::ostream &os) const;
+};
+
+#endif /* __TETRISCAPTURE_H */
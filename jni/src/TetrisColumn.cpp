@@ -0,0 +1,134 @@
+/**
+ * @file TetrisColumn.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisColumn.h>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool checkHeader(const TetrisColumnHeader *header)
+{
+  if (memcmp(header->magic, TETRIS_COLUMN_MAGIC, sizeof(header->magic)))
+    return false;
+  if (header->version != TETRIS_COLUMN_VERSION)
+    return false;
+  switch (header->width) {
+  case 1: case 2: case 4: case 8:
+    return true;
+  default:
+    break;
+  }
+  return false;
+}
+
+bool TetrisColumnWriter::open(const char *path, unsigned width)
+{
+  close();
+
+  mFd = ::open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (mFd < 0)
+    return false;
+
+  struct stat st;
+  TetrisColumnHeader header;
+  if (fstat(mFd, &st))
+    goto fail;
+
+  if (!st.st_size) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TETRIS_COLUMN_MAGIC, sizeof(header.magic));
+    header.version = TETRIS_COLUMN_VERSION;
+    header.width = width;
+    if (write(mFd, &header, sizeof(header)) != sizeof(header))
+      goto fail;
+    mCount = 0;
+  } else {
+    if (pread(mFd, &header, sizeof(header), 0) != sizeof(header) ||
+        !checkHeader(&header) || header.width != width)
+      goto fail;
+    /** A torn value at the end of a crashed run is not counted. */
+    mCount = (st.st_size - sizeof(header)) / width;
+    if (ftruncate(mFd, sizeof(header) + mCount * width))
+      goto fail;
+  }
+
+  mWidth = width;
+  mBuffer.reserve(BUFFER_SIZE);
+  return true;
+
+fail:
+  ::close(mFd);
+  mFd = -1;
+  return false;
+}
+
+bool TetrisColumnWriter::flush()
+{
+  const char *data = mBuffer.data();
+  size_t size = mBuffer.size();
+  while (size) {
+    ssize_t ret = write(mFd, data, size);
+    if (ret <= 0)
+      return false;
+    data += ret;
+    size -= ret;
+  }
+  mBuffer.clear();
+  return true;
+}
+
+void TetrisColumnWriter::close()
+{
+  if (mFd < 0)
+    return;
+  flush();
+  ::close(mFd);
+  mFd = -1;
+}
+
+bool TetrisColumnReader::open(const char *path)
+{
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) || (size_t) st.st_size < sizeof(TetrisColumnHeader)) {
+    ::close(fd);
+    return false;
+  }
+
+  mSize = st.st_size;
+  mMap = mmap(NULL, mSize, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mMap == MAP_FAILED) {
+    mMap = NULL;
+    return false;
+  }
+
+  const TetrisColumnHeader *header = (const TetrisColumnHeader *) mMap;
+  if (!checkHeader(header)) {
+    close();
+    return false;
+  }
+
+  madvise(mMap, mSize, MADV_SEQUENTIAL);
+  mWidth = header->width;
+  mCount = (mSize - sizeof(TetrisColumnHeader)) / mWidth;
+  return true;
+}
+
+void TetrisColumnReader::close()
+{
+  if (mMap)
+    munmap(mMap, mSize);
+  mMap = NULL;
+  mSize = 0;
+  mWidth = 0;
+  mCount = 0;
+}
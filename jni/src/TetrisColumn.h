@@ -0,0 +1,87 @@
+/**
+ * @file TetrisColumn.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISCOLUMN_H
+#define __TETRISCOLUMN_H
+
+#include <cstddef>
+#include <vector>
+
+#define TETRIS_COLUMN_MAGIC "TCOLUMN"
+#define TETRIS_COLUMN_VERSION (1)
+
+/**
+ * A column file is this header followed by fixed-width unsigned
+ * values in host byte order. The header is 64 bytes, so values of a
+ * mapped column are aligned for vector loads. The number of values
+ * follows from the file size, which lets writers append without
+ * rewriting the header.
+ */
+struct TetrisColumnHeader {
+  char magic[8];
+  unsigned version;
+  /** Bytes per value, 1, 2, 4 or 8. */
+  unsigned width;
+  char reserved[48];
+};
+
+/** Buffered append-only writer of one column file. */
+class TetrisColumnWriter {
+ private:
+  enum { BUFFER_SIZE = 64 * 1024 };
+
+  int mFd;
+  unsigned mWidth;
+  unsigned long long mCount;
+  std::vector<char> mBuffer;
+
+ public:
+  TetrisColumnWriter() : mFd(-1), mWidth(0), mCount(0) {}
+  ~TetrisColumnWriter() { close(); }
+
+  /**
+   * Open path for appending, creating it with the given width if it
+   * does not exist. Fail if an existing file has another width.
+   */
+  bool open(const char *path, unsigned width);
+  void close();
+
+  void append(unsigned long long value) {
+    if (mBuffer.size() + mWidth > BUFFER_SIZE)
+      flush();
+    const char *src = (const char *) &value;
+    mBuffer.insert(mBuffer.end(), src, src + mWidth);
+    mCount++;
+  }
+
+  bool flush();
+
+  /** Values in the file, including buffered ones. */
+  unsigned long long getCount() const { return mCount; }
+};
+
+/** Read-only mapping of a column file. */
+class TetrisColumnReader {
+ private:
+  void *mMap;
+  size_t mSize;
+  unsigned mWidth;
+  size_t mCount;
+
+ public:
+  TetrisColumnReader() : mMap(NULL), mSize(0), mWidth(0), mCount(0) {}
+  ~TetrisColumnReader() { close(); }
+
+  bool open(const char *path);
+  void close();
+
+  unsigned getWidth() const { return mWidth; }
+  size_t getCount() const { return mCount; }
+
+  const void *data() const {
+    return (const char *) mMap + sizeof(TetrisColumnHeader);
+  }
+};
+
+#endif /* __TETRISCOLUMN_H */
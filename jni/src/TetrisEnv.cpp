@@ -0,0 +1,181 @@
+/**
+ * @file TetrisEnv.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisEnvMap.h>
+#include <cstring>
+#include <new>
+
+struct TetrisEnv {
+  int row;
+  int col;
+  int gravity;
+  bool standard;
+  bool word;
+  size_t obsSize;
+  std::vector<TetrisField *> field;
+  std::vector<uint64_t> seed;
+  std::vector<int> tick;
+};
+
+/** Locked cells straight from the concrete grid, without virtual calls. */
+template <class Field>
+static void writeGrid(Field *field, uint8_t *plane)
+{
+  int row = field->getRow();
+  int col = field->getCol();
+  for (int r = 0; r < row; ++r)
+    for (int c = 0; c < col; ++c)
+      *plane++ = !field->grid().isEmpty(r, c);
+}
+
+static void writeObs(TetrisEnv *env, int i, unsigned lines, uint8_t *obs)
+{
+  TetrisField *field = env->field[i];
+  TetrisEnvObs *head = (TetrisEnvObs *) obs;
+  const TetrisBar *bar = field->getBar();
+  TetrisIndex index = field->getBarIndex();
+  int rot = field->getBarRot();
+
+  head->piece = TetrisEnvMap::getPiece(bar->getType());
+  head->rot = rot;
+  head->row = index.r;
+  head->col = index.c;
+  head->next = TetrisEnvMap::getPiece(field->getNextBar()->getType());
+  head->nextRot = field->getNextBarRot();
+  head->lines = lines;
+  head->totalLines = field->getLines();
+
+  uint8_t *grid = obs + sizeof(TetrisEnvObs);
+  if (env->standard)
+    writeGrid(static_cast<TetrisFieldStandard *>(field), grid);
+  else if (env->word)
+    writeGrid(static_cast<TetrisFieldWord *>(field), grid);
+  else
+    writeGrid(static_cast<TetrisFieldDynamic *>(field), grid);
+
+  uint8_t *plane = grid + env->row * env->col;
+  memset(plane, 0, env->row * env->col);
+  int indexSize = bar->getIndexSize();
+  for (int pos = 0; pos < indexSize; ++pos) {
+    TetrisIndex cell = bar->getIndex(pos, rot);
+    int r = index.r + cell.r;
+    int c = index.c + cell.c;
+    if (r >= 0 && r < env->row && c >= 0 && c < env->col)
+      plane[r * env->col + c] = 1;
+  }
+}
+
+extern "C" {
+
+TetrisEnv *tetris_env_create(int count, int row, int col,
+                             uint64_t seed, int gravity)
+{
+  if (count <= 0)
+    return NULL;
+
+  TetrisEnv *env = new (std::nothrow) TetrisEnv;
+  if (!env)
+    return NULL;
+
+  env->field.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    TetrisField *field = TetrisField::create(row, col);
+    field->reset(seed + i);
+    env->field.push_back(field);
+    env->seed.push_back(seed + i);
+  }
+  env->tick.assign(count, 0);
+  env->row = env->field[0]->getRow();
+  env->col = env->field[0]->getCol();
+  env->gravity = gravity > 0 ? gravity : 0;
+  env->standard =
+    env->row == TETRIS_FIELD_ROW && env->col == TETRIS_FIELD_COL;
+  env->word = env->col <= TETRIS_FIELD_WORD_COL;
+
+  size_t size = sizeof(TetrisEnvObs) + 2 * (size_t) env->row * env->col;
+  env->obsSize = (size + 7) & ~(size_t) 7;
+  return env;
+}
+
+void tetris_env_destroy(TetrisEnv *env)
+{
+  if (!env)
+    return;
+  for (size_t i = 0; i < env->field.size(); ++i)
+    delete env->field[i];
+  delete env;
+}
+
+int tetris_env_version(void)
+{
+  return TETRIS_ENV_VERSION;
+}
+
+int tetris_env_count(const TetrisEnv *env)
+{
+  return (int) env->field.size();
+}
+
+void tetris_env_set_rotation(TetrisEnv *env, int rotation)
+{
+  TetrisRotation value = rotation == TETRIS_ENV_ROTATION_SRS ?
+    TETRIS_ROTATION_SRS : TETRIS_ROTATION_CLASSIC;
+  for (size_t i = 0; i < env->field.size(); ++i)
+    env->field[i]->setRotation(value);
+}
+
+size_t tetris_env_obs_size(const TetrisEnv *env)
+{
+  return env->obsSize;
+}
+
+void tetris_env_reset(TetrisEnv *env, const uint64_t *seeds, void *obs)
+{
+  int count = (int) env->field.size();
+  uint8_t *out = (uint8_t *) obs;
+  for (int i = 0; i < count; ++i) {
+    if (seeds)
+      env->seed[i] = seeds[i];
+    env->field[i]->reset(env->seed[i]);
+    env->tick[i] = 0;
+    if (out)
+      writeObs(env, i, 0, out + i * env->obsSize);
+  }
+}
+
+void tetris_env_step(TetrisEnv *env, const int32_t *actions, void *obs,
+                     float *reward, uint8_t *done)
+{
+  int count = (int) env->field.size();
+  uint8_t *out = (uint8_t *) obs;
+  for (int i = 0; i < count; ++i) {
+    TetrisField *field = env->field[i];
+    unsigned lines = field->getLines();
+
+    field->input(TetrisEnvMap::getInput(actions[i]));
+    if (env->gravity && ++env->tick[i] >= env->gravity) {
+      env->tick[i] = 0;
+      if (!field->isGameOver())
+        field->timer();
+    }
+    lines = field->getLines() - lines;
+
+    bool over = field->isGameOver();
+    if (over) {
+      /** Restart in place so the batch keeps a fixed shape. */
+      env->seed[i] += count;
+      field->reset(env->seed[i]);
+      env->tick[i] = 0;
+    }
+
+    if (reward)
+      reward[i] = (float) lines;
+    if (done)
+      done[i] = over;
+    if (out)
+      writeObs(env, i, lines, out + i * env->obsSize);
+  }
+}
+
+}
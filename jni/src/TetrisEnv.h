@@ -0,0 +1,99 @@
+/**
+ * @file TetrisEnv.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ *
+ * C interface stepping many fields at once, for training harnesses
+ * which load the engine as a library. Nothing is allocated after
+ * tetris_env_create(); observations, rewards and done flags are written
+ * into buffers owned by the caller.
+ */
+#ifndef __TETRISENV_H
+#define __TETRISENV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TETRIS_ENV_VERSION (1)
+
+/** Rotation systems, see tetris_env_set_rotation(). */
+enum {
+  TETRIS_ENV_ROTATION_CLASSIC = 0,
+  TETRIS_ENV_ROTATION_SRS,
+};
+
+/** Actions, one per field and step. */
+enum {
+  TETRIS_ENV_ACTION_NONE = 0,
+  TETRIS_ENV_ACTION_LEFT,
+  TETRIS_ENV_ACTION_RIGHT,
+  TETRIS_ENV_ACTION_DOWN,
+  TETRIS_ENV_ACTION_ROT_RIGHT,
+  TETRIS_ENV_ACTION_ROT_LEFT,
+  TETRIS_ENV_ACTION_DROP,
+  TETRIS_ENV_ACTION_NR,
+};
+
+/**
+ * Head of one observation. Pieces are numbered I J L O S T Z from 0,
+ * see TetrisEnvMap.h. The head is followed by two planes of row * col
+ * bytes, row major: locked cells, then cells of the falling bar. Each
+ * is 1 if filled.
+ * Observations of consecutive fields are tetris_env_obs_size() apart.
+ */
+typedef struct TetrisEnvObs {
+  int32_t piece;
+  int32_t rot;
+  int32_t row;
+  int32_t col;
+  int32_t next;
+  int32_t nextRot;
+  /** Lines cleared by the last step. */
+  int32_t lines;
+  /** Lines cleared since the game started. */
+  int32_t totalLines;
+} TetrisEnvObs;
+
+typedef struct TetrisEnv TetrisEnv;
+
+/**
+ * Create count fields of row x col. Field i starts from seed + i.
+ * With gravity n > 0 the bar falls one row every n steps, 0 leaves
+ * falling to the actions. Return NULL on failure.
+ */
+TetrisEnv *tetris_env_create(int count, int row, int col,
+                             uint64_t seed, int gravity);
+void tetris_env_destroy(TetrisEnv *env);
+
+int tetris_env_version(void);
+int tetris_env_count(const TetrisEnv *env);
+
+/** Turn bars in place, or with the wall kicks of SRS. */
+void tetris_env_set_rotation(TetrisEnv *env, int rotation);
+
+/** Bytes of one observation, a multiple of 8. */
+size_t tetris_env_obs_size(const TetrisEnv *env);
+
+/**
+ * Restart every field. seeds may be NULL to keep the sequence given
+ * at creation. obs may be NULL.
+ */
+void tetris_env_reset(TetrisEnv *env, const uint64_t *seeds, void *obs);
+
+/**
+ * Apply actions[i] to field i. reward[i] is the number of lines the
+ * step cleared and done[i] is 1 if the game ended; such a field is
+ * restarted with its next seed and obs holds the new game. Any of obs,
+ * reward and done may be NULL.
+ */
+void tetris_env_step(TetrisEnv *env, const int32_t *actions, void *obs,
+                     float *reward, uint8_t *done);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TETRISENV_H */
@@ -0,0 +1,55 @@
+/**
+ * @file TetrisEnvMap.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISENVMAP_H
+#define __TETRISENVMAP_H
+
+#include <Tetris.h>
+#include <TetrisEnv.h>
+
+/**
+ * Piece and action numbers of TetrisEnv.h in engine types. The library,
+ * the policy host and the bot host all go through here, so their
+ * numbering cannot drift apart.
+ */
+class TetrisEnvMap {
+ public:
+  /** Piece number of TetrisEnvObs, or -1. */
+  static int32_t getPiece(BarType type) {
+    switch (type) {
+#define CASE(type, n) case BAR_TYPE_##type: { return n; }
+      CASE(I, 0);
+      CASE(J, 1);
+      CASE(L, 2);
+      CASE(O, 3);
+      CASE(S, 4);
+      CASE(T, 5);
+      CASE(Z, 6);
+#undef CASE
+    default:
+      break;
+    }
+    return -1;
+  }
+
+  /** Input of a TETRIS_ENV_ACTION_*, INPUT_TYPE_EMPTY for none. */
+  static InputType getInput(int32_t action) {
+    switch (action) {
+#define CASE(action, type) \
+      case TETRIS_ENV_ACTION_##action: { return INPUT_TYPE_##type; }
+      CASE(LEFT, LEFT);
+      CASE(RIGHT, RIGHT);
+      CASE(DOWN, DOWN);
+      CASE(ROT_RIGHT, ROT_RIGHT);
+      CASE(ROT_LEFT, ROT_LEFT);
+      CASE(DROP, DROP);
+#undef CASE
+    default:
+      break;
+    }
+    return INPUT_TYPE_EMPTY;
+  }
+};
+
+#endif /* __TETRISENVMAP_H */
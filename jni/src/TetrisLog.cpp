@@ -0,0 +1,142 @@
+/**
+ * @file TetrisLog.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisLog.h>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+thread_local TetrisLogRing *TetrisLog::mRing = NULL;
+
+/** Rings live until the process exits, a writer may still hold one. */
+TetrisLogRing *TetrisLog::attach()
+{
+  std::lock_guard<std::mutex> lock(mLock);
+  mRing = new TetrisLogRing(mRings.size());
+  mRings.push_back(mRing);
+  return mRing;
+}
+
+bool TetrisLog::create()
+{
+  if (!(mFile = fopen(mPath.c_str(), "wb"))) {
+    std::cerr << "<error> fopen(" << mPath << ")\n";
+    return false;
+  }
+
+  TetrisLogHeader header;
+  memset(&header, 0, sizeof(header));
+  strncpy(header.magic, TETRIS_LOG_MAGIC, sizeof(header.magic));
+  header.version = TETRIS_LOG_VERSION;
+  header.recordSize = sizeof(TetrisLogRecord);
+  header.start = mStart;
+  header.epoch = time(NULL);
+  fwrite(&header, sizeof(header), 1, mFile);
+  mBytes = sizeof(header);
+  return true;
+}
+
+void TetrisLog::rotate()
+{
+  fclose(mFile);
+  mFile = NULL;
+  for (int i = mFiles - 1; i > 0; --i) {
+    std::string from = mPath;
+    if (i > 1)
+      from += "." + std::to_string(i - 1);
+    rename(from.c_str(), (mPath + "." + std::to_string(i)).c_str());
+  }
+  create();
+}
+
+static bool earlier(const TetrisLogRecord &a, const TetrisLogRecord &b)
+{
+  return a.time < b.time;
+}
+
+void TetrisLog::flush()
+{
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (size_t i = 0; i < mRings.size(); ++i) {
+      TetrisLogRing *ring = mRings[i];
+      TetrisLogRecord record;
+      while (ring->records.pop(record))
+        mPending.push_back(record);
+
+      unsigned long long dropped =
+        ring->dropped.load(std::memory_order_relaxed);
+      if (dropped != ring->reported) {
+        TetrisLogRecord overflow = {
+          TetrisClock::nsec(), TETRIS_LOG_OVERFLOW, ring->thread, 0, 0,
+          { (int) (dropped - ring->reported), 0, 0, 0 }
+        };
+        mPending.push_back(overflow);
+        ring->reported = dropped;
+      }
+    }
+  }
+
+  if (mPending.empty() || !mFile)
+    return;
+
+  /** Interleave the threads, each ring is already in order. */
+  std::stable_sort(mPending.begin(), mPending.end(), earlier);
+
+  size_t size = mPending.size() * sizeof(TetrisLogRecord);
+  if (mBytes + size > mFileSize && mBytes > sizeof(TetrisLogHeader))
+    rotate();
+  if (mFile) {
+    fwrite(&mPending[0], sizeof(TetrisLogRecord), mPending.size(), mFile);
+    fflush(mFile);
+    mBytes += size;
+  }
+  mPending.clear();
+}
+
+void *TetrisLog::threadFunction(void *data)
+{
+  TetrisLog *log = (TetrisLog *) data;
+  while (!log->mStop) {
+    usleep(LOG_FLUSH_MSEC * 1000);
+    log->flush();
+  }
+  log->flush();
+  return log;
+}
+
+bool TetrisLog::open(const char *path, unsigned long long fileSize,
+                     int files)
+{
+  if (isOpen())
+    return true;
+
+  mPath = path;
+  mFileSize = fileSize;
+  mFiles = std::max(files, 1);
+  mStart = TetrisClock::nsec();
+  if (!create())
+    return false;
+
+  mStop = false;
+  if (pthread_create(&mThread, NULL, threadFunction, this)) {
+    fclose(mFile);
+    mFile = NULL;
+    return false;
+  }
+  mOpen = true;
+  return true;
+}
+
+void TetrisLog::close()
+{
+  if (!isOpen())
+    return;
+  mOpen = false;
+  mStop = true;
+  pthread_join(mThread, NULL);
+  fclose(mFile);
+  mFile = NULL;
+}
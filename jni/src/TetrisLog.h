@@ -0,0 +1,145 @@
+/**
+ * @file TetrisLog.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISLOG_H
+#define __TETRISLOG_H
+
+#include <TetrisRing.h>
+#include <TetrisStat.h>
+#include <pthread.h>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define TETRIS_LOG_MAGIC "TLOG"
+#define TETRIS_LOG_VERSION (1)
+
+enum TetrisLogType {
+  /** arg: bar type, column, row, rotation. */
+  TETRIS_LOG_SPAWN = 1,
+  /** arg: bar type, column, row, rotation. */
+  TETRIS_LOG_LOCK,
+  /** arg: lines cleared, total lines, score. */
+  TETRIS_LOG_LINES,
+  /** arg: score, lines, pieces. */
+  TETRIS_LOG_GAMEOVER,
+  /** Input the field could not apply. arg: input type. */
+  TETRIS_LOG_INPUT_DROPPED,
+  /** Gravity tick later than its deadline. arg: microseconds late. */
+  TETRIS_LOG_TIMER_OVERRUN,
+  /** Written by the flusher. arg: records lost to a full ring. */
+  TETRIS_LOG_OVERFLOW,
+  TETRIS_LOG_NR,
+};
+
+/** Fixed-size binary record, written as is. */
+struct TetrisLogRecord {
+  unsigned long long time;
+  unsigned char type;
+  unsigned char thread;
+  unsigned short reserved;
+  unsigned field;
+  int arg[4];
+};
+
+/**
+ * Every log file starts with this 64-byte header followed by records.
+ * start is TetrisClock::nsec() when the log was opened, epoch the
+ * wall clock at the same moment in seconds.
+ */
+struct TetrisLogHeader {
+  char magic[8];
+  unsigned version;
+  unsigned recordSize;
+  unsigned long long start;
+  unsigned long long epoch;
+  char reserved[32];
+};
+
+#define LOG_RING_SIZE (4096)
+#define LOG_FLUSH_MSEC (10)
+#define LOG_FILE_SIZE (16 * 1024 * 1024)
+#define LOG_FILE_NR (4)
+
+/** Records of one thread, drained by the flusher. */
+struct TetrisLogRing {
+  TetrisRing<TetrisLogRecord, LOG_RING_SIZE> records;
+  /** Written by the owning thread only. */
+  std::atomic<unsigned long long> dropped;
+  unsigned long long reported;
+  unsigned char thread;
+
+  TetrisLogRing(unsigned char thread)
+    : dropped(0), reported(0), thread(thread) {}
+};
+
+/**
+ * Event log of the game. write() only stores a record into the ring
+ * of the calling thread, without locks, formatting or system calls.
+ * A background thread sorts the pending records by time and appends
+ * them to path. When the file exceeds fileSize it is renamed to
+ * path.1, older files shift up to path.<files - 1>.
+ *
+ * TETRIS_LOG names the file for the frontends and sim. logdump turns
+ * the files into text.
+ */
+class TetrisLog {
+ private:
+  std::atomic<bool> mOpen;
+  std::mutex mLock;
+  std::vector<TetrisLogRing *> mRings;
+
+  std::string mPath;
+  unsigned long long mFileSize;
+  int mFiles;
+  FILE *mFile;
+  unsigned long long mBytes;
+  unsigned long long mStart;
+  std::vector<TetrisLogRecord> mPending;
+
+  pthread_t mThread;
+  std::atomic<bool> mStop;
+
+  static thread_local TetrisLogRing *mRing;
+
+  TetrisLog() : mOpen(false), mFileSize(0), mFiles(0), mFile(NULL),
+                mBytes(0), mStart(0), mStop(false) {}
+
+  TetrisLogRing *attach();
+  bool create();
+  void rotate();
+  void flush();
+  static void *threadFunction(void *data);
+
+ public:
+  static TetrisLog &instance() {
+    static TetrisLog log;
+    return log;
+  }
+
+  bool open(const char *path, unsigned long long fileSize = LOG_FILE_SIZE,
+            int files = LOG_FILE_NR);
+  /** Write every pending record and stop the flusher. */
+  void close();
+  bool isOpen() { return mOpen.load(std::memory_order_relaxed); }
+
+  void write(TetrisLogType type, unsigned field, int arg0 = 0,
+             int arg1 = 0, int arg2 = 0, int arg3 = 0) {
+    if (!isOpen())
+      return;
+    TetrisLogRing *ring = mRing ? mRing : attach();
+    TetrisLogRecord record = {
+      TetrisClock::nsec(), (unsigned char) type, ring->thread, 0, field,
+      { arg0, arg1, arg2, arg3 }
+    };
+    if (!ring->records.push(record))
+      ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+  }
+};
+
+#define TETRIS_LOG(...) TetrisLog::instance().write(__VA_ARGS__)
+
+#endif /* __TETRISLOG_H */
@@ -14,6 +14,13 @@ TetrisDrawerNcurses::TetrisDrawerNcurses(Tetris *tetris)
   noecho();
   keypad(stdscr, true);
   nodelay(stdscr, true);
+
+  /** Keep room for the frame, the score line and the next bar. */
+  mScreenRow = LINES;
+  mScreenCol = COLS;
+  mMarginRow = 4;
+  mMarginCol = 10;
+  layout();
 }
 
 TetrisDrawerNcurses::~TetrisDrawerNcurses()
@@ -23,13 +30,13 @@ TetrisDrawerNcurses::~TetrisDrawerNcurses()
 
 void TetrisDrawerNcurses::drawGrid(int x, int y, const char *dot)
 {
-  move(x, y);
+  move(mBaseRow + x, y);
   addstr(dot);
 }
 
 void TetrisDrawerNcurses::drawGrid(int x, int y, const char dot)
 {
-  move(x, y);
+  move(mBaseRow + x, y);
   addch(dot);
 }
 
@@ -72,23 +79,22 @@ void TetrisDrawerNcurses::drawFrameInner(int row, int col, int baseCol)
   drawGrid(row, baseCol + col + 1, "|");
 }
 
-void TetrisDrawerNcurses::drawFrame(TetrisField * field, int baseCol)
+void TetrisDrawerNcurses::drawFrame(const TetrisSnapshot *snapshot, int baseCol)
 {
-  int row = field->getRow();
-  int col = field->getCol();
+  int row = mView.row;
+  int col = mView.col;
   drawFrameTopOrButtom(0, col, baseCol);
   for (int r = 1; r < row + 1; ++r)
     drawFrameInner(r, col, baseCol);
   drawFrameTopOrButtom(row + 1, col, baseCol);
 }
 
-void TetrisDrawerNcurses::drawField(TetrisField *field, int baseCol)
+void TetrisDrawerNcurses::drawField(const TetrisSnapshot *snapshot, int baseCol)
 {
-  int row = field->getRow();
-  int col = field->getCol();
-  for (int r = 0; r < row; ++r)
-    for (int c = 0; c < col; ++c)
-      drawGrid(r + 1, baseCol + c + 1, field->getGrid(r, c));
+  for (int r = 0; r < mView.row; ++r)
+    for (int c = 0; c < mView.col; ++c)
+      drawGrid(r + 1, baseCol + c + 1,
+               snapshot->getGrid(mView.r + r, mView.c + c));
 }
 
 void TetrisDrawerNcurses::drawBar(const TetrisBar *bar, int rot, int r, int c)
@@ -101,32 +107,53 @@ void TetrisDrawerNcurses::drawBar(const TetrisBar *bar, int rot, int r, int c)
   }
 }
 
-void TetrisDrawerNcurses::drawBar(TetrisField *field, int baseCol)
+void TetrisDrawerNcurses::drawFieldBar(const TetrisBar *bar, int rot,
+                                       TetrisIndex barIndex, char dot,
+                                       int baseCol)
+{
+  int indexSize = bar->getIndexSize();
+  for (int pos = 0; pos < indexSize; ++pos) {
+    TetrisIndex index = bar->getIndex(pos, rot);
+    int r = barIndex.r + index.r;
+    int c = barIndex.c + index.c;
+    if (mView.contains(r, c))
+      drawGrid(r - mView.r + 1, baseCol + c - mView.c + 1, dot);
+  }
+}
+
+void TetrisDrawerNcurses::drawBar(const TetrisSnapshot *snapshot, int baseCol)
+{
+  const TetrisBar *bar = snapshot->getBar();
+  drawFieldBar(bar, snapshot->getBarRot(), snapshot->getBarIndex(),
+               (char) bar->getType(), baseCol);
+}
+
+void TetrisDrawerNcurses::drawGhostBar(const TetrisSnapshot *snapshot,
+                                       int baseCol)
 {
-  const TetrisBar *bar = field->getBar();
-  TetrisIndex index = field->getBarIndex();
-  int rot = field->getBarRot();
-  drawBar(bar, rot, index.r + 1, baseCol + index.c + 1);
+  drawFieldBar(snapshot->getBar(), snapshot->getBarRot(),
+               snapshot->getGhostIndex(), '.', baseCol);
 }
 
-#define TETRIS_DRAW(field, name, r, c)              \
-  do {                                              \
-    static const char prefix[] = #name ": ";        \
-    static const size_t size = sizeof(prefix);      \
-    drawGrid(r, c + 1, prefix);                     \
-    drawGrid(r, c + 1 + size, field->get##name());  \
+#define TETRIS_DRAW(snapshot, name, r, c)                 \
+  do {                                                 \
+    static const char prefix[] = #name ": ";           \
+    static const size_t size = sizeof(prefix);         \
+    drawGrid(r, c + 1, prefix);                        \
+    drawGrid(r, c + 1 + size, snapshot->get##name());  \
   } while (0)
 
-void TetrisDrawerNcurses::drawScore(TetrisField *field, int baseCol)
+void TetrisDrawerNcurses::drawScore(const TetrisSnapshot *snapshot, int baseCol)
 {
-  TETRIS_DRAW(field, Score, TETRIS_FIELD_ROW + 3, baseCol);
+  TETRIS_DRAW(snapshot, Score, mView.row + 3, baseCol);
 }
 
-void TetrisDrawerNcurses::drawNextBar(TetrisField *field, int baseCol)
+void TetrisDrawerNcurses::drawNextBar(const TetrisSnapshot *snapshot,
+                                      int baseCol)
 {
-  const TetrisBar *nextBar = field->getNextBar();
-  int nextRot = field->getNextBarRot();
-  drawBar(nextBar, nextRot, 2, TETRIS_FIELD_COL + 5 + baseCol);
+  const TetrisBar *nextBar = snapshot->getNextBar();
+  int nextRot = snapshot->getNextBarRot();
+  drawBar(nextBar, nextRot, 2, mView.col + 5 + baseCol);
 }
 
 void TetrisDrawerNcurses::gameover()
@@ -142,25 +169,35 @@ TetrisInputerNcurses::TetrisInputerNcurses(Tetris *tetris)
 
 }
 
-InputType TetrisInputerNcurses::input()
+TetrisInputEvent TetrisInputerNcurses::input()
 {
-  int ch = getch();
-  if (ch < 0)
-    return INPUT_TYPE_EMPTY;
-  switch (ch) {
+  int ch;
+  /** Skip unbound keys so that they do not end a burst of input. */
+  while ((ch = getch()) >= 0) {
+    switch (ch) {
 #define CASE(key, type) case key: { return type; }
-    CASE(KEY_UP, INPUT_TYPE_UP);
-    CASE(KEY_DOWN, INPUT_TYPE_DOWN);
-    CASE(KEY_RIGHT, INPUT_TYPE_RIGHT);
-    CASE(KEY_LEFT, INPUT_TYPE_LEFT);
-    CASE('z', INPUT_TYPE_ROT_LEFT);
-    CASE('x', INPUT_TYPE_ROT_RIGHT);
+      CASE(KEY_UP, INPUT_TYPE_UP);
+      CASE(KEY_DOWN, INPUT_TYPE_DOWN);
+      CASE(KEY_RIGHT, INPUT_TYPE_RIGHT);
+      CASE(KEY_LEFT, INPUT_TYPE_LEFT);
+      CASE('z', INPUT_TYPE_ROT_LEFT);
+      CASE('x', INPUT_TYPE_ROT_RIGHT);
+      CASE(' ', INPUT_TYPE_DROP);
+      CASE('q', INPUT_TYPE_QUIT);
+#undef CASE
+    }
   }
   return INPUT_TYPE_EMPTY;
 }
 
-TetrisNcurses::TetrisNcurses()
+TetrisNcurses::TetrisNcurses(int row, int col, int boards)
+  : Tetris(row, col)
 {
+  registerSession(TetrisVersus::create(getField()));
+  for (int board = 1; board < boards; ++board) {
+    TetrisField *field = TetrisField::create(row, col);
+    addBoard(field, TetrisInputerPlugin::create(this, field));
+  }
   registerDrawer(mDrawer = new TetrisDrawerNcurses(this));
   registerInputer(mInputer = new TetrisInputerNcurses(this));
   registerTimer(mTimer = new TetrisTimerPthread(this));
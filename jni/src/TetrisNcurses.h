@@ -6,15 +6,18 @@
 #define __TETRISNCURSES_H
 
 #include <Tetris.h>
+#include <TetrisPlugin.h>
+#include <TetrisVersus.h>
 #include <ncurses.h>
 
 class TetrisDrawerNcurses : public TetrisDrawer {
  protected:
-  void drawFrame(TetrisField * field, int baseCol);
-  void drawField(TetrisField *field, int baseCol);
-  void drawBar(TetrisField *field, int baseCol);
-  void drawScore(TetrisField *field, int baseCol);
-  void drawNextBar(TetrisField *field, int baseCol);
+  void drawFrame(const TetrisSnapshot *snapshot, int baseCol);
+  void drawField(const TetrisSnapshot *snapshot, int baseCol);
+  void drawBar(const TetrisSnapshot *snapshot, int baseCol);
+  void drawGhostBar(const TetrisSnapshot *snapshot, int baseCol);
+  void drawScore(const TetrisSnapshot *snapshot, int baseCol);
+  void drawNextBar(const TetrisSnapshot *snapshot, int baseCol);
   void erase() { ::erase(); }
   void update() { ::refresh(); }
 
@@ -25,6 +28,8 @@ class TetrisDrawerNcurses : public TetrisDrawer {
   void drawFrameTopOrButtom(int row, int col, int baseCol);
   void drawFrameInner(int row, int col, int baseCol);
   void drawBar(const TetrisBar *bar, int rot, int r, int c);
+  void drawFieldBar(const TetrisBar *bar, int rot, TetrisIndex barIndex,
+                    char dot, int baseCol);
 
  public:
   TetrisDrawerNcurses(Tetris *tetris);
@@ -36,7 +41,7 @@ class TetrisInputerNcurses : public TetrisInputer {
  public:
   TetrisInputerNcurses(Tetris *tetris);
   ~TetrisInputerNcurses() {}
-  InputType input();
+  TetrisInputEvent input();
 };
 
 class TetrisNcurses : public Tetris {
@@ -46,7 +51,9 @@ class TetrisNcurses : public Tetris {
   TetrisTimerPthread *mTimer;
 
  public:
-  TetrisNcurses();
+  /** Boards other than the player's are played by TetrisAutoplay. */
+  TetrisNcurses(int row = TETRIS_FIELD_ROW, int col = TETRIS_FIELD_COL,
+                int boards = 1);
   ~TetrisNcurses();
 };
 
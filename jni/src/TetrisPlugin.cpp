@@ -0,0 +1,248 @@
+/**
+ * @file TetrisPlugin.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisPlugin.h>
+#include <TetrisBot.h>
+#include <dlfcn.h>
+
+bool TetrisPlugin::open(const char *path, int row, int col)
+{
+  close();
+
+  mHandle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!mHandle) {
+    std::cerr << "<error> dlopen(" << dlerror() << ")\n";
+    return false;
+  }
+
+  TetrisPolicyEntry entry =
+    (TetrisPolicyEntry) dlsym(mHandle, TETRIS_POLICY_SYMBOL);
+  const TetrisPolicy *policy = entry ? entry() : NULL;
+  if (!policy || policy->version != TETRIS_POLICY_VERSION ||
+      !policy->create || !policy->destroy || !policy->decide) {
+    std::cerr << "<error> " << path << ": no " << TETRIS_POLICY_SYMBOL
+              << "() of version " << TETRIS_POLICY_VERSION << "\n";
+    close();
+    return false;
+  }
+
+  mState = policy->create(row, col);
+  if (!mState) {
+    std::cerr << "<error> " << path << ": create(" << row << ", " << col
+              << ")\n";
+    close();
+    return false;
+  }
+
+  mPolicy = policy;
+  mName = policy->name ? policy->name : path;
+  mRow = row;
+  mCol = col;
+  mCell.resize((size_t) row * col);
+  return true;
+}
+
+void TetrisPlugin::close()
+{
+  if (mPolicy && mState)
+    mPolicy->destroy(mState);
+  if (mHandle)
+    dlclose(mHandle);
+  mHandle = NULL;
+  mPolicy = NULL;
+  mState = NULL;
+}
+
+int32_t TetrisPlugin::place(const TetrisPolicyField *view, int32_t rot,
+                            int32_t col, uint8_t *out)
+{
+  TetrisPlugin *plugin = (TetrisPlugin *) view->host;
+  TetrisField *field = plugin->mField;
+  TetrisIndex drop;
+  if (!field || !TetrisAutoplay::reach(field, rot, col, drop))
+    return -1;
+  if (!out)
+    return 0;
+
+  const TetrisBar *bar = field->getBar();
+  int row = view->row;
+  std::copy(view->cell, view->cell + row * view->col, out);
+  for (int pos = 0; pos < bar->getIndexSize(); ++pos) {
+    TetrisIndex cell = bar->getIndex(pos, rot);
+    int r = drop.r + cell.r;
+    if (r >= 0)
+      out[r * view->col + drop.c + cell.c] = 1;
+  }
+
+  /** Delete full lines from the bottom up, moving the rest down. */
+  int lines = 0;
+  int dst = row - 1;
+  for (int src = row - 1; src >= 0; --src) {
+    uint8_t *line = out + src * view->col;
+    int filled = 0;
+    for (int c = 0; c < view->col; ++c)
+      filled += line[c];
+    if (filled == view->col) {
+      lines++;
+      continue;
+    }
+    if (dst != src)
+      std::copy(line, line + view->col, out + dst * view->col);
+    dst--;
+  }
+  std::fill(out, out + (dst + 1) * view->col, 0);
+  return lines;
+}
+
+bool TetrisPlugin::decide(TetrisField *field,
+                          TetrisPolicyDecision &decision)
+{
+  if (!mPolicy || field->getRow() != mRow || field->getCol() != mCol)
+    return false;
+
+  field->getOccupancy(0, mRow, &mCell[0]);
+  TetrisPolicyField view;
+  view.row = mRow;
+  view.col = mCol;
+  view.piece = TetrisEnvMap::getPiece(field->getBar()->getType());
+  view.rot = field->getBarRot();
+  view.rotSize = field->getBar()->getRotSize();
+  view.pieceRow = field->getBarIndex().r;
+  view.pieceCol = field->getBarIndex().c;
+  view.next = TetrisEnvMap::getPiece(field->getNextBar()->getType());
+  view.nextRot = field->getNextBarRot();
+  view.lines = field->getLines();
+  view.pieces = field->getPieces();
+  view.cell = &mCell[0];
+  view.place = place;
+  view.host = this;
+
+  memset(&decision, 0, sizeof(decision));
+  mField = field;
+  unsigned long long start = TetrisClock::nsec();
+  int32_t ret = mPolicy->decide(mState, &view, &decision);
+  mLast = TetrisClock::nsec() - start;
+  mField = NULL;
+  mLatency.add(mLast);
+
+  if (mBudget && mLast > mBudget) {
+    mTimeouts++;
+    return false;
+  }
+  if (ret) {
+    mFailures++;
+    return false;
+  }
+  return true;
+}
+
+bool TetrisPlugin::getMove(TetrisField *field,
+                           const TetrisPolicyDecision &decision,
+                           TetrisMove &move)
+{
+  if (!TetrisAutoplay::reach(field, decision.rot, decision.col,
+                             move.index)) {
+    mFailures++;
+    return false;
+  }
+  move.rot = decision.rot;
+  return true;
+}
+
+bool TetrisPlugin::play(TetrisField *field)
+{
+  if (field->isGameOver())
+    return false;
+
+  TetrisPolicyDecision decision;
+  TetrisMove move;
+  if (!decide(field, decision)) {
+    field->input(INPUT_TYPE_DROP);
+  } else if (decision.kind == TETRIS_POLICY_PLACE) {
+    if (getMove(field, decision, move))
+      TetrisAutoplay::apply(field, move);
+    else
+      field->input(INPUT_TYPE_DROP);
+  } else {
+    unsigned pieces = field->getPieces();
+    int size = std::min(decision.inputSize, TETRIS_POLICY_INPUT_MAX);
+    for (int i = 0; i < size && field->getPieces() == pieces; ++i)
+      field->input(TetrisEnvMap::getInput(decision.input[i]));
+    if (field->getPieces() == pieces)
+      field->input(INPUT_TYPE_DROP);
+  }
+  return !field->isGameOver();
+}
+
+TetrisInputerPlugin::TetrisInputerPlugin(Tetris *tetris,
+                                         TetrisField *field,
+                                         const char *path)
+  : TetrisInputer(tetris), mField(field), mInput(0), mPieces(0),
+    mDecided(false), mValid(false), mNext(0)
+{
+  mPlugin.open(path, field->getRow(), field->getCol());
+  mPlugin.setBudget(AUTOPLAY_INPUT_MSEC * 1000000ULL);
+}
+
+TetrisInputerPlugin::~TetrisInputerPlugin()
+{
+  if (getenv("TETRIS_STAT") && mPlugin.isOpen()) {
+    std::string name = std::string(mPlugin.getName()) + " decision";
+    mPlugin.getLatency().print(std::cerr, name.c_str(), "ns");
+    std::cerr << "timeouts " << mPlugin.getTimeouts() << " failures "
+              << mPlugin.getFailures() << "\n";
+  }
+}
+
+TetrisInputEvent TetrisInputerPlugin::input()
+{
+  unsigned long long now = TetrisClock::nsec();
+  if (now < mNext)
+    return INPUT_TYPE_EMPTY;
+  mNext = now + AUTOPLAY_INPUT_MSEC * 1000000ULL;
+
+  if (mField->isGameOver()) {
+    mField->reset(now ^ (unsigned long long) (size_t) mField);
+    mDecided = false;
+    return INPUT_TYPE_EMPTY;
+  }
+
+  if (!mDecided || mField->getPieces() != mPieces) {
+    mPieces = mField->getPieces();
+    mDecided = true;
+    mInput = 0;
+    mValid = mPlugin.decide(mField, mDecision);
+    if (mValid && mDecision.kind == TETRIS_POLICY_PLACE)
+      mValid = mPlugin.getMove(mField, mDecision, mMove);
+  }
+
+  if (!mValid)
+    return INPUT_TYPE_DROP;
+  if (mDecision.kind == TETRIS_POLICY_PLACE)
+    return TetrisAutoplay::step(mField, mMove);
+  if (mInput < std::min(mDecision.inputSize, TETRIS_POLICY_INPUT_MAX))
+    return TetrisEnvMap::getInput(mDecision.input[mInput++]);
+  return INPUT_TYPE_DROP;
+}
+
+TetrisInputer *TetrisInputerPlugin::create(Tetris *tetris,
+                                           TetrisField *field)
+{
+  const char *path = getenv("TETRIS_BOT");
+  if (path) {
+    TetrisInputerBot *inputer = new TetrisInputerBot(tetris, field, path);
+    if (inputer->isOpen())
+      return inputer;
+    delete inputer;
+  }
+  path = getenv("TETRIS_PLUGIN");
+  if (path) {
+    TetrisInputerPlugin *inputer =
+      new TetrisInputerPlugin(tetris, field, path);
+    if (inputer->isOpen())
+      return inputer;
+    delete inputer;
+  }
+  return new TetrisInputerAutoplay(tetris, field);
+}
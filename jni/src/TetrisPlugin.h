@@ -0,0 +1,117 @@
+/**
+ * @file TetrisPlugin.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISPLUGIN_H
+#define __TETRISPLUGIN_H
+
+#include <TetrisAutoplay.h>
+#include <TetrisEnvMap.h>
+#include <TetrisPolicy.h>
+#include <string>
+
+/**
+ * Policy loaded from a shared object, see TetrisPolicy.h. Every
+ * TetrisPlugin holds its own policy state, so one is needed per thread
+ * playing the policy.
+ */
+class TetrisPlugin {
+ private:
+  void *mHandle;
+  const TetrisPolicy *mPolicy;
+  void *mState;
+  std::string mName;
+  int mRow;
+  int mCol;
+
+  /** Field of the decide() call in progress, for place(). */
+  TetrisField *mField;
+  std::vector<uint8_t> mCell;
+
+  unsigned long long mBudget;
+  unsigned long long mLast;
+  unsigned long long mTimeouts;
+  unsigned long long mFailures;
+  TetrisHistogram mLatency;
+
+  static int32_t place(const TetrisPolicyField *view, int32_t rot,
+                       int32_t col, uint8_t *out);
+
+ public:
+  TetrisPlugin()
+    : mHandle(NULL), mPolicy(NULL), mState(NULL), mRow(0), mCol(0),
+      mField(NULL), mBudget(0), mLast(0), mTimeouts(0), mFailures(0) {}
+  ~TetrisPlugin() { close(); }
+
+  /** Load the policy at path and create its state for row x col. */
+  bool open(const char *path, int row, int col);
+  void close();
+
+  bool isOpen() const { return mPolicy != NULL; }
+  /** Name given by the policy, or its path. */
+  const char *getName() const { return mName.c_str(); }
+
+  /** A decision taking longer than nsec is thrown away. 0 is no limit. */
+  void setBudget(unsigned long long nsec) { mBudget = nsec; }
+
+  /**
+   * Ask the policy what to do with the falling bar of field. Return
+   * false if it failed or went over the budget.
+   */
+  bool decide(TetrisField *field, TetrisPolicyDecision &decision);
+
+  /**
+   * Turn a TETRIS_POLICY_PLACE decision into a move for
+   * TetrisAutoplay. Return false if the bar cannot get there.
+   */
+  bool getMove(TetrisField *field, const TetrisPolicyDecision &decision,
+               TetrisMove &move);
+
+  /**
+   * Decide and apply the decision, or drop the bar where it is if
+   * there is none. Return false once the game is over.
+   */
+  bool play(TetrisField *field);
+
+  /** Nanoseconds taken by the last decide(). */
+  unsigned long long getLast() const { return mLast; }
+  unsigned long long getTimeouts() const { return mTimeouts; }
+  /** Failed decide() calls and decisions which could not be applied. */
+  unsigned long long getFailures() const { return mFailures; }
+  const TetrisHistogram &getLatency() const { return mLatency; }
+};
+
+/**
+ * Inputer for a board played by a policy. Like TetrisInputerAutoplay
+ * one input is sent every AUTOPLAY_INPUT_MSEC, which is also the
+ * budget of a decision.
+ */
+class TetrisInputerPlugin : public TetrisInputer {
+ private:
+  TetrisField *mField;
+  TetrisPlugin mPlugin;
+  TetrisPolicyDecision mDecision;
+  TetrisMove mMove;
+  int mInput;
+  /** Pieces locked when mDecision was made. */
+  unsigned mPieces;
+  bool mDecided;
+  bool mValid;
+  unsigned long long mNext;
+
+ public:
+  TetrisInputerPlugin(Tetris *tetris, TetrisField *field, const char *path);
+  ~TetrisInputerPlugin();
+  TetrisInputEvent input();
+
+  bool isOpen() const { return mPlugin.isOpen(); }
+
+  /**
+   * Inputer for another board: the bot process at TETRIS_BOT or the
+   * policy at TETRIS_PLUGIN if either is set and opens, TetrisAutoplay
+   * otherwise.
+   */
+  static TetrisInputer *create(Tetris *tetris, TetrisField *field);
+};
+
+#endif /* __TETRISPLUGIN_H */
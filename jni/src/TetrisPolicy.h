@@ -0,0 +1,100 @@
+/**
+ * @file TetrisPolicy.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ *
+ * C interface of bot policies loaded at run time. A policy is a shared
+ * object exporting tetris_policy(), built without the engine:
+ *
+ *   cc -shared -fPIC -I jni/src -o my.so my.c
+ *
+ * The engine asks the policy for a decision each time a new bar
+ * spawns and applies it, see TetrisPlugin.
+ */
+#ifndef __TETRISPOLICY_H
+#define __TETRISPOLICY_H
+
+#include <TetrisEnv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TETRIS_POLICY_VERSION (1)
+#define TETRIS_POLICY_SYMBOL "tetris_policy"
+#define TETRIS_POLICY_INPUT_MAX (32)
+
+/** Kinds of decision. */
+enum {
+  /** Drop the bar turned to rot with its origin at column col. */
+  TETRIS_POLICY_PLACE = 0,
+  /** Apply input[0..inputSize), then drop the bar where it is. */
+  TETRIS_POLICY_INPUTS,
+};
+
+/**
+ * Read-only view of a field when a bar spawns. Pieces are numbered
+ * I J L O S T Z from 0 as in TetrisEnvObs. It is valid only during the
+ * decide() call it is passed to.
+ */
+typedef struct TetrisPolicyField {
+  int32_t row;
+  int32_t col;
+  /** Falling bar, its rotations and the cell of its origin. */
+  int32_t piece;
+  int32_t rot;
+  int32_t rotSize;
+  int32_t pieceRow;
+  int32_t pieceCol;
+  int32_t next;
+  int32_t nextRot;
+  int32_t lines;
+  int32_t pieces;
+  /** row * col bytes, row major from the top, 1 if locked. */
+  const uint8_t *cell;
+
+  /**
+   * Engine service: drop the falling bar turned to rot at column col
+   * as TETRIS_POLICY_PLACE would, without touching the field. Write the
+   * row * col cells left after full lines are deleted into out unless
+   * it is NULL, and return the lines deleted, or -1 if the bar cannot
+   * get there.
+   */
+  int32_t (*place)(const struct TetrisPolicyField *field, int32_t rot,
+                   int32_t col, uint8_t *out);
+  void *host;
+} TetrisPolicyField;
+
+typedef struct TetrisPolicyDecision {
+  int32_t kind;
+  int32_t rot;
+  int32_t col;
+  int32_t inputSize;
+  /** TETRIS_ENV_ACTION_* */
+  int32_t input[TETRIS_POLICY_INPUT_MAX];
+} TetrisPolicyDecision;
+
+typedef struct TetrisPolicy {
+  /** TETRIS_POLICY_VERSION the policy was built with. */
+  int32_t version;
+  const char *name;
+  /** State of one player, one per thread. NULL on failure. */
+  void *(*create)(int32_t row, int32_t col);
+  void (*destroy)(void *policy);
+  /**
+   * Fill decision for field. Return 0 on success; otherwise the bar is
+   * dropped where it spawned.
+   */
+  int32_t (*decide)(void *policy, const TetrisPolicyField *field,
+                    TetrisPolicyDecision *decision);
+} TetrisPolicy;
+
+typedef const TetrisPolicy *(*TetrisPolicyEntry)(void);
+
+/** Exported by every policy. */
+const TetrisPolicy *tetris_policy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TETRISPOLICY_H */
@@ -0,0 +1,55 @@
+/**
+ * @file TetrisRing.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISRING_H
+#define __TETRISRING_H
+
+#include <atomic>
+
+/**
+ * Bounded lock-free ring for one producer thread and one consumer
+ * thread. Both push and pop finish in a fixed number of steps. Size
+ * must be a power of two.
+ */
+template <class T, unsigned Size>
+class TetrisRing {
+ private:
+  enum { CACHE_LINE = 64 };
+
+  T mData[Size];
+  alignas(CACHE_LINE) std::atomic<unsigned> mHead;
+  alignas(CACHE_LINE) std::atomic<unsigned> mTail;
+
+ public:
+  TetrisRing() : mHead(0), mTail(0) {
+    static_assert((Size & (Size - 1)) == 0, "Size must be a power of two");
+  }
+
+  /** Called by the producer only. Return false if the ring is full. */
+  bool push(const T &value) {
+    unsigned tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mHead.load(std::memory_order_acquire) == Size)
+      return false;
+    mData[tail & (Size - 1)] = value;
+    mTail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Called by the consumer only. Return false if the ring is empty. */
+  bool pop(T &value) {
+    unsigned head = mHead.load(std::memory_order_relaxed);
+    if (head == mTail.load(std::memory_order_acquire))
+      return false;
+    value = mData[head & (Size - 1)];
+    mHead.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  unsigned size() const {
+    return mTail.load(std::memory_order_acquire) -
+      mHead.load(std::memory_order_acquire);
+  }
+};
+
+#endif /* __TETRISRING_H */
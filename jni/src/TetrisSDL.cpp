@@ -3,10 +3,234 @@
  * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
  */
 #include <TetrisSDL.h>
+#ifdef TETRIS_BITMAP_FONT
+#include <TetrisFont.h>
+#endif
 #include <iostream>
 #include <unistd.h>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static inline void copyPixels(Uint32 *dst, const Uint32 *src, int size)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= size; i += 4)
+    _mm_storeu_si128((__m128i *) (dst + i),
+                     _mm_loadu_si128((const __m128i *) (src + i)));
+#elif defined(__ARM_NEON)
+  for (; i + 4 <= size; i += 4)
+    vst1q_u32(dst + i, vld1q_u32(src + i));
+#endif
+  for (; i < size; ++i)
+    dst[i] = src[i];
+}
+
+TetrisCanvas::~TetrisCanvas()
+{
+  if (mTexture)
+    SDL_DestroyTexture(mTexture);
+}
+
+bool TetrisCanvas::create(SDL_Renderer *renderer, int width, int height,
+                          int blockWidth, int blockHeight)
+{
+  mWidth = width;
+  mHeight = height;
+  mBlockWidth = blockWidth;
+  mBlockHeight = blockHeight;
+  mRow = height / blockHeight;
+  mCol = width / blockWidth;
+
+  mPixels.assign((size_t) width * height, 0);
+  mTiles.assign((size_t) TILE_NR * blockWidth * blockHeight, 0);
+  mBack.assign(mRow * mCol, TILE_NONE);
+  mFront.assign(mRow * mCol, TILE_NONE);
+
+  mTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                               SDL_TEXTUREACCESS_STREAMING, width, height);
+  if (!mTexture) {
+    std::cerr << "<error> SDL_CreateTexture(" << SDL_GetError() << ")\n";
+    return false;
+  }
+  SDL_SetTextureBlendMode(mTexture, SDL_BLENDMODE_NONE);
+  SDL_UpdateTexture(mTexture, NULL, &mPixels[0], width * sizeof(Uint32));
+  return true;
+}
+
+void TetrisCanvas::setTile(int tile, SDL_Surface *surface,
+                           const SDL_Rect *srcrect)
+{
+  SDL_Surface *block =
+    SDL_CreateRGBSurfaceWithFormat(0, mBlockWidth, mBlockHeight, 32,
+                                   SDL_PIXELFORMAT_ARGB8888);
+  if (!block)
+    return;
+  SDL_FillRect(block, NULL, 0);
+  SDL_BlitScaled(surface, srcrect, block, NULL);
+
+  SDL_LockSurface(block);
+  Uint32 *dst = getTile(tile);
+  for (int y = 0; y < mBlockHeight; ++y)
+    memcpy(dst + y * mBlockWidth,
+           (Uint8 *) block->pixels + y * block->pitch,
+           mBlockWidth * sizeof(Uint32));
+  SDL_UnlockSurface(block);
+  SDL_FreeSurface(block);
+}
+
+void TetrisCanvas::blendTile(int dst, int src, int under, Uint8 alpha)
+{
+  Uint32 *d = getTile(dst);
+  const Uint32 *s = getTile(src);
+  const Uint32 *u = getTile(under);
+  for (int i = 0; i < mBlockWidth * mBlockHeight; ++i) {
+    Uint32 pixel = 0xff000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+      Uint32 a = (s[i] >> shift) & 0xff;
+      Uint32 b = (u[i] >> shift) & 0xff;
+      pixel |= ((a * alpha + b * (255 - alpha)) / 255) << shift;
+    }
+    d[i] = pixel;
+  }
+}
+
+void TetrisCanvas::copyTile(int tile, int row, int col)
+{
+  const Uint32 *src = getTile(tile);
+  Uint32 *dst = &mPixels[(size_t) row * mBlockHeight * mWidth +
+                         col * mBlockWidth];
+  for (int y = 0; y < mBlockHeight; ++y)
+    copyPixels(dst + y * mWidth, src + y * mBlockWidth, mBlockWidth);
+}
+
+void TetrisCanvas::erase()
+{
+  std::fill(mBack.begin(), mBack.end(), (Uint16) TILE_NONE);
+}
 
-Sprite TetrisDrawerSDL::loadSprite(const char* file, SDL_Renderer* renderer)
+void TetrisCanvas::update(SDL_Renderer *renderer)
+{
+  int top = mRow, buttom = -1, left = mCol, right = -1;
+  for (int r = 0; r < mRow; ++r)
+    for (int c = 0; c < mCol; ++c) {
+      int pos = r * mCol + c;
+      if (mBack[pos] == mFront[pos])
+        continue;
+      copyTile(mBack[pos], r, c);
+      mFront[pos] = mBack[pos];
+      top = std::min(top, r);
+      buttom = std::max(buttom, r);
+      left = std::min(left, c);
+      right = std::max(right, c);
+    }
+
+  if (buttom >= 0) {
+    SDL_Rect rect = { left * mBlockWidth, top * mBlockHeight,
+                      (right - left + 1) * mBlockWidth,
+                      (buttom - top + 1) * mBlockHeight };
+    SDL_UpdateTexture(mTexture, &rect,
+                      &mPixels[(size_t) rect.y * mWidth + rect.x],
+                      mWidth * sizeof(Uint32));
+  }
+  SDL_RenderCopy(renderer, mTexture, NULL, NULL);
+}
+
+void TetrisBatch::setSprite(const Sprite &sprite)
+{
+  mTexture = sprite.texture;
+  mWidth = sprite.width;
+  mHeight = sprite.height;
+}
+
+void TetrisBatch::add(const SDL_Rect &srcrect, const SDL_Rect &dstrect,
+                      Uint8 alpha)
+{
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  static const int corner[] = { 0, 1, 2, 2, 1, 3 };
+  int base = mVertex.size();
+  for (int i = 0; i < 4; ++i) {
+    int dx = i & 1;
+    int dy = i >> 1;
+    SDL_Vertex vertex;
+    vertex.position.x = dstrect.x + dx * dstrect.w;
+    vertex.position.y = dstrect.y + dy * dstrect.h;
+    vertex.color.r = 255;
+    vertex.color.g = 255;
+    vertex.color.b = 255;
+    vertex.color.a = alpha;
+    vertex.tex_coord.x = (srcrect.x + dx * srcrect.w) / mWidth;
+    vertex.tex_coord.y = (srcrect.y + dy * srcrect.h) / mHeight;
+    mVertex.push_back(vertex);
+  }
+  for (int i = 0; i < 6; ++i)
+    mIndex.push_back(base + corner[i]);
+#else
+  Quad quad = { srcrect, dstrect, alpha };
+  mQuad.push_back(quad);
+#endif
+}
+
+void TetrisBatch::flush(SDL_Renderer *renderer)
+{
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  if (!mIndex.empty())
+    SDL_RenderGeometry(renderer, mTexture, &mVertex[0], mVertex.size(),
+                       &mIndex[0], mIndex.size());
+  mVertex.clear();
+  mIndex.clear();
+#else
+  for (size_t i = 0; i < mQuad.size(); ++i) {
+    SDL_SetTextureAlphaMod(mTexture, mQuad[i].alpha);
+    SDL_RenderCopy(renderer, mTexture, &mQuad[i].srcrect,
+                   &mQuad[i].dstrect);
+  }
+  if (!mQuad.empty())
+    SDL_SetTextureAlphaMod(mTexture, 255);
+  mQuad.clear();
+#endif
+}
+
+SDL_Surface *TetrisDrawerSDL::loadBitmap(const char *file)
+{
+#ifdef TETRIS_EMBED_ASSETS
+  static const struct {
+    const char *file;
+    const unsigned char *data;
+    const unsigned int *size;
+  } assets[] = {
+    { TETRIS_FRAME_BITMAP, Frame_bmp, &Frame_bmp_len },
+    { TETRIS_BAR_BITMAP, Bar_bmp, &Bar_bmp_len },
+  };
+
+  for (size_t i = 0; i < sizeof(assets) / sizeof(*assets); ++i)
+    if (!strcmp(assets[i].file, file))
+      return SDL_LoadBMP_RW(SDL_RWFromConstMem(assets[i].data,
+                                               *assets[i].size), 1);
+  return NULL;
+#else
+  return SDL_LoadBMP(file);
+#endif
+}
+
+Sprite TetrisDrawerSDL::createSprite(SDL_Surface *surface, const char *name,
+                                     SDL_Renderer *renderer)
+{
+  Sprite sprite;
+  sprite.width = surface->w;
+  sprite.height = surface->h;
+  sprite.texture = SDL_CreateTextureFromSurface(renderer, surface);
+  if (!sprite.texture)
+    std::cerr << "<error> SDL_CreateTextureFromSurface(" << name << ")\n";
+  return sprite;
+}
+
+Sprite TetrisDrawerSDL::loadSprite(const char* file, SDL_Renderer* renderer,
+                                   SDL_Surface **keep)
 {
   Sprite sprite;
   SDL_Surface *surface;
@@ -15,41 +239,256 @@ Sprite TetrisDrawerSDL::loadSprite(const char* file, SDL_Renderer* renderer)
   sprite.width = -1;
   sprite.height = -1;
 
-  surface = SDL_LoadBMP(file);
+  surface = loadBitmap(file);
   if (surface == NULL) {
     std::cerr << "<error> SDL_LoadBMP(" << file << ")\n";
     return sprite;
   }
-  sprite.width = surface->w;
-  sprite.height = surface->h;
 
-  sprite.texture = SDL_CreateTextureFromSurface(renderer, surface);
-  if (!sprite.texture)
-    std::cerr << "<error> SDL_CreateTextureFromSurface(" << file << ")\n";
-  SDL_FreeSurface(surface);
+  sprite = createSprite(surface, file, renderer);
+  if (keep)
+    *keep = surface;
+  else
+    SDL_FreeSurface(surface);
 
   return sprite;
 }
 
+#ifdef TETRIS_BITMAP_FONT
+/** Expand TetrisFont.h into one row of yellow glyphs. */
+SDL_Surface *TetrisDrawerSDL::createFont()
+{
+  int size = TETRIS_FONT_LAST - TETRIS_FONT_FIRST + 1;
+  SDL_Surface *surface =
+    SDL_CreateRGBSurfaceWithFormat(0, size * TETRIS_FONT_WIDTH,
+                                   TETRIS_FONT_HEIGHT, 32,
+                                   SDL_PIXELFORMAT_ARGB8888);
+  if (!surface)
+    return NULL;
+
+  SDL_LockSurface(surface);
+  for (int ch = 0; ch < size; ++ch)
+    for (int y = 0; y < TETRIS_FONT_HEIGHT; ++y) {
+      Uint32 *pixels = (Uint32 *) ((Uint8 *) surface->pixels +
+                                   y * surface->pitch);
+      for (int x = 0; x < TETRIS_FONT_WIDTH; ++x) {
+        bool dot = TETRIS_FONT[ch][y] & (0x80 >> x);
+        pixels[ch * TETRIS_FONT_WIDTH + x] = dot ? 0xffffff00 : 0;
+      }
+    }
+  SDL_UnlockSurface(surface);
+  return surface;
+}
+#endif
+
+void TetrisDrawerSDL::createCanvas(SDL_Surface *frame, SDL_Surface *bar,
+                                   SDL_Surface *font)
+{
+  if (!frame || !bar ||
+      !mCanvas.create(mRenderer, mWindowWidth, mWindowHeight,
+                      mBlockWidth, mBlockHeight)) {
+    mSoftware = false;
+    return;
+  }
+
+  for (int i = 0; i < 8; ++i) {
+    SDL_Rect srcrect = { i * bar->h, 0, bar->h, bar->h };
+    mCanvas.setTile(TetrisCanvas::TILE_BAR + i, bar, &srcrect);
+  }
+  for (int i = 0; i < 8; ++i)
+    mCanvas.blendTile(TetrisCanvas::TILE_GHOST + i,
+                      TetrisCanvas::TILE_BAR + i,
+                      TetrisCanvas::TILE_BAR + type2index(BAR_TYPE_E),
+                      TETRIS_SDL_GHOST_ALPHA);
+  for (int i = 0; i < 9; ++i) {
+    SDL_Rect srcrect = { (i % 3) * (frame->w / 3), (i / 3) * (frame->h / 3),
+                         frame->w / 3, frame->h / 3 };
+    mCanvas.setTile(TetrisCanvas::TILE_FRAME + i, frame, &srcrect);
+  }
+
+  for (int ch = TetrisCanvas::GLYPH_FIRST; ch <= TetrisCanvas::GLYPH_LAST;
+       ++ch) {
+    int tile = TetrisCanvas::TILE_GLYPH + ch - TetrisCanvas::GLYPH_FIRST;
+#ifdef TETRIS_BITMAP_FONT
+    if (!font)
+      return;
+    SDL_Rect srcrect = { (ch - TETRIS_FONT_FIRST) * TETRIS_FONT_WIDTH, 0,
+                         TETRIS_FONT_WIDTH, TETRIS_FONT_HEIGHT };
+    mCanvas.setTile(tile, font, &srcrect);
+#else
+    if (!mFont)
+      return;
+    SDL_Color color = { 255, 255, 0 };
+    SDL_Surface *surface = TTF_RenderGlyph_Solid(mFont, ch, color);
+    if (!surface)
+      continue;
+    mCanvas.setTile(tile, surface, NULL);
+    SDL_FreeSurface(surface);
+#endif
+  }
+}
+
+#ifndef TETRIS_BITMAP_FONT
+void TetrisDrawerSDL::createGlyph()
+{
+  for (int ch = TetrisCanvas::GLYPH_FIRST; ch <= TetrisCanvas::GLYPH_LAST;
+       ++ch) {
+    int glyph = ch - TetrisCanvas::GLYPH_FIRST;
+    mGlyph[glyph] = NULL;
+    if (!mFont)
+      continue;
+    SDL_Color color = { 255, 255, 0 };
+    SDL_Surface *surface = TTF_RenderGlyph_Solid(mFont, ch, color);
+    if (!surface)
+      continue;
+    mGlyph[glyph] = SDL_CreateTextureFromSurface(mRenderer, surface);
+    SDL_Rect rect = { 0, 0, surface->w, surface->h };
+    mGlyphRect[glyph] = rect;
+    SDL_FreeSurface(surface);
+  }
+}
+#endif
+
 TetrisDrawerSDL::TetrisDrawerSDL(Tetris *tetris)
   : TetrisDrawer(tetris)
 {
-  SDL_CreateWindowAndRenderer(TETRIS_SDL_WIDTH, TETRIS_SDL_HEIGHT,
-                              0, &mWindow, &mRenderer);
-  mFrameSprite = loadSprite(TETRIS_FRAME_BITMAP, mRenderer);
-  mBarSprite = loadSprite(TETRIS_BAR_BITMAP, mRenderer);
+  TetrisStartup *startup = tetris->getStartup();
+
+  /**
+   * Boards are laid out in a square grid of windows sized for one
+   * board, as long as the desktop is large enough.
+   */
+  int size = tetris->getBoardSize();
+  int line = 1;
+  while (line * line < size)
+    line++;
+  int lines = (size + line - 1) / line;
+  int width = TETRIS_SDL_WIDTH * line;
+  int height = TETRIS_SDL_HEIGHT * lines;
+  SDL_DisplayMode mode;
+  if (size > 1 && SDL_GetDesktopDisplayMode(0, &mode) == 0) {
+    width = std::min(width, mode.w);
+    height = std::min(height, mode.h);
+  }
+
+  SDL_CreateWindowAndRenderer(width, height, 0, &mWindow, &mRenderer);
+  startup->mark("window");
 
   SDL_GetWindowSize(mWindow, &mWindowWidth, &mWindowHeight);
-  mBlockWidth = mWindowWidth / 18;
-  mBlockHeight = mWindowHeight / 26;
+  mTarget = NULL;
+  if (getenv("TETRIS_SDL_OFFSCREEN")) {
+    mTarget = SDL_CreateTexture(mRenderer, SDL_PIXELFORMAT_ARGB8888,
+                                SDL_TEXTUREACCESS_TARGET,
+                                mWindowWidth, mWindowHeight);
+    if (mTarget)
+      SDL_SetRenderTarget(mRenderer, mTarget);
+    else
+      std::cerr << "<error> SDL_CreateTexture(" << SDL_GetError()
+                << ")\n";
+  }
+  const char *capture = getenv("TETRIS_CAPTURE");
+  if (capture)
+    mCapture.open(capture, mWindowWidth, mWindowHeight,
+                  getenv("TETRIS_CAPTURE_DROP") != NULL);
+
+  /** TETRIS_SDL_SOFTWARE forces CPU compositing on any renderer. */
+  SDL_RendererInfo info;
+  mSoftware = getenv("TETRIS_SDL_SOFTWARE") ||
+    (SDL_GetRendererInfo(mRenderer, &info) == 0 &&
+     (info.flags & SDL_RENDERER_SOFTWARE));
+  mGhost = false;
+
+  SDL_Surface *frame = NULL;
+  SDL_Surface *bar = NULL;
+  SDL_Surface *font = NULL;
+  mFrameSprite = loadSprite(TETRIS_FRAME_BITMAP, mRenderer,
+                            mSoftware ? &frame : NULL);
+  mBarSprite = loadSprite(TETRIS_BAR_BITMAP, mRenderer,
+                          mSoftware ? &bar : NULL);
+  SDL_SetTextureBlendMode(mBarSprite.texture, SDL_BLENDMODE_BLEND);
+  startup->mark("bitmap");
 
+  mScreenRow = TETRIS_SDL_BLOCK_ROW * lines;
+  mScreenCol = TETRIS_SDL_BLOCK_COL * line;
+  mMarginRow = 6;
+  mMarginCol = 8;
+  mBlockWidth = std::max(1, mWindowWidth / mScreenCol);
+  mBlockHeight = std::max(1, mWindowHeight / mScreenRow);
+  layout();
+
+  mFrameBatch.setSprite(mFrameSprite);
+  mBarBatch.setSprite(mBarSprite);
+
+#ifdef TETRIS_BITMAP_FONT
+  mFontSprite.texture = NULL;
+  font = createFont();
+  if (font) {
+    mFontSprite = createSprite(font, "font", mRenderer);
+    SDL_SetTextureBlendMode(mFontSprite.texture, SDL_BLENDMODE_BLEND);
+    mFontBatch.setSprite(mFontSprite);
+  }
+#else
   TTF_Init();
   mFont = TTF_OpenFont(TETRIS_FONT_FILE, 16);
+  createGlyph();
+#endif
+  startup->mark("font");
+
+  if (mSoftware) {
+    createCanvas(frame, bar, font);
+    startup->mark("canvas");
+  }
+  if (frame)
+    SDL_FreeSurface(frame);
+  if (bar)
+    SDL_FreeSurface(bar);
+  if (font)
+    SDL_FreeSurface(font);
+}
+
+void TetrisDrawerSDL::erase()
+{
+  if (mSoftware)
+    mCanvas.erase();
+  else
+    SDL_RenderClear(mRenderer);
+}
+
+void TetrisDrawerSDL::update()
+{
+  if (mSoftware) {
+    mCanvas.update(mRenderer);
+  } else {
+    mFrameBatch.flush(mRenderer);
+    mBarBatch.flush(mRenderer);
+#ifdef TETRIS_BITMAP_FONT
+    mFontBatch.flush(mRenderer);
+#endif
+  }
+
+  if (mCapture.isOpen()) {
+    unsigned char *pixels = mCapture.begin();
+    if (pixels) {
+      SDL_RenderReadPixels(mRenderer, NULL, SDL_PIXELFORMAT_RGB24, pixels,
+                           mWindowWidth * 3);
+      mCapture.end();
+    }
+  }
+  if (!mTarget)
+    SDL_RenderPresent(mRenderer);
 }
 
 TetrisDrawerSDL::~TetrisDrawerSDL()
 {
-  ;
+  mCapture.close();
+  if (mTarget)
+    SDL_DestroyTexture(mTarget);
+#ifndef TETRIS_BITMAP_FONT
+  for (int i = 0; i <= TetrisCanvas::GLYPH_LAST - TetrisCanvas::GLYPH_FIRST;
+       ++i)
+    if (mGlyph[i])
+      SDL_DestroyTexture(mGlyph[i]);
+#endif
 }
 
 int TetrisDrawerSDL::type2index(BarType type)
@@ -64,67 +503,82 @@ int TetrisDrawerSDL::type2index(BarType type)
     CASE(BAR_TYPE_S, 5);
     CASE(BAR_TYPE_T, 6);
     CASE(BAR_TYPE_Z, 7);
+    /** Garbage has no sprite of its own. */
+    CASE(BAR_TYPE_G, 3);
 #undef CASE
   default:
     break;
   };
-  return -1;
+  /** Bars of a TetrisBarSet take the sprites of the built-in ones. */
+  return 1 + (unsigned char) type % TETRIS_BAR_NR;
 }
 
-void TetrisDrawerSDL::drawFrame(TetrisField *field, int srcRow,
+void TetrisDrawerSDL::drawFrame(const TetrisSnapshot *snapshot, int srcRow,
                                 int srcCol, int dstRow, int dstCol)
 {
+  dstRow += mBaseRow;
+  if (mSoftware) {
+    mCanvas.put(dstRow, dstCol,
+                TetrisCanvas::TILE_FRAME + srcRow * 3 + srcCol);
+    return;
+  }
 #define RECT(r, c, w, h) { (c) * (w), (r) * (h), (w), (h) }
   SDL_Rect srcrect = RECT(srcRow, srcCol, mFrameSprite.width / 3,
                           mFrameSprite.height / 3);
   SDL_Rect dstrect = RECT(dstRow, dstCol, mBlockWidth, mBlockHeight);
 #undef RECT
-  SDL_RenderCopy(mRenderer, mFrameSprite.texture, &srcrect, &dstrect);
+  mFrameBatch.add(srcrect, dstrect);
 }
 
-void TetrisDrawerSDL::drawFrameTop(TetrisField *field, int dstRow,
-                                   int baseCol)
+void TetrisDrawerSDL::drawFrameTop(const TetrisSnapshot *snapshot,
+                                   int dstRow, int baseCol)
 {
-  int col = field->getCol();
-  drawFrame(field, 0, 0, dstRow, baseCol);
+  int col = mView.col;
+  drawFrame(snapshot, 0, 0, dstRow, baseCol);
   for (int c = 1; c <= col; ++c)
-    drawFrame(field, 0, 1, dstRow, c + baseCol);
-  drawFrame(field, 0, 2, dstRow, col + 1 + baseCol);
+    drawFrame(snapshot, 0, 1, dstRow, c + baseCol);
+  drawFrame(snapshot, 0, 2, dstRow, col + 1 + baseCol);
 }
 
-void TetrisDrawerSDL::drawFrameButtom(TetrisField *field, int dstRow,
-                                      int baseCol)
+void TetrisDrawerSDL::drawFrameButtom(const TetrisSnapshot *snapshot,
+                                      int dstRow, int baseCol)
 {
-  int col = field->getCol();
-  drawFrame(field, 2, 0, dstRow, baseCol);
+  int col = mView.col;
+  drawFrame(snapshot, 2, 0, dstRow, baseCol);
   for (int c = 1; c <= col; ++c)
-    drawFrame(field, 2, 1, dstRow, c + baseCol);
-  drawFrame(field, 2, 2, dstRow, col + 1 + baseCol);
+    drawFrame(snapshot, 2, 1, dstRow, c + baseCol);
+  drawFrame(snapshot, 2, 2, dstRow, col + 1 + baseCol);
 }
 
-void TetrisDrawerSDL::drawFrameInner(TetrisField *field, int dstRow,
-                                     int baseCol)
+void TetrisDrawerSDL::drawFrameInner(const TetrisSnapshot *snapshot,
+                                     int dstRow, int baseCol)
 {
-  drawFrame(field, 1, 0, dstRow, baseCol);
-  drawFrame(field, 1, 2, dstRow, field->getCol() + 1 + baseCol);
+  drawFrame(snapshot, 1, 0, dstRow, baseCol);
+  drawFrame(snapshot, 1, 2, dstRow, mView.col + 1 + baseCol);
 }
 
-void TetrisDrawerSDL::drawFrame(TetrisField *field, int baseCol)
+void TetrisDrawerSDL::drawFrame(const TetrisSnapshot *snapshot, int baseCol)
 {
-  int row = field->getRow();
-  drawFrameTop(field, 0, baseCol);
+  int row = mView.row;
+  drawFrameTop(snapshot, 0, baseCol);
   for (int r = 1; r <= row; ++r)
-    drawFrameInner(field, r, baseCol);
-  drawFrameButtom(field, row + 1, baseCol);
+    drawFrameInner(snapshot, r, baseCol);
+  drawFrameButtom(snapshot, row + 1, baseCol);
 }
 
 void TetrisDrawerSDL::drawBar(int row, int col, BarType type)
 {
+  row += mBaseRow;
+  if (mSoftware) {
+    int tile = mGhost ? TetrisCanvas::TILE_GHOST : TetrisCanvas::TILE_BAR;
+    mCanvas.put(row, col, tile + type2index(type));
+    return;
+  }
   SDL_Rect srcrect = { type2index(type) * mBarSprite.height, 0,
                        mBarSprite.height, mBarSprite.height };
   SDL_Rect dstrect = { col * mBlockWidth, row * mBlockHeight,
                        mBlockWidth, mBlockHeight };
-  SDL_RenderCopy(mRenderer, mBarSprite.texture, &srcrect, &dstrect);
+  mBarBatch.add(srcrect, dstrect, mGhost ? TETRIS_SDL_GHOST_ALPHA : 255);
 }
 
 void TetrisDrawerSDL::drawBar(const TetrisBar *bar, int rot,
@@ -138,41 +592,76 @@ void TetrisDrawerSDL::drawBar(const TetrisBar *bar, int rot,
   }
 }
 
-void TetrisDrawerSDL::drawBar(TetrisField *field, int baseCol)
+void TetrisDrawerSDL::drawFieldBar(const TetrisBar *bar, int rot,
+                                   TetrisIndex barIndex, int baseCol)
+{
+  BarType type = bar->getType();
+  int indexSize = bar->getIndexSize();
+  for (int pos = 0; pos < indexSize; ++pos) {
+    TetrisIndex index = bar->getIndex(pos, rot);
+    int r = barIndex.r + index.r;
+    int c = barIndex.c + index.c;
+    if (mView.contains(r, c))
+      drawBar(r - mView.r + 1, baseCol + c - mView.c + 1, type);
+  }
+}
+
+void TetrisDrawerSDL::drawBar(const TetrisSnapshot *snapshot, int baseCol)
+{
+  drawFieldBar(snapshot->getBar(), snapshot->getBarRot(),
+               snapshot->getBarIndex(), baseCol);
+}
+
+void TetrisDrawerSDL::drawGhostBar(const TetrisSnapshot *snapshot, int baseCol)
 {
-  const TetrisBar *bar = field->getBar();
-  TetrisIndex barIndex = field->getBarIndex();
-  int rot = field->getBarRot();
-  drawBar(bar, rot, barIndex.r, barIndex.c + baseCol);
+  mGhost = true;
+  drawFieldBar(snapshot->getBar(), snapshot->getBarRot(),
+               snapshot->getGhostIndex(), baseCol);
+  mGhost = false;
 }
 
-void TetrisDrawerSDL::drawField(TetrisField *field, int baseCol)
+void TetrisDrawerSDL::drawField(const TetrisSnapshot *snapshot, int baseCol)
 {
-  int row = field->getRow();
-  int col = field->getCol();
-  for (int r = 0; r < row; ++r)
-    for (int c = 0; c < col; ++c)
-      drawBar(r + 1, baseCol + c + 1, field->getGrid(r, c));
+  for (int r = 0; r < mView.row; ++r)
+    for (int c = 0; c < mView.col; ++c)
+      drawBar(r + 1, baseCol + c + 1,
+              snapshot->getGrid(mView.r + r, mView.c + c));
 }
 
-void TetrisDrawerSDL::drawNextBar(TetrisField *field, int baseCol)
+void TetrisDrawerSDL::drawNextBar(const TetrisSnapshot *snapshot, int baseCol)
 {
-  const TetrisBar *nextBar = field->getNextBar();
-  int nextRot = field->getNextBarRot();
-  drawBar(nextBar, nextRot, 2, TETRIS_FIELD_COL + 3 + baseCol);
+  const TetrisBar *nextBar = snapshot->getNextBar();
+  int nextRot = snapshot->getNextBarRot();
+  drawBar(nextBar, nextRot, 2, mView.col + 3 + baseCol);
 }
 
 void TetrisDrawerSDL::drawChar(Uint16 ch, int row, int col)
 {
-  SDL_Color color = { 255, 255, 0 };
-  SDL_Surface *surface = TTF_RenderGlyph_Solid(mFont, ch, color);
-  SDL_Texture *texture = SDL_CreateTextureFromSurface(mRenderer, surface);
-  SDL_Rect srcrect = { 0, 0, surface->w, surface->h };
+  row += mBaseRow;
+  if (mSoftware) {
+    if (ch >= TetrisCanvas::GLYPH_FIRST && ch <= TetrisCanvas::GLYPH_LAST)
+      mCanvas.put(row, col, TetrisCanvas::TILE_GLYPH + ch -
+                  TetrisCanvas::GLYPH_FIRST);
+    return;
+  }
+#ifdef TETRIS_BITMAP_FONT
+  if (ch < TETRIS_FONT_FIRST || ch > TETRIS_FONT_LAST)
+    return;
+  SDL_Rect srcrect = { (ch - TETRIS_FONT_FIRST) * TETRIS_FONT_WIDTH, 0,
+                       TETRIS_FONT_WIDTH, TETRIS_FONT_HEIGHT };
+  SDL_Rect dstrect = { col * mBlockWidth, row * mBlockHeight,
+                       mBlockWidth, mBlockHeight };
+  mFontBatch.add(srcrect, dstrect);
+#else
+  if (ch < TetrisCanvas::GLYPH_FIRST || ch > TetrisCanvas::GLYPH_LAST)
+    return;
+  int glyph = ch - TetrisCanvas::GLYPH_FIRST;
+  if (!mGlyph[glyph])
+    return;
   SDL_Rect dstrect = { col * mBlockWidth, row * mBlockHeight,
                        mBlockWidth, mBlockHeight };
-  SDL_RenderCopy(mRenderer, texture, &srcrect, &dstrect);
-  SDL_FreeSurface(surface);
-  SDL_DestroyTexture(texture);
+  SDL_RenderCopy(mRenderer, mGlyph[glyph], &mGlyphRect[glyph], &dstrect);
+#endif
 }
 
 void TetrisDrawerSDL::drawString(const wchar_t *str, int row, int col)
@@ -201,26 +690,27 @@ void TetrisDrawerSDL::drawValue(int value, int row, int col)
   drawChar(number[value % 10], row, col);
 }
 
-#define TETRIS_DRAW(field, name, r, c)                               \
+#define TETRIS_DRAW(snapshot, name, r, c)                            \
   do {                                                               \
     static const wchar_t prefix[] = L"" #name ": ";                  \
     static const size_t size = sizeof(prefix) / sizeof(*prefix) - 1; \
     drawString(prefix, r, c);                                        \
-    drawValue(field->get##name(), r, c + size);                      \
+    drawValue(snapshot->get##name(), r, c + size);                   \
   } while (false)
 
-void TetrisDrawerSDL::drawScore(TetrisField *field, int baseCol)
+void TetrisDrawerSDL::drawScore(const TetrisSnapshot *snapshot, int baseCol)
 {
-  TETRIS_DRAW(field, Score, field->getRow() + 3, baseCol);
+  TETRIS_DRAW(snapshot, Score, mView.row + 3, baseCol);
 }
 
 #undef TETRIS_DRAW
 
 void TetrisDrawerSDL::gameover()
 {
-  drawString(L"Game Over", mTetris->getField()->getRow() / 2, 4);
+  drawString(L"Game Over", mView.row / 2, 4);
   update();
-  SDL_Delay(3000);
+  if (!mTarget)
+    SDL_Delay(3000);
 }
 
 #define DIRECT_SIZE (0.05f)
@@ -246,79 +736,141 @@ DirectType getDirectType(float dx, float dy)
   return DIRECT_TYPE_EMPTY;
 }
 
-#ifdef ANDROID
-static int threadFunction(void *data)
+#ifdef TETRIS_INPUTER_THREAD
+/** Never waits: an input which does not fit in the ring is lost. */
+static void pushInput(InputerThreadData *threadData, TetrisInputEvent event)
 {
-  InputerThreadData *threadData = (InputerThreadData *) data;
-  DirectType directType;
-  SDL_Event event;
-  float dx = 0;
-  float dy = 0;
+  if (!threadData->ring.push(event))
+    threadData->overflow++;
+}
 
-  while (!threadData->stop) {
-    if (threadData->interrupt)
-      break;
-    if (SDL_WaitEvent(&event) < 0)
-      continue;
-    if (event.type == SDL_QUIT) {
-      *threadData->inputType = INPUT_TYPE_QUIT;
-      continue;
+static void handleEvent(InputerThreadData *threadData,
+                        const SDL_Event &event)
+{
+  if (event.type == SDL_QUIT) {
+    pushInput(threadData, INPUT_TYPE_QUIT);
+    return;
+  }
+
+  if (event.type == SDL_KEYDOWN) {
+    switch (event.key.keysym.sym) {
+#define CASE(key, type) \
+      case key: { pushInput(threadData, type); break; }
+      CASE(SDLK_UP, INPUT_TYPE_UP);
+      CASE(SDLK_DOWN, INPUT_TYPE_DOWN);
+      CASE(SDLK_RIGHT, INPUT_TYPE_RIGHT);
+      CASE(SDLK_LEFT, INPUT_TYPE_LEFT);
+      CASE(SDLK_z, INPUT_TYPE_ROT_LEFT);
+      CASE(SDLK_x, INPUT_TYPE_ROT_RIGHT);
+      CASE(SDLK_SPACE, INPUT_TYPE_DROP);
+#undef CASE
+    default: { break; }
     }
+    return;
+  }
 
-    if (event.type != SDL_FINGERMOTION)
-      continue;
+  if (event.type != SDL_FINGERMOTION)
+    return;
 
-    dx += event.tfinger.dx;
-    dy += event.tfinger.dy;
+  threadData->dx += event.tfinger.dx;
+  threadData->dy += event.tfinger.dy;
 
-    directType = getDirectType(dx, dy);
-    if (directType == DIRECT_TYPE_EMPTY)
-      continue;
+  DirectType directType = getDirectType(threadData->dx, threadData->dy);
+  if (directType == DIRECT_TYPE_EMPTY)
+    return;
 
-    dx = 0;
-    dy = 0;
+  threadData->dx = 0;
+  threadData->dy = 0;
 
-    switch (directType) {
+  switch (directType) {
 #define CASE(key, type) \
-      case key: { *threadData->inputType = type; break; }
-      CASE(DIRECT_TYPE_UP, INPUT_TYPE_ROT_LEFT);
-      CASE(DIRECT_TYPE_DOWN, INPUT_TYPE_DOWN);
-      CASE(DIRECT_TYPE_RIGHT, INPUT_TYPE_RIGHT);
-      CASE(DIRECT_TYPE_LEFT, INPUT_TYPE_LEFT);
+    case key: { pushInput(threadData, type); break; }
+    CASE(DIRECT_TYPE_UP, INPUT_TYPE_ROT_LEFT);
+    CASE(DIRECT_TYPE_DOWN, INPUT_TYPE_DOWN);
+    CASE(DIRECT_TYPE_RIGHT, INPUT_TYPE_RIGHT);
+    CASE(DIRECT_TYPE_LEFT, INPUT_TYPE_LEFT);
 #undef CASE
-    default: { break; }
-    }
+  default: { break; }
+  }
+}
+
+#ifdef ANDROID
+static int threadFunction(void *data)
+{
+  InputerThreadData *threadData = (InputerThreadData *) data;
+  SDL_Event event;
+
+  TETRIS_TRACE_THREAD(INPUTER_THREAD_NAME);
+  while (!threadData->stop) {
+    if (threadData->interrupt)
+      break;
+    if (SDL_WaitEventTimeout(&event, INPUTER_THREAD_TIMEOUT))
+      handleEvent(threadData, event);
   }
 
   return 0;
 }
+#else
+/** Called by SDL for every event queued while the game loop pumps. */
+static int eventWatch(void *data, SDL_Event *event)
+{
+  handleEvent((InputerThreadData *) data, *event);
+  return 0;
+}
+#endif
 
-TetrisInputerSDL::TetrisInputerSDL(Tetris *tetris)
-  : TetrisInputer(tetris)
+TetrisInputerSDL::TetrisInputerSDL(Tetris *tetris, TetrisTimer *timer)
+  : TetrisInputer(tetris), mDropped(0)
 {
-  mInputType = INPUT_TYPE_EMPTY;
-  mThreadData.inputType = &mInputType;
+#ifdef ANDROID
   mThread = SDL_CreateThread(threadFunction, INPUTER_THREAD_NAME,
                              &mThreadData);
+#else
+  mPumped = false;
+  SDL_AddEventWatch(eventWatch, &mThreadData);
+#endif
 }
 
 TetrisInputerSDL::~TetrisInputerSDL()
 {
+#ifdef ANDROID
   mThreadData.stop = true;
+  SDL_WaitThread(mThread, NULL);
+#else
+  SDL_DelEventWatch(eventWatch, &mThreadData);
+#endif
 }
 
-InputType TetrisInputerSDL::input()
+TetrisInputEvent TetrisInputerSDL::input()
 {
-  if (mInputType == INPUT_TYPE_EMPTY)
+#ifndef ANDROID
+  /**
+   * Pump once per frame on this thread, which initialized video. The
+   * watch has seen every event by then, so the queue is emptied.
+   */
+  if (!mPumped) {
+    SDL_PumpEvents();
+    SDL_FlushEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+    mPumped = true;
+  }
+#endif
+  TetrisInputEvent ret;
+  if (!mThreadData.ring.pop(ret)) {
+#ifndef ANDROID
+    mPumped = false;
+#endif
+    /** Inputs lost to a full ring are reported from this thread. */
+    unsigned long long overflow = mThreadData.overflow;
+    for (; mDropped < overflow; ++mDropped)
+      mTetris->getLatency()->drop();
     return INPUT_TYPE_EMPTY;
-
-  InputType ret = mInputType;
-  mInputType = INPUT_TYPE_EMPTY;
+  }
   return ret;
 }
 #else
-TetrisInputerSDL::TetrisInputerSDL(Tetris *tetris)
-  : TetrisInputer(tetris)
+TetrisInputerSDL::TetrisInputerSDL(Tetris *tetris, TetrisTimer *timer)
+  : TetrisInputer(tetris), mTimer((TetrisTimerSDL *) timer),
+    mBatchSize(0), mBatchPos(0), mFilled(false)
 {
 
 }
@@ -328,48 +880,171 @@ TetrisInputerSDL::~TetrisInputerSDL()
 
 }
 
-InputType TetrisInputerSDL::input()
+void TetrisInputerSDL::push(TetrisInputEvent event)
 {
-  SDL_Event event;
-  if (SDL_PollEvent(&event) < 0)
-    return INPUT_TYPE_EMPTY;
+  mBatch[mBatchSize++] = event;
+}
+
+void TetrisInputerSDL::handle(const SDL_Event &event)
+{
+  if (mTimer->isTimerEvent(event)) {
+    push(INPUT_TYPE_TIMER);
+    return;
+  }
+
+  if (event.type == SDL_QUIT) {
+    push(INPUT_TYPE_QUIT);
+    return;
+  }
 
-  if (event.type == SDL_QUIT)
-    return INPUT_TYPE_QUIT;
+  if (event.type == SDL_WINDOWEVENT) {
+    switch (event.window.event) {
+    case SDL_WINDOWEVENT_HIDDEN:
+    case SDL_WINDOWEVENT_MINIMIZED:
+      mTetris->setVisible(false);
+      break;
+    case SDL_WINDOWEVENT_SHOWN:
+    case SDL_WINDOWEVENT_RESTORED:
+    case SDL_WINDOWEVENT_EXPOSED:
+      mTetris->setVisible(true);
+      break;
+    default:
+      break;
+    }
+    return;
+  }
 
   if (event.type != SDL_KEYDOWN)
-    return INPUT_TYPE_EMPTY;
+    return;
 
   switch (event.key.keysym.sym) {
 #define CASE(key, type) \
-    case key: { return type; }
+    case key: { push(type); break; }
     CASE(SDLK_UP, INPUT_TYPE_UP);
     CASE(SDLK_DOWN, INPUT_TYPE_DOWN);
     CASE(SDLK_RIGHT, INPUT_TYPE_RIGHT);
     CASE(SDLK_LEFT, INPUT_TYPE_LEFT);
     CASE(SDLK_z, INPUT_TYPE_ROT_LEFT);
     CASE(SDLK_x, INPUT_TYPE_ROT_RIGHT);
+    CASE(SDLK_SPACE, INPUT_TYPE_DROP);
 #undef CASE
   default:
     break;
   }
+}
 
+/**
+ * Block until an event arrives or the gravity deadline passes, then
+ * drain everything pending into the batch. Events which do not fit
+ * stay in the SDL queue for the next frame.
+ */
+void TetrisInputerSDL::fill()
+{
+  SDL_Event event;
+  int timeout = mTimer->getTimeout();
+  /** Wake up for the boards played by the computer as well. */
+  if (mTetris->getBoardSize() > 1)
+    timeout = std::min(timeout, AUTOPLAY_INPUT_MSEC);
+  if (SDL_WaitEventTimeout(&event, timeout))
+    handle(event);
+  mTimer->post();
+  while (mBatchSize < INPUTER_BATCH_SIZE && SDL_PollEvent(&event))
+    handle(event);
+}
+
+TetrisInputEvent TetrisInputerSDL::input()
+{
+  if (!mFilled) {
+    fill();
+    mFilled = true;
+  }
+
+  if (mBatchPos < mBatchSize)
+    return mBatch[mBatchPos++];
+
+  /** The batch is consumed, the next call waits for a new one. */
+  mBatchSize = 0;
+  mBatchPos = 0;
+  mFilled = false;
   return INPUT_TYPE_EMPTY;
 }
 #endif
 
-TetrisSDL::TetrisSDL()
+TetrisTimerSDL::TetrisTimerSDL(Tetris *tetris)
+  : TetrisTimer(tetris), mDeadline(0), mInterval(TIMER_INTERVAL_MSEC),
+    mStop(true)
+{
+  mEventType = SDL_RegisterEvents(1);
+}
+
+bool TetrisTimerSDL::start()
 {
-  SDL_Init(SDL_INIT_EVERYTHING);
+  mStop = false;
+  mDeadline = SDL_GetTicks() + mInterval;
+  return true;
+}
+
+bool TetrisTimerSDL::stop()
+{
+  mStop = true;
+  return true;
+}
+
+int TetrisTimerSDL::getTimeout()
+{
+  Sint32 timeout = (Sint32) (mDeadline - SDL_GetTicks());
+  return timeout > 0 ? timeout : 0;
+}
+
+void TetrisTimerSDL::post()
+{
+  if (mStop || getTimeout() > 0)
+    return;
+
+  /** A late tick is logged, and the next one is not hurried. */
+  Uint32 late = SDL_GetTicks() - mDeadline;
+  if (late > TIMER_OVERRUN_MSEC) {
+    TETRIS_LOG(TETRIS_LOG_TIMER_OVERRUN, mTetris->getField()->getId(),
+               late * 1000);
+    mDeadline += late;
+  }
+
+  SDL_Event event;
+  SDL_memset(&event, 0, sizeof(event));
+  event.type = mEventType;
+  SDL_PushEvent(&event);
+  mDeadline += mInterval;
+}
+
+TetrisSDL::TetrisSDL(int row, int col, int boards)
+  : Tetris(row, col)
+{
+  /** Offscreen runs need no display, the dummy driver is enough. */
+  if (getenv("TETRIS_SDL_OFFSCREEN"))
+    setenv("SDL_VIDEODRIVER", "dummy", 1);
+  /** Audio, haptics and game controllers are never used. */
+  SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
+  getStartup()->mark("SDL_Init");
+  registerSession(TetrisVersus::create(getField()));
+  for (int board = 1; board < boards; ++board) {
+    TetrisField *field = TetrisField::create(row, col);
+    addBoard(field, TetrisInputerPlugin::create(this, field));
+  }
   registerDrawer(mDrawer = new TetrisDrawerSDL(this));
-  registerInputer(mInputer = new TetrisInputerSDL(this));
+#ifdef TETRIS_INPUTER_THREAD
+  /** Threaded input takes every event off the SDL queue. */
   registerTimer(mTimer = new TetrisTimerPthread(this));
+#else
+  registerTimer(mTimer = new TetrisTimerSDL(this));
+#endif
+  registerInputer(mInputer = new TetrisInputerSDL(this, mTimer));
 }
 
 TetrisSDL::~TetrisSDL()
 {
-  SDL_Quit();
+  /** They wait for threads and destroy textures, so SDL quits last. */
   delete mDrawer;
   delete mInputer;
   delete mTimer;
+  SDL_Quit();
 }
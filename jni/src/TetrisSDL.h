@@ -6,7 +6,33 @@
 #define __TETRISSDL_H
 
 #include <Tetris.h>
+#include <TetrisPlugin.h>
+#include <TetrisVersus.h>
+#include <TetrisCapture.h>
+#include <TetrisRing.h>
+
+/**
+ * TETRIS_EMBED_ASSETS links the bitmaps into the binary and draws text
+ * with the pre-rasterized TetrisFont.h instead of FreeType.
+ */
+#if defined(TETRIS_EMBED_ASSETS) && !defined(TETRIS_BITMAP_FONT)
+#define TETRIS_BITMAP_FONT
+#endif
+
+#ifndef TETRIS_BITMAP_FONT
 #include <SDL_ttf.h>
+#endif
+
+/**
+ * TETRIS_INPUTER_THREAD hands SDL events to the game loop through a
+ * ring. Android always uses it, and reads the events on a separate
+ * thread. X11, Wayland and Cocoa only pump events on the thread which
+ * initialized video, so elsewhere the game loop pumps and an event
+ * watch fills the ring.
+ */
+#if defined(ANDROID) && !defined(TETRIS_INPUTER_THREAD)
+#define TETRIS_INPUTER_THREAD
+#endif
 
 #ifdef ANDROID
 
@@ -34,6 +60,21 @@ enum {
 
 #endif
 
+#ifdef TETRIS_EMBED_ASSETS
+/** Generated from the assets directory with xxd -i. */
+extern unsigned char Frame_bmp[];
+extern unsigned int Frame_bmp_len;
+extern unsigned char Bar_bmp[];
+extern unsigned int Bar_bmp_len;
+#endif
+
+/** The window is laid out as a grid of blocks. */
+enum {
+  TETRIS_SDL_BLOCK_ROW = 26,
+  TETRIS_SDL_BLOCK_COL = 18,
+  TETRIS_SDL_GHOST_ALPHA = 96,
+};
+
 class Sprite {
  public:
   SDL_Texture *texture;
@@ -41,40 +82,172 @@ class Sprite {
   Uint16 height;
 };
 
+/**
+ * CPU side frame made of block sized tiles. Tiles are scaled once from
+ * the bitmaps, each frame only tiles which changed are copied into the
+ * pixel buffer, and the buffer is uploaded with one SDL_UpdateTexture.
+ * This replaces hundreds of scaled blits on software renderers.
+ */
+class TetrisCanvas {
+ public:
+  enum {
+    TILE_NONE = 0,
+    TILE_BAR = 1,
+    TILE_GHOST = TILE_BAR + 8,
+    TILE_FRAME = TILE_GHOST + 8,
+    TILE_GLYPH = TILE_FRAME + 9,
+    GLYPH_FIRST = ' ',
+    GLYPH_LAST = '~',
+    TILE_NR = TILE_GLYPH + GLYPH_LAST - GLYPH_FIRST + 1,
+  };
+
+ private:
+  int mWidth;
+  int mHeight;
+  int mBlockWidth;
+  int mBlockHeight;
+  int mRow;
+  int mCol;
+
+  std::vector<Uint32> mPixels;
+  std::vector<Uint32> mTiles;
+  std::vector<Uint16> mBack;
+  std::vector<Uint16> mFront;
+  SDL_Texture *mTexture;
+
+  Uint32 *getTile(int tile) {
+    return &mTiles[(size_t) tile * mBlockWidth * mBlockHeight];
+  }
+  void copyTile(int tile, int row, int col);
+
+ public:
+  TetrisCanvas() : mTexture(NULL) {}
+  ~TetrisCanvas();
+
+  bool create(SDL_Renderer *renderer, int width, int height,
+              int blockWidth, int blockHeight);
+
+  /** Scale srcrect of surface into a tile. */
+  void setTile(int tile, SDL_Surface *surface, const SDL_Rect *srcrect);
+  /** Blend tile src over tile under into tile dst. */
+  void blendTile(int dst, int src, int under, Uint8 alpha);
+
+  void erase();
+  void put(int row, int col, int tile) {
+    if (row >= 0 && row < mRow && col >= 0 && col < mCol)
+      mBack[row * mCol + col] = tile;
+  }
+  void update(SDL_Renderer *renderer);
+};
+
+/**
+ * Quads cut from one texture, collected over a frame. From SDL 2.0.18
+ * they are submitted with a single SDL_RenderGeometry call, so the
+ * number of draw calls does not grow with the number of boards.
+ */
+class TetrisBatch {
+ private:
+  SDL_Texture *mTexture;
+  float mWidth;
+  float mHeight;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  std::vector<SDL_Vertex> mVertex;
+  std::vector<int> mIndex;
+#else
+  struct Quad {
+    SDL_Rect srcrect;
+    SDL_Rect dstrect;
+    Uint8 alpha;
+  };
+  std::vector<Quad> mQuad;
+#endif
+
+ public:
+  TetrisBatch() : mTexture(NULL), mWidth(1), mHeight(1) {}
+
+  void setSprite(const Sprite &sprite);
+  void add(const SDL_Rect &srcrect, const SDL_Rect &dstrect,
+           Uint8 alpha = 255);
+  /** Draw the quads in the order they were added and forget them. */
+  void flush(SDL_Renderer *renderer);
+};
+
 class TetrisDrawerSDL : public TetrisDrawer {
  private:
   SDL_Window *mWindow;
   SDL_Renderer *mRenderer;
   Sprite mBarSprite;
   Sprite mFrameSprite;
+#ifdef TETRIS_BITMAP_FONT
+  Sprite mFontSprite;
+#else
   TTF_Font *mFont;
+  /** Glyphs rendered once at startup, drawChar only copies them. */
+  SDL_Texture *mGlyph[TetrisCanvas::GLYPH_LAST -
+                      TetrisCanvas::GLYPH_FIRST + 1];
+  SDL_Rect mGlyphRect[TetrisCanvas::GLYPH_LAST -
+                      TetrisCanvas::GLYPH_FIRST + 1];
+#endif
+
+  /** Composite frames on the CPU, see TetrisCanvas. */
+  bool mSoftware;
+  bool mGhost;
+  TetrisCanvas mCanvas;
+
+  /** Hardware renderers draw the sprites through batches instead. */
+  TetrisBatch mFrameBatch;
+  TetrisBatch mBarBatch;
+#ifdef TETRIS_BITMAP_FONT
+  TetrisBatch mFontBatch;
+#endif
+
+  /**
+   * TETRIS_SDL_OFFSCREEN draws into mTarget instead of the window and
+   * TETRIS_CAPTURE records every frame, see TetrisCapture.
+   */
+  SDL_Texture *mTarget;
+  TetrisCapture mCapture;
 
   int mWindowWidth;
   int mWindowHeight;
   int mBlockWidth;
   int mBlockHeight;
 
-  Sprite loadSprite(const char* file, SDL_Renderer* renderer);
+  SDL_Surface *loadBitmap(const char *file);
+  Sprite loadSprite(const char* file, SDL_Renderer* renderer,
+                    SDL_Surface **keep = NULL);
+  Sprite createSprite(SDL_Surface *surface, const char *name,
+                      SDL_Renderer *renderer);
+#ifdef TETRIS_BITMAP_FONT
+  SDL_Surface *createFont();
+#else
+  void createGlyph();
+#endif
+  void createCanvas(SDL_Surface *frame, SDL_Surface *bar,
+                    SDL_Surface *font);
   int type2index(BarType type);
-  void drawFrame(TetrisField *field, int srcRow, int srcCol,
+  void drawFrame(const TetrisSnapshot *snapshot, int srcRow, int srcCol,
                  int dstRow, int dstCol);
-  void drawFrameTop(TetrisField *field, int dstRow, int baseCol);
-  void drawFrameButtom(TetrisField *field, int dstRow, int baseCol);
-  void drawFrameInner(TetrisField *field, int dstRow, int baseCol);
+  void drawFrameTop(const TetrisSnapshot *snapshot, int dstRow, int baseCol);
+  void drawFrameButtom(const TetrisSnapshot *snapshot, int dstRow, int baseCol);
+  void drawFrameInner(const TetrisSnapshot *snapshot, int dstRow, int baseCol);
   void drawBar(int row, int col, BarType type);
   void drawBar(const TetrisBar *bar, int rot, int row, int col);
+  void drawFieldBar(const TetrisBar *bar, int rot, TetrisIndex barIndex,
+                    int baseCol);
   void drawChar(Uint16 ch, int row, int col);
   void drawValue(int value, int row, int col);
   void drawString(const wchar_t *str, int row, int col);
 
  protected:
-  void drawFrame(TetrisField * field, int baseCol);
-  void drawField(TetrisField *field, int baseCol);
-  void drawBar(TetrisField *field, int baseCol);
-  void drawScore(TetrisField *field, int baseCol);
-  void drawNextBar(TetrisField *field, int baseCol);
-  void erase() { SDL_RenderClear(mRenderer); }
-  void update() { SDL_RenderPresent(mRenderer); }
+  void drawFrame(const TetrisSnapshot *snapshot, int baseCol);
+  void drawField(const TetrisSnapshot *snapshot, int baseCol);
+  void drawBar(const TetrisSnapshot *snapshot, int baseCol);
+  void drawGhostBar(const TetrisSnapshot *snapshot, int baseCol);
+  void drawScore(const TetrisSnapshot *snapshot, int baseCol);
+  void drawNextBar(const TetrisSnapshot *snapshot, int baseCol);
+  void erase();
+  void update();
 
  public:
   TetrisDrawerSDL(Tetris *tetris);
@@ -82,42 +255,101 @@ class TetrisDrawerSDL : public TetrisDrawer {
   void gameover();
 };
 
-#ifdef ANDROID
+/**
+ * Gravity timer driven from the game loop. When the deadline passes
+ * a user event is posted, so the tick is handled in order with the
+ * other events by the inputer.
+ */
+class TetrisTimerSDL : public TetrisTimer {
+ private:
+  Uint32 mEventType;
+  Uint32 mDeadline;
+  int mInterval;
+  bool mStop;
+
+ public:
+  TetrisTimerSDL(Tetris *tetris);
+  ~TetrisTimerSDL() {}
+
+  bool start();
+  bool stop();
+  bool isInterrupted() { return false; }
+
+  /** Milliseconds until the next deadline. */
+  int getTimeout();
+  /** Post a timer event if the deadline has passed. */
+  void post();
+  bool isTimerEvent(const SDL_Event &event) {
+    return event.type == mEventType;
+  }
+};
+
+#ifdef TETRIS_INPUTER_THREAD
+#define INPUTER_RING_SIZE (256)
+
+typedef TetrisRing<TetrisInputEvent, INPUTER_RING_SIZE> InputerRing;
+
 struct InputerThreadData {
 public:
-  InputType *inputType;
-  bool stop;
+  InputerRing ring;
+  std::atomic<bool> stop;
   bool interrupt;
+  /** Finger motion not turned into an input yet. */
+  float dx;
+  float dy;
+  /** Inputs lost because the ring was full. */
+  std::atomic<unsigned long long> overflow;
 
-  InputerThreadData() : stop(false), interrupt(false) {}
+  InputerThreadData()
+    : stop(false), interrupt(false), dx(0), dy(0), overflow(0) {}
 };
 
 #define INPUTER_THREAD_TIMEOUT (100)
 #define INPUTER_THREAD_NAME "InputerThread"
 #endif
 
+#define INPUTER_BATCH_SIZE (64)
+
 class TetrisInputerSDL : public TetrisInputer {
-#ifdef ANDROID
  private:
+#ifdef TETRIS_INPUTER_THREAD
+#ifdef ANDROID
   SDL_Thread *mThread;
-  InputType mInputType;
+#else
+  /** Events were pumped for the inputs of this frame. */
+  bool mPumped;
+#endif
   InputerThreadData mThreadData;
+  /** Ring overflows already reported to TetrisLatency. */
+  unsigned long long mDropped;
+#else
+  TetrisTimerSDL *mTimer;
+  TetrisInputEvent mBatch[INPUTER_BATCH_SIZE];
+  int mBatchSize;
+  int mBatchPos;
+  bool mFilled;
+
+  void push(TetrisInputEvent event);
+  void handle(const SDL_Event &event);
+  void fill();
 #endif
 
  public:
-  TetrisInputerSDL(Tetris *tetris);
+  TetrisInputerSDL(Tetris *tetris, TetrisTimer *timer);
   ~TetrisInputerSDL();
-  InputType input();
+  TetrisInputEvent input();
 };
 
 class TetrisSDL : public Tetris {
  private:
   TetrisDrawerSDL *mDrawer;
   TetrisInputerSDL *mInputer;
-  TetrisTimerPthread *mTimer;
+  TetrisTimer *mTimer;
 
  public:
-  TetrisSDL();
+  /** Boards other than the player's are played by TetrisAutoplay. */
+  TetrisSDL(int row = TETRIS_FIELD_ROW, int col = TETRIS_FIELD_COL,
+            int boards = 1);
   ~TetrisSDL();
 };
 
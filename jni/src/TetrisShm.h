@@ -0,0 +1,86 @@
+/**
+ * @file TetrisShm.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ *
+ * C interface of bots running in their own process. The engine creates
+ * one file per board, TETRIS_BOT with the field id appended, and both
+ * sides map it shared:
+ *
+ *   TETRIS_BOT=/dev/shm/tetris ansi 20 10 2
+ *   shmbot /dev/shm/tetris-1
+ *
+ * Each time a bar spawns, the engine writes the field into the segment,
+ * increments seq and wakes seq with FUTEX_WAKE. The bot waits on seq
+ * with FUTEX_WAIT, pushes its inputs tagged with seq into the ring and
+ * then sets done to seq. Nothing is copied or serialized besides the
+ * cells; where there is no futex the bot has to poll seq.
+ */
+#ifndef __TETRISSHM_H
+#define __TETRISSHM_H
+
+#include <TetrisEnv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TETRIS_SHM_VERSION (1)
+#define TETRIS_SHM_MAGIC (0x54534d31)
+/** Inputs in the ring, a power of two. */
+#define TETRIS_SHM_RING (64)
+
+typedef struct TetrisShmInput {
+  /** seq of the field the input is for; other inputs are skipped. */
+  uint32_t seq;
+  /** TETRIS_ENV_ACTION_* */
+  int32_t action;
+} TetrisShmInput;
+
+/**
+ * Header of the segment, followed by row * col bytes of cells, row
+ * major from the top, 1 if locked. Pieces are numbered I J L O S T Z
+ * from 0 as in TetrisEnvObs, and times are CLOCK_MONOTONIC in
+ * nanoseconds.
+ */
+typedef struct TetrisShm {
+  uint32_t magic;
+  uint32_t version;
+  int32_t row;
+  int32_t col;
+
+  /** Written by the engine before seq is incremented. */
+  int32_t piece;
+  int32_t rot;
+  int32_t rotSize;
+  int32_t pieceRow;
+  int32_t pieceCol;
+  int32_t next;
+  int32_t nextRot;
+  int32_t lines;
+  int32_t pieces;
+  /** Set once the engine is gone. The bot should unmap and exit. */
+  int32_t closed;
+  uint64_t publishTime;
+
+  /** Futex word, incremented by the engine. */
+  uint32_t seq;
+  /** seq the bot has answered, set after its inputs are in the ring. */
+  uint32_t done;
+  /** Written by the bot: when it woke for done and when it answered. */
+  uint64_t wakeTime;
+  uint64_t doneTime;
+
+  /** The bot writes at head, the engine reads at tail. */
+  uint32_t head;
+  uint32_t tail;
+  TetrisShmInput ring[TETRIS_SHM_RING];
+} TetrisShm;
+
+#define TETRIS_SHM_CELL(shm) ((uint8_t *) ((TetrisShm *) (shm) + 1))
+#define TETRIS_SHM_SIZE(row, col) (sizeof(TetrisShm) + (size_t) (row) * (col))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TETRISSHM_H */
@@ -0,0 +1,127 @@
+/**
+ * @file TetrisStat.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisStat.h>
+#include <ctime>
+
+unsigned long long TetrisClock::nsec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int TetrisHistogram::bucket(unsigned long long value)
+{
+  int ret = 0;
+  while (value && ret < BUCKET_NR - 1) {
+    value >>= 1;
+    ret++;
+  }
+  return ret;
+}
+
+void TetrisHistogram::clear()
+{
+  for (int i = 0; i < BUCKET_NR; ++i)
+    mBucket[i] = 0;
+  mCount = 0;
+  mSum = 0;
+  mMin = ~0ULL;
+  mMax = 0;
+}
+
+void TetrisHistogram::add(unsigned long long value)
+{
+  mBucket[bucket(value)]++;
+  mCount++;
+  mSum += value;
+  if (value < mMin)
+    mMin = value;
+  if (value > mMax)
+    mMax = value;
+}
+
+unsigned long long TetrisHistogram::percentile(double p) const
+{
+  unsigned long long rank = (unsigned long long) (p / 100.0 * mCount);
+  unsigned long long seen = 0;
+  for (int i = 0; i < BUCKET_NR; ++i) {
+    seen += mBucket[i];
+    if (seen > rank)
+      return i ? (1ULL << i) - 1 : 0;
+  }
+  return mMax;
+}
+
+void TetrisHistogram::print(std::ostream &os, const char *name,
+                            const char *unit) const
+{
+  os << name << ": count " << mCount
+     << " min " << getMin() << unit
+     << " mean " << (unsigned long long) getMean() << unit
+     << " p50 <" << percentile(50) << unit
+     << " p99 <" << percentile(99) << unit
+     << " max " << mMax << unit << "\n";
+
+  for (int i = 0; i < BUCKET_NR; ++i) {
+    if (!mBucket[i])
+      continue;
+    os << "  <" << (i ? (1ULL << i) - 1 : 0) << unit << "\t"
+       << mBucket[i] << "\n";
+  }
+}
+
+void TetrisLatency::input(unsigned long long time, bool applied)
+{
+  mInputs++;
+  if (!applied) {
+    mRejected++;
+    return;
+  }
+  if (mPendingSize == PENDING_NR) {
+    mOverflowed++;
+    return;
+  }
+  mPending[mPendingSize++] = time;
+}
+
+void TetrisLatency::present(unsigned long long time)
+{
+  mFrames++;
+  if (mPendingSize > 1)
+    mCoalesced += mPendingSize - 1;
+  for (int i = 0; i < mPendingSize; ++i)
+    mHistogram.add((time - mPending[i]) / 1000);
+  mPendingSize = 0;
+}
+
+void TetrisLatency::print(std::ostream &os) const
+{
+  os << "inputs " << mInputs << " frames " << mFrames
+     << " rejected " << mRejected << " dropped " << mDropped
+     << " overflowed " << mOverflowed << " coalesced " << mCoalesced
+     << "\n";
+  mHistogram.print(os, "input latency", "us");
+}
+
+void TetrisStartup::mark(const char *name)
+{
+  if (mSize == MARK_NR)
+    return;
+  mName[mSize] = name;
+  mTime[mSize] = TetrisClock::nsec();
+  mSize++;
+}
+
+void TetrisStartup::print(std::ostream &os) const
+{
+  unsigned long long prev = mStart;
+  os << "startup:";
+  for (int i = 0; i < mSize; ++i) {
+    os << " " << mName[i] << " " << (mTime[i] - prev) / 1000 << "us";
+    prev = mTime[i];
+  }
+  os << " total " << (prev - mStart) / 1000 << "us\n";
+}
@@ -0,0 +1,118 @@
+/**
+ * @file TetrisStat.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISSTAT_H
+#define __TETRISSTAT_H
+
+#include <iostream>
+
+class TetrisClock {
+ public:
+  /** Monotonic time in nanoseconds. */
+  static unsigned long long nsec();
+  static unsigned long long usec() { return nsec() / 1000; }
+};
+
+/**
+ * Histogram with power of two buckets. Bucket i counts values in
+ * [2^(i-1), 2^i), bucket 0 counts zero.
+ */
+class TetrisHistogram {
+ public:
+  enum { BUCKET_NR = 48 };
+
+ private:
+  unsigned long long mBucket[BUCKET_NR];
+  unsigned long long mCount;
+  unsigned long long mSum;
+  unsigned long long mMin;
+  unsigned long long mMax;
+
+  static int bucket(unsigned long long value);
+
+ public:
+  TetrisHistogram() { clear(); }
+
+  void clear();
+  void add(unsigned long long value);
+
+  unsigned long long getCount() const { return mCount; }
+  unsigned long long getSum() const { return mSum; }
+  unsigned long long getMin() const { return mCount ? mMin : 0; }
+  unsigned long long getMax() const { return mMax; }
+  double getMean() const { return mCount ? (double) mSum / mCount : 0; }
+
+  /** Upper bound of the bucket holding the given percentile. */
+  unsigned long long percentile(double p) const;
+
+  void print(std::ostream &os, const char *name, const char *unit) const;
+};
+
+/**
+ * Input to photon latency. An input is timestamped when the inputer
+ * receives it and is complete when the frame showing it is handed to
+ * the backend.
+ */
+class TetrisLatency {
+ public:
+  enum { PENDING_NR = 64 };
+
+ private:
+  unsigned long long mPending[PENDING_NR];
+  int mPendingSize;
+
+  TetrisHistogram mHistogram;
+  unsigned long long mInputs;
+  unsigned long long mRejected;
+  unsigned long long mDropped;
+  /** Applied inputs beyond PENDING_NR in one frame, not measured. */
+  unsigned long long mOverflowed;
+  unsigned long long mCoalesced;
+  unsigned long long mFrames;
+
+ public:
+  TetrisLatency()
+    : mPendingSize(0), mInputs(0), mRejected(0), mDropped(0),
+      mOverflowed(0), mCoalesced(0), mFrames(0) {}
+
+  /** An input was applied to the field, or rejected by it. */
+  void input(unsigned long long time, bool applied);
+  /**
+   * An input was lost before it reached the field, like one which did
+   * not fit in the ring of the threaded SDL inputer.
+   */
+  void drop() { mInputs++; mDropped++; }
+  /** A frame was handed to the backend. */
+  void present(unsigned long long time);
+
+  const TetrisHistogram &getHistogram() const { return mHistogram; }
+  unsigned long long getRejected() const { return mRejected; }
+  unsigned long long getDropped() const { return mDropped; }
+  unsigned long long getOverflowed() const { return mOverflowed; }
+  unsigned long long getCoalesced() const { return mCoalesced; }
+
+  void print(std::ostream &os) const;
+};
+
+/** Time spent in each step of startup. */
+class TetrisStartup {
+ public:
+  enum { MARK_NR = 16 };
+
+ private:
+  unsigned long long mStart;
+  const char *mName[MARK_NR];
+  unsigned long long mTime[MARK_NR];
+  int mSize;
+
+ public:
+  TetrisStartup() : mStart(TetrisClock::nsec()), mSize(0) {}
+
+  /** The step called name ended now. */
+  void mark(const char *name);
+
+  void print(std::ostream &os) const;
+};
+
+#endif /* __TETRISSTAT_H */
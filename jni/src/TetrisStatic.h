@@ -0,0 +1,154 @@
+/**
+ * @file TetrisStatic.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISSTATIC_H
+#define __TETRISSTATIC_H
+
+#include <TetrisAutoplay.h>
+
+/**
+ * Game loop of one field whose drawer, inputer and timer are template
+ * parameters instead of the virtual interfaces of Tetris, so that their
+ * calls are inlined and empty ones disappear. Everything runs on the
+ * calling thread. The components need no base class, only:
+ *
+ *   Drawer:  void draw(TetrisField *field);
+ *            void gameover(TetrisField *field);
+ *   Inputer: InputType input(TetrisField *field);
+ *   Timer:   void start(); void stop();
+ *            bool tick();           true when gravity is due
+ *            bool isInterrupted();
+ *
+ * Tetris and its frontends are unchanged; this is for headless and
+ * embedded builds which know their components at compile time.
+ */
+template <class Drawer, class Inputer, class Timer>
+class TetrisStatic {
+ private:
+  TetrisField *mField;
+  Drawer mDrawer;
+  Inputer mInputer;
+  Timer mTimer;
+
+ public:
+  TetrisStatic(int row = TETRIS_FIELD_ROW, int col = TETRIS_FIELD_COL)
+    : mField(TetrisField::create(row, col)) {}
+  ~TetrisStatic() { delete mField; }
+
+  TetrisField *getField() { return mField; }
+  Drawer &getDrawer() { return mDrawer; }
+  Inputer &getInputer() { return mInputer; }
+  Timer &getTimer() { return mTimer; }
+
+  /** Play until the game is over, the inputer quits or the timer stops. */
+  void run() {
+    mTimer.start();
+    while (1) {
+      mDrawer.draw(mField);
+
+      InputType type;
+      while ((type = mInputer.input(mField)) != INPUT_TYPE_EMPTY) {
+        if (type == INPUT_TYPE_QUIT)
+          break;
+        mField->input(type);
+      }
+
+      if (type == INPUT_TYPE_QUIT)
+        break;
+      if (mTimer.tick())
+        mField->input(INPUT_TYPE_TIMER);
+      if (mTimer.isInterrupted() || mField->isGameOver())
+        break;
+    }
+    mTimer.stop();
+    mDrawer.gameover(mField);
+  }
+};
+
+class TetrisDrawerNull {
+ public:
+  void draw(TetrisField *) {}
+  void gameover(TetrisField *) {}
+};
+
+/** Never gives an input; the timer has to end the game. */
+class TetrisInputerNull {
+ public:
+  InputType input(TetrisField *) { return INPUT_TYPE_EMPTY; }
+};
+
+/** No gravity, never interrupted. */
+class TetrisTimerNull {
+ public:
+  void start() {}
+  void stop() {}
+  bool tick() { return false; }
+  bool isInterrupted() { return false; }
+};
+
+/**
+ * Gravity every given number of loop iterations instead of
+ * milliseconds, so a headless game only depends on its seed.
+ */
+class TetrisTimerFrames {
+ private:
+  unsigned mFrames;
+  unsigned mFrame;
+
+ public:
+  TetrisTimerFrames() : mFrames(1), mFrame(0) {}
+  void setFrames(unsigned frames) { mFrames = frames ? frames : 1; }
+
+  void start() { mFrame = 0; }
+  void stop() {}
+  bool tick() {
+    if (++mFrame < mFrames)
+      return false;
+    mFrame = 0;
+    return true;
+  }
+  bool isInterrupted() { return false; }
+};
+
+/**
+ * TetrisAutoplay without the pacing of TetrisInputerAutoplay: one input
+ * per loop iteration, so gravity interleaves with the moves as it does
+ * on screen. Quits after the given number of pieces, or when there is
+ * no placement.
+ */
+class TetrisInputerPlay {
+ private:
+  TetrisAutoplay mAutoplay;
+  TetrisMove mMove;
+  unsigned mPieces;
+  unsigned mLimit;
+  bool mSearched;
+  /** An input was given in this iteration. */
+  bool mGiven;
+
+ public:
+  TetrisInputerPlay()
+    : mPieces(0), mLimit(UINT_MAX), mSearched(false), mGiven(false) {}
+  void setLimit(unsigned pieces) { mLimit = pieces; }
+  TetrisAutoplay &getAutoplay() { return mAutoplay; }
+  /** Forget the move, before the field starts a new game. */
+  void reset() { mSearched = false; }
+
+  InputType input(TetrisField *field) {
+    mGiven = !mGiven;
+    if (!mGiven)
+      return INPUT_TYPE_EMPTY;
+    if (!mSearched || field->getPieces() != mPieces) {
+      mPieces = field->getPieces();
+      if (mPieces >= mLimit)
+        return INPUT_TYPE_QUIT;
+      mSearched = true;
+      if (!mAutoplay.search(field, mMove))
+        return INPUT_TYPE_QUIT;
+    }
+    return TetrisAutoplay::step(field, mMove);
+  }
+};
+
+#endif /* __TETRISSTATIC_H */
@@ -0,0 +1,113 @@
+/**
+ * @file TetrisSurface.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisSurface.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool checkHeader(const TetrisSurfaceHeader *header, size_t size)
+{
+  if (strncmp(header->magic, TETRIS_SURFACE_MAGIC, sizeof(header->magic)) ||
+      header->version != TETRIS_SURFACE_VERSION ||
+      header->bars != TETRIS_BAR_NR || header->col < 2 || !header->clamp)
+    return false;
+  return size - sizeof(*header) == header->profiles * header->bars;
+}
+
+bool TetrisSurface::open(const char *path)
+{
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) || (size_t) st.st_size < sizeof(TetrisSurfaceHeader)) {
+    ::close(fd);
+    return false;
+  }
+
+  mSize = st.st_size;
+  mMap = mmap(NULL, mSize, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mMap == MAP_FAILED) {
+    mMap = NULL;
+    return false;
+  }
+
+  const TetrisSurfaceHeader *header = (const TetrisSurfaceHeader *) mMap;
+  if (!checkHeader(header, mSize)) {
+    close();
+    return false;
+  }
+
+  /** Lookups jump around the table. */
+  madvise(mMap, mSize, MADV_RANDOM);
+  mCol = header->col;
+  mClamp = header->clamp;
+  mBase = 2 * mClamp + 1;
+  mTable = (const unsigned char *) mMap + sizeof(TetrisSurfaceHeader);
+  return true;
+}
+
+void TetrisSurface::close()
+{
+  if (mMap)
+    munmap(mMap, mSize);
+  mMap = NULL;
+  mSize = 0;
+  mCol = 0;
+  mTable = NULL;
+}
+
+int TetrisSurface::cost(const TetrisBar *bar, const int *height, int col)
+{
+  int best = COST_MAX;
+  int after[COL_MAX];
+  std::copy(height, height + col, after);
+
+  for (int rot = 0; rot < bar->getRotSize(); ++rot) {
+    /** Lowest and highest cell of each bar column, from its bottom. */
+    int low[TETRIS_BAR_COL];
+    int top[TETRIS_BAR_COL];
+    int left = TETRIS_BAR_COL, right = -1, buttom = 0;
+    for (int pos = 0; pos < bar->getIndexSize(); ++pos) {
+      TetrisIndex index = bar->getIndex(pos, rot);
+      left = std::min(left, index.c);
+      right = std::max(right, index.c);
+      buttom = std::max(buttom, index.r);
+    }
+    std::fill(low, low + TETRIS_BAR_COL, INT_MAX);
+    std::fill(top, top + TETRIS_BAR_COL, -1);
+    for (int pos = 0; pos < bar->getIndexSize(); ++pos) {
+      TetrisIndex index = bar->getIndex(pos, rot);
+      int j = index.c - left;
+      low[j] = std::min(low[j], buttom - index.r);
+      top[j] = std::max(top[j], buttom - index.r);
+    }
+    int width = right - left + 1;
+
+    for (int c = 0; c + width <= col; ++c) {
+      int base = INT_MIN;
+      for (int j = 0; j < width; ++j)
+        base = std::max(base, height[c + j] - low[j]);
+
+      int holes = 0;
+      for (int j = 0; j < width; ++j) {
+        holes += base + low[j] - height[c + j];
+        after[c + j] = base + top[j] + 1;
+      }
+      int bump = 0;
+      for (int k = 0; k + 1 < col; ++k)
+        bump += std::abs(after[k + 1] - after[k]);
+      best = std::min(best, HOLE_COST * holes + bump);
+
+      for (int j = 0; j < width; ++j)
+        after[c + j] = height[c + j];
+    }
+  }
+  return best;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file TetrisSurface.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISSURFACE_H
+#define __TETRISSURFACE_H
+
+#include <Tetris.h>
+
+#define TETRIS_SURFACE_MAGIC "TSURF"
+#define TETRIS_SURFACE_VERSION (1)
+
+/**
+ * A surface table is this header followed by one byte per surface
+ * profile and bar, at profile * bars + bar. The header is 64 bytes.
+ *
+ * A profile is the difference of the heights of neighbouring columns,
+ * clamped to [-clamp, clamp], read as a number in base 2 * clamp + 1
+ * with the leftmost pair as the lowest digit. The byte is the cost of
+ * the best drop of the bar onto that surface, see TetrisSurface::cost.
+ */
+struct TetrisSurfaceHeader {
+  char magic[8];
+  unsigned version;
+  unsigned col;
+  unsigned clamp;
+  unsigned bars;
+  unsigned long long profiles;
+  char reserved[32];
+};
+
+/**
+ * Read-only mapping of a surface table. The pages come from the page
+ * cache, so every process playing with the same table shares them and
+ * opening it costs a few system calls.
+ */
+class TetrisSurface {
+ private:
+  void *mMap;
+  size_t mSize;
+  int mCol;
+  int mClamp;
+  int mBase;
+  const unsigned char *mTable;
+
+ public:
+  /** Cells left empty under a dropped bar cost this much each. */
+  enum { HOLE_COST = 4, COST_MAX = 255, COL_MAX = 16 };
+
+  TetrisSurface() : mMap(NULL), mSize(0), mCol(0), mClamp(0), mBase(0),
+                    mTable(NULL) {}
+  ~TetrisSurface() { close(); }
+
+  bool open(const char *path);
+  void close();
+
+  int getCol() const { return mCol; }
+  int getClamp() const { return mClamp; }
+
+  /** Table position of bar type, the order of getBarFromType. */
+  static int bar(BarType type) {
+    switch (type) {
+#define CASE(type, n) case type: { return n; }
+      CASE(BAR_TYPE_I, 0);
+      CASE(BAR_TYPE_J, 1);
+      CASE(BAR_TYPE_L, 2);
+      CASE(BAR_TYPE_O, 3);
+      CASE(BAR_TYPE_S, 4);
+      CASE(BAR_TYPE_T, 5);
+      CASE(BAR_TYPE_Z, 6);
+#undef CASE
+    default:
+      break;
+    }
+    return 0;
+  }
+
+  /**
+   * Lowest cost of dropping bar in any rotation and column onto
+   * column heights height[0..col), counting HOLE_COST per covered
+   * empty cell plus the bumpiness of the resulting surface. Full lines
+   * are not removed, the table only rates how well the bar fits.
+   * col is at most COL_MAX.
+   */
+  static int cost(const TetrisBar *bar, const int *height, int col);
+
+  unsigned long long profile(const int *height) const {
+    unsigned long long index = 0;
+    for (int c = mCol - 2; c >= 0; --c) {
+      int diff = height[c + 1] - height[c];
+      diff = diff < -mClamp ? -mClamp : diff > mClamp ? mClamp : diff;
+      index = index * mBase + diff + mClamp;
+    }
+    return index;
+  }
+
+  int lookup(unsigned long long profile, int bar) const {
+    return mTable[profile * TETRIS_BAR_NR + bar];
+  }
+  int lookup(const int *height, BarType type) const {
+    return lookup(profile(height), bar(type));
+  }
+};
+
+#endif /* __TETRISSURFACE_H */
@@ -0,0 +1,85 @@
+/**
+ * @file TetrisTrace.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisTrace.h>
+#include <cstdio>
+
+thread_local TetrisTraceBuffer *TetrisTrace::mBuffer = NULL;
+
+/** Buffers live until the process exits, a thread may still hold one. */
+TetrisTraceBuffer *TetrisTrace::attach()
+{
+  std::lock_guard<std::mutex> lock(mLock);
+  mBuffer = new TetrisTraceBuffer(mBuffers.size() + 1);
+  mBuffers.push_back(mBuffer);
+  return mBuffer;
+}
+
+bool TetrisTrace::open(const char *path)
+{
+  std::lock_guard<std::mutex> lock(mLock);
+  if (mEnabled)
+    return false;
+  for (size_t i = 0; i < mBuffers.size(); ++i) {
+    mBuffers[i]->size.store(0, std::memory_order_relaxed);
+    mBuffers[i]->dropped = 0;
+  }
+  mPath = path;
+  mNsec = TetrisClock::nsec();
+  mTick = tick();
+  mEnabled = true;
+  return true;
+}
+
+void TetrisTrace::close()
+{
+  if (!mEnabled)
+    return;
+  mEnabled = false;
+
+  /** Ticks per nanosecond over the whole session. */
+  double scale = 1;
+  unsigned long long nsec = TetrisClock::nsec() - mNsec;
+  unsigned long long ticks = tick() - mTick;
+  if (nsec && ticks)
+    scale = (double) nsec / ticks;
+
+  std::lock_guard<std::mutex> lock(mLock);
+  FILE *file = fopen(mPath.c_str(), "w");
+  if (!file) {
+    std::cerr << "<error> fopen(" << mPath << ")\n";
+    return;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  const char *separator = "";
+  unsigned long long dropped = 0;
+  for (size_t i = 0; i < mBuffers.size(); ++i) {
+    TetrisTraceBuffer *buffer = mBuffers[i];
+    unsigned size = buffer->size.load(std::memory_order_acquire);
+    dropped += buffer->dropped;
+    if (!size)
+      continue;
+
+    fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+            "\"tid\":%u,\"args\":{\"name\":\"%s\"}}", separator,
+            buffer->thread, buffer->name ? buffer->name : "thread");
+    separator = ",\n";
+    for (unsigned k = 0; k < size; ++k) {
+      const TetrisTraceEvent &event = buffer->event[k];
+      /** Zones from before open() have no place on the timeline. */
+      if (event.start < mTick)
+        continue;
+      fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,"
+              "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event.name,
+              buffer->thread, (event.start - mTick) * scale / 1e3,
+              (event.end - event.start) * scale / 1e3);
+    }
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+
+  if (dropped)
+    std::cerr << mPath << ": " << dropped << " zones dropped\n";
+}
@@ -0,0 +1,142 @@
+/**
+ * @file TetrisTrace.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISTRACE_H
+#define __TETRISTRACE_H
+
+#include <TetrisStat.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/** Zones kept per thread, later ones are counted as dropped. */
+#define TRACE_BUFFER_SIZE (1 << 18)
+
+struct TetrisTraceEvent {
+  const char *name;
+  unsigned long long start;
+  unsigned long long end;
+};
+
+/** Zones of one thread, written by that thread only. */
+struct TetrisTraceBuffer {
+  TetrisTraceEvent event[TRACE_BUFFER_SIZE];
+  std::atomic<unsigned> size;
+  unsigned long long dropped;
+  unsigned thread;
+  const char *name;
+
+  TetrisTraceBuffer(unsigned thread)
+    : size(0), dropped(0), thread(thread), name(NULL) {}
+};
+
+/**
+ * Timeline of scoped zones. A zone stores its name and two ticks into
+ * the buffer of its thread, without locks or system calls. close()
+ * writes every zone as a complete event of the Chrome trace event
+ * format, one track per thread, which chrome://tracing and Perfetto
+ * open.
+ *
+ * Zones are compiled in with -DTETRIS_TRACE (make TRACE=1) and
+ * recorded while TETRIS_TRACE names the output file. Without
+ * TETRIS_TRACE defined the macros expand to nothing.
+ */
+class TetrisTrace {
+ private:
+  std::atomic<bool> mEnabled;
+  std::mutex mLock;
+  std::vector<TetrisTraceBuffer *> mBuffers;
+  std::string mPath;
+  unsigned long long mTick;
+  unsigned long long mNsec;
+
+  static thread_local TetrisTraceBuffer *mBuffer;
+
+  TetrisTrace() : mEnabled(false), mTick(0), mNsec(0) {}
+
+  TetrisTraceBuffer *attach();
+
+ public:
+  static TetrisTrace &instance() {
+    static TetrisTrace trace;
+    return trace;
+  }
+
+  /**
+   * Time stamp counter where there is one, which costs a few
+   * nanoseconds against about 20 for clock_gettime. It is converted to
+   * nanoseconds against TetrisClock when the trace is written.
+   */
+  static unsigned long long tick() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    unsigned long long value;
+    asm volatile("mrs %0, cntvct_el0" : "=r" (value));
+    return value;
+#else
+    return TetrisClock::nsec();
+#endif
+  }
+
+  bool open(const char *path);
+  /** Stop recording and write the trace. */
+  void close();
+  bool isEnabled() { return mEnabled.load(std::memory_order_relaxed); }
+
+  /** Name of the calling thread's track, a string literal. */
+  void setThreadName(const char *name) {
+    if (isEnabled())
+      (mBuffer ? mBuffer : attach())->name = name;
+  }
+
+  void add(const char *name, unsigned long long start,
+           unsigned long long end) {
+    TetrisTraceBuffer *buffer = mBuffer ? mBuffer : attach();
+    unsigned size = buffer->size.load(std::memory_order_relaxed);
+    if (size == TRACE_BUFFER_SIZE) {
+      buffer->dropped++;
+      return;
+    }
+    TetrisTraceEvent &event = buffer->event[size];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    buffer->size.store(size + 1, std::memory_order_release);
+  }
+};
+
+/** Zone from construction to the end of the enclosing scope. */
+class TetrisTraceZone {
+ private:
+  const char *mName;
+  unsigned long long mStart;
+
+ public:
+  TetrisTraceZone(const char *name)
+    : mName(name),
+      mStart(TetrisTrace::instance().isEnabled() ? TetrisTrace::tick() : 0) {}
+  ~TetrisTraceZone() {
+    if (mStart)
+      TetrisTrace::instance().add(mName, mStart, TetrisTrace::tick());
+  }
+};
+
+#ifdef TETRIS_TRACE
+#define TETRIS_TRACE_JOIN(a, b) a##b
+#define TETRIS_TRACE_NAME(line) TETRIS_TRACE_JOIN(traceZone, line)
+#define TETRIS_TRACE_ZONE(name) \
+  TetrisTraceZone TETRIS_TRACE_NAME(__LINE__)(name)
+#define TETRIS_TRACE_THREAD(name) \
+  TetrisTrace::instance().setThreadName(name)
+#else
+#define TETRIS_TRACE_ZONE(name)
+#define TETRIS_TRACE_THREAD(name)
+#endif
+
+#endif /* __TETRISTRACE_H */
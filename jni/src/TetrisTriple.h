@@ -0,0 +1,49 @@
+/**
+ * @file TetrisTriple.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISTRIPLE_H
+#define __TETRISTRIPLE_H
+
+#include <atomic>
+
+/**
+ * Triple buffer for one writer thread and one reader thread. The writer
+ * fills its back slot and publishes it, the reader takes the latest
+ * published slot. Neither side waits for the other and a slot is never
+ * written while the reader holds it.
+ */
+template <class T>
+class TetrisTriple {
+ private:
+  enum { CACHE_LINE = 64, INDEX = 3, FRESH = 4 };
+
+  T mData[3];
+  /** Slot index of the last published value, with FRESH until read. */
+  alignas(CACHE_LINE) std::atomic<unsigned> mMiddle;
+  alignas(CACHE_LINE) unsigned mBack;
+  alignas(CACHE_LINE) unsigned mFront;
+
+ public:
+  TetrisTriple() : mMiddle(1), mBack(0), mFront(2) {}
+
+  /** Every slot, for sizing before the threads start. */
+  T &slot(int index) { return mData[index]; }
+
+  /** Called by the writer only. */
+  T &back() { return mData[mBack]; }
+
+  /** Called by the writer only, after back() is complete. */
+  void publish() {
+    mBack = mMiddle.exchange(mBack | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  /** Called by the reader only. Valid until the next call. */
+  const T &read() {
+    if (mMiddle.load(std::memory_order_relaxed) & FRESH)
+      mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & INDEX;
+    return mData[mFront];
+  }
+};
+
+#endif /* __TETRISTRIPLE_H */
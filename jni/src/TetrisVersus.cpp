@@ -0,0 +1,381 @@
+/**
+ * @file TetrisVersus.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisVersus.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+TetrisVersus::TetrisVersus()
+  : mRemoteField(NULL), mLocal(0), mSocket(-1), mDelay(0), mSeed(0), mStarted(false),
+    mFrame(0), mRemote(0), mAck(0), mRollback(0), mQueueHead(0),
+    mQueueSize(0), mDelayedHead(0), mDelayedSize(0), mNext(0),
+    mLastReceive(0), mLinger(0), mPeerLost(false), mMismatch(false),
+    mStalls(0), mSent(0), mReceived(0), mDropped(0), mResimulated(0),
+    mOverBudget(0)
+{
+  mField[0] = mField[1] = NULL;
+  mPending[0] = mPending[1] = 0;
+  memset(&mPeer, 0, sizeof(mPeer));
+  memset(mInput, INPUT_TYPE_EMPTY, sizeof(mInput));
+}
+
+TetrisVersus::~TetrisVersus()
+{
+  if (mSocket >= 0)
+    close(mSocket);
+}
+
+bool TetrisVersus::open(const char *spec, TetrisField *local,
+                        TetrisField *remote)
+{
+  unsigned port = 0;
+  unsigned peer = 0;
+  if (sscanf(spec, "%u:%u:%u", &port, &peer, &mDelay) < 2 ||
+      !port || port > 65535 || !peer || peer > 65535 || port == peer) {
+    std::cerr << spec << ": not port:peer[:delay]\n";
+    return false;
+  }
+  mDelay = std::min(mDelay, (unsigned) VERSUS_DELAY_MAX_MSEC);
+
+  mSocket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (mSocket < 0) {
+    std::cerr << "<error> socket()\n";
+    return false;
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(mSocket, (struct sockaddr *) &addr, sizeof(addr))) {
+    std::cerr << "<error> bind(" << port << ")\n";
+    return false;
+  }
+  fcntl(mSocket, F_SETFL, fcntl(mSocket, F_GETFL) | O_NONBLOCK);
+  mPeer = addr;
+  mPeer.sin_port = htons(peer);
+
+  mLocal = port < peer ? 0 : 1;
+  mField[mLocal] = local;
+  mField[1 - mLocal] = remote;
+  if (!mLocal)
+    mSeed = ((unsigned long long) time(NULL) << 20) ^ getpid();
+  return true;
+}
+
+TetrisVersus *TetrisVersus::create(TetrisField *local)
+{
+  const char *spec = getenv("TETRIS_VERSUS");
+  if (!spec)
+    return NULL;
+  TetrisField *remote = TetrisField::create(local->getRow(),
+                                            local->getCol());
+  TetrisVersus *versus = new TetrisVersus();
+  if (!versus->open(spec, local, remote)) {
+    delete versus;
+    delete remote;
+    return NULL;
+  }
+  versus->mRemoteField = remote;
+  return versus;
+}
+
+void TetrisVersus::push(InputType type)
+{
+  /** Moving up would let a player stall forever. */
+  if (type == INPUT_TYPE_UP || type == INPUT_TYPE_TIMER)
+    return;
+  if (mQueueSize == VERSUS_QUEUE_SIZE) {
+    mDropped++;
+    return;
+  }
+  mQueue[(mQueueHead + mQueueSize++) % VERSUS_QUEUE_SIZE] = type;
+}
+
+int TetrisVersus::getHole(unsigned frame, int player)
+{
+  unsigned long long x = mSeed ^ (((unsigned long long) frame << 1 | player) *
+                                  0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return (x ^ (x >> 31)) % mField[player]->getCol();
+}
+
+void TetrisVersus::save(unsigned frame)
+{
+  State &state = mState[frame % VERSUS_STATE_NR];
+  for (int player = 0; player < 2; ++player) {
+    mField[player]->save(state.field[player]);
+    state.pending[player] = mPending[player];
+  }
+}
+
+void TetrisVersus::restore(unsigned frame)
+{
+  const State &state = mState[frame % VERSUS_STATE_NR];
+  for (int player = 0; player < 2; ++player) {
+    mField[player]->restore(state.field[player]);
+    mPending[player] = state.pending[player];
+  }
+}
+
+/** One frame of both fields, a function of the state and the inputs. */
+void TetrisVersus::simulate(unsigned frame)
+{
+  /** The first game over decides, both fields stop there. */
+  if (mField[0]->isGameOver() || mField[1]->isGameOver())
+    return;
+
+  bool locked[2];
+  for (int player = 0; player < 2; ++player) {
+    TetrisField *field = mField[player];
+    unsigned pieces = field->getPieces();
+    InputType type = getInput(player, frame);
+    if (type != INPUT_TYPE_EMPTY)
+      field->input(type);
+    if (frame % VERSUS_GRAVITY_FRAMES == VERSUS_GRAVITY_FRAMES - 1)
+      field->timer();
+    locked[player] = field->getPieces() != pieces;
+  }
+
+  for (int player = 0; player < 2; ++player)
+    mPending[1 - player] += mField[player]->takeGarbage();
+
+  /** Garbage rises between bars, never under a falling one. */
+  for (int player = 0; player < 2; ++player) {
+    if (!locked[player] || !mPending[player])
+      continue;
+    mField[player]->addGarbage(mPending[player], getHole(frame, player));
+    mPending[player] = 0;
+  }
+}
+
+void TetrisVersus::rollback()
+{
+  unsigned from = mRollback;
+  mMismatch = false;
+  TETRIS_TRACE_ZONE("rollback");
+  unsigned long long start = TetrisClock::nsec();
+
+  restore(from);
+  for (unsigned frame = from; frame < mFrame; ++frame) {
+    if (frame != from)
+      save(frame);
+    simulate(frame);
+  }
+
+  unsigned long long nsec = TetrisClock::nsec() - start;
+  mDepth.add(mFrame - from);
+  mResimulation.add(nsec);
+  mResimulated += mFrame - from;
+  if (nsec > VERSUS_FRAME_NSEC)
+    mOverBudget++;
+}
+
+void TetrisVersus::start()
+{
+  mStarted = true;
+  mField[0]->reset(mSeed);
+  mField[1]->reset(mSeed);
+  mNext = TetrisClock::nsec();
+}
+
+void TetrisVersus::sendNow(const TetrisVersusPacket &packet)
+{
+  if (sendto(mSocket, &packet, sizeof(packet), 0,
+             (struct sockaddr *) &mPeer, sizeof(mPeer)) ==
+      (ssize_t) sizeof(packet))
+    mSent++;
+}
+
+/** Every local input the peer has not acknowledged, oldest first. */
+void TetrisVersus::send()
+{
+  TetrisVersusPacket packet;
+  memset(&packet, 0, sizeof(packet));
+  packet.magic = VERSUS_MAGIC;
+  packet.seed = mLocal ? 0 : mSeed;
+  packet.row = mField[mLocal]->getRow();
+  packet.col = mField[mLocal]->getCol();
+  packet.rotation = mField[mLocal]->getRotation();
+  packet.frame = mAck;
+  packet.size = std::min(mFrame - mAck, (unsigned) VERSUS_PACKET_INPUT);
+  packet.ack = mRemote;
+  for (unsigned i = 0; i < packet.size; ++i)
+    packet.input[i] = mInput[mLocal][(mAck + i) % VERSUS_HISTORY];
+
+  if (!mDelay) {
+    sendNow(packet);
+    return;
+  }
+  if (mDelayedSize == VERSUS_DELAY_SIZE)
+    return;
+  Delayed &delayed =
+    mDelayed[(mDelayedHead + mDelayedSize++) % VERSUS_DELAY_SIZE];
+  delayed.time = TetrisClock::nsec() + mDelay * 1000000ULL;
+  delayed.packet = packet;
+}
+
+/** A packet whose inputs could not have been pushed is not played. */
+static bool isValid(const TetrisVersusPacket &packet)
+{
+  if (packet.magic != VERSUS_MAGIC || packet.size > VERSUS_PACKET_INPUT)
+    return false;
+  for (unsigned i = 0; i < packet.size; ++i) {
+    unsigned char type = packet.input[i];
+    if (type != INPUT_TYPE_EMPTY &&
+        (type < INPUT_TYPE_DOWN || type > INPUT_TYPE_DROP))
+      return false;
+  }
+  return true;
+}
+
+void TetrisVersus::receive()
+{
+  unsigned long long now = TetrisClock::nsec();
+  while (mDelayedSize && mDelayed[mDelayedHead].time <= now) {
+    sendNow(mDelayed[mDelayedHead].packet);
+    mDelayedHead = (mDelayedHead + 1) % VERSUS_DELAY_SIZE;
+    mDelayedSize--;
+  }
+
+  TetrisVersusPacket packet;
+  int remote = 1 - mLocal;
+  while (recv(mSocket, &packet, sizeof(packet), 0) ==
+         (ssize_t) sizeof(packet)) {
+    if (!isValid(packet))
+      continue;
+    if (packet.row != mField[remote]->getRow() ||
+        packet.col != mField[remote]->getCol() ||
+        packet.rotation != mField[remote]->getRotation()) {
+      std::cerr << "<error> versus: the peer plays another field\n";
+      mPeerLost = true;
+      return;
+    }
+    mReceived++;
+    mLastReceive = now;
+    if (!mStarted) {
+      if (mLocal)
+        mSeed = packet.seed;
+      start();
+    }
+
+    mAck = std::max(mAck, packet.ack);
+    for (unsigned i = 0; i < packet.size; ++i) {
+      unsigned frame = packet.frame + i;
+      if (frame != mRemote)
+        continue;
+      unsigned char type = packet.input[i];
+      mInput[remote][frame % VERSUS_HISTORY] = type;
+      /** Frames already simulated assumed an empty input. */
+      if (frame < mFrame && type != INPUT_TYPE_EMPTY &&
+          (!mMismatch || frame < mRollback)) {
+        mMismatch = true;
+        mRollback = frame;
+      }
+      mRemote++;
+    }
+  }
+}
+
+bool TetrisVersus::isDecided()
+{
+  unsigned confirmed = getConfirmed();
+  if (confirmed == mFrame)
+    return mField[0]->isGameOver() || mField[1]->isGameOver();
+  const State &state = mState[confirmed % VERSUS_STATE_NR];
+  return state.field[0].isGameOver() || state.field[1].isGameOver();
+}
+
+bool TetrisVersus::update()
+{
+  receive();
+  if (mPeerLost)
+    return false;
+
+  unsigned long long now = TetrisClock::nsec();
+  if (!mStarted) {
+    /** Say hello every frame until the peer answers. */
+    if (now >= mNext) {
+      send();
+      mNext = now + VERSUS_FRAME_NSEC;
+    }
+    return true;
+  }
+  if (now - mLastReceive > VERSUS_TIMEOUT_MSEC * 1000000ULL) {
+    mPeerLost = true;
+    return false;
+  }
+
+  if (mMismatch)
+    rollback();
+
+  /** After a pause, do not hurry through the missed frames. */
+  if (now > mNext + VERSUS_ROLLBACK_MAX * VERSUS_FRAME_NSEC)
+    mNext = now;
+  while (now >= mNext) {
+    mNext += VERSUS_FRAME_NSEC;
+    /** mRemote is ahead of mFrame when the first packet had inputs. */
+    if (mFrame >= mRemote + VERSUS_ROLLBACK_MAX) {
+      mStalls++;
+      send();
+      break;
+    }
+
+    InputType type = INPUT_TYPE_EMPTY;
+    if (mQueueSize) {
+      type = mQueue[mQueueHead];
+      mQueueHead = (mQueueHead + 1) % VERSUS_QUEUE_SIZE;
+      mQueueSize--;
+    }
+    mInput[mLocal][mFrame % VERSUS_HISTORY] = type;
+    save(mFrame);
+    simulate(mFrame);
+    mFrame++;
+    send();
+
+    if (isDecided() && ++mLinger > VERSUS_LINGER_FRAMES)
+      return false;
+  }
+  return true;
+}
+
+unsigned TetrisVersus::getTimeout()
+{
+  unsigned long long now = TetrisClock::nsec();
+  return now >= mNext ? 0 : (mNext - now) / 1000;
+}
+
+void TetrisVersus::print(std::ostream &os)
+{
+  bool local = mField[mLocal]->isGameOver();
+  bool remote = mField[1 - mLocal]->isGameOver();
+  os << "versus: ";
+  /** A peer leaving after the game over does not change the result. */
+  if (local && remote)
+    os << "draw";
+  else if (local || remote)
+    os << (local ? "lost" : "won");
+  else if (mPeerLost)
+    os << "peer lost";
+  else if (!mStarted)
+    os << "no peer";
+  else
+    os << "quit";
+  os << " at frame " << mFrame << " as player " << mLocal << ", "
+     << mDelay << "ms delay\n";
+  os << "versus: score " << mField[0]->getScore() << " to "
+     << mField[1]->getScore() << ", pieces " << mField[0]->getPieces()
+     << " to " << mField[1]->getPieces() << "\n";
+  os << "versus: " << mSent << " packets sent, " << mReceived
+     << " received, " << mStalls << " stalled frames, " << mDropped
+     << " inputs dropped\n";
+  os << "versus: " << mDepth.getCount() << " rollbacks, " << mResimulated
+     << " frames simulated again, " << mOverBudget
+     << " over one frame\n";
+  mDepth.print(os, "rollback depth", " frames");
+  mResimulation.print(os, "resimulation", "ns");
+}
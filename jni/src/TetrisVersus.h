@@ -0,0 +1,177 @@
+/**
+ * @file TetrisVersus.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISVERSUS_H
+#define __TETRISVERSUS_H
+
+#include <Tetris.h>
+#include <netinet/in.h>
+
+/** Frames simulated per second, the unit inputs are exchanged in. */
+#define VERSUS_FRAME_NSEC (1000000000ULL / 60)
+/** Gravity ticks every TIMER_INTERVAL_MSEC, counted in frames. */
+#define VERSUS_GRAVITY_FRAMES (TIMER_INTERVAL_MSEC * 60 / 1000)
+/** Frames the game may be simulated past the last remote input. */
+#define VERSUS_ROLLBACK_MAX (8)
+/** Saved states, covering every frame a rollback may return to. */
+#define VERSUS_STATE_NR (VERSUS_ROLLBACK_MAX + 1)
+/** Frames of inputs kept, enough for a round trip at the longest delay. */
+#define VERSUS_HISTORY (256)
+/** Inputs not acknowledged yet, resent in every packet. */
+#define VERSUS_PACKET_INPUT (32)
+/** Local inputs waiting for a frame. */
+#define VERSUS_QUEUE_SIZE (16)
+/** Artificial one-way delay and the packets held back for it. */
+#define VERSUS_DELAY_MAX_MSEC (1000)
+#define VERSUS_DELAY_SIZE (256)
+/** The session ends if the peer is silent this long. */
+#define VERSUS_TIMEOUT_MSEC (5000)
+/** Frames inputs are still sent once the game is decided. */
+#define VERSUS_LINGER_FRAMES (60)
+#define VERSUS_MAGIC (0x54565331)
+
+/**
+ * Datagram of one player. Both processes run on the same host, so the
+ * layout is not converted to network order.
+ */
+struct TetrisVersusPacket {
+  unsigned magic;
+  /** Bar sequence seed, chosen by player 0. */
+  unsigned long long seed;
+  unsigned short row;
+  unsigned short col;
+  unsigned char rotation;
+  unsigned char size;
+  /** Frame of input[0], the first frame the receiver has not acked. */
+  unsigned frame;
+  /** Frames of the receiver's inputs the sender has. */
+  unsigned ack;
+  unsigned char input[VERSUS_PACKET_INPUT];
+};
+
+/**
+ * Two player game over loopback UDP with rollback. Both processes
+ * simulate both fields in fixed frames from the inputs of both
+ * players, so they see the same game. Remote inputs which have not
+ * arrived are predicted to be empty and the game runs ahead on the
+ * prediction. When a real input differs, both fields are restored
+ * from the state saved before its frame and the frames since are
+ * simulated again within the current one.
+ *
+ * Lines deleted at once are sent to the opponent as garbage, which
+ * rises under the opponent's stack when the next bar locks.
+ */
+class TetrisVersus : public TetrisSession {
+ private:
+  struct State {
+    TetrisFieldState field[2];
+    unsigned pending[2];
+  };
+
+  struct Delayed {
+    unsigned long long time;
+    TetrisVersusPacket packet;
+  };
+
+  TetrisField *mField[2];
+  /** Created by create(), owned by Tetris once registered. */
+  TetrisField *mRemoteField;
+  /** Player number of this process, 0 for the lower port. */
+  int mLocal;
+  int mSocket;
+  struct sockaddr_in mPeer;
+  unsigned mDelay;
+  unsigned long long mSeed;
+  bool mStarted;
+
+  /** Next frame to simulate. */
+  unsigned mFrame;
+  /** Remote inputs are known below this frame. */
+  unsigned mRemote;
+  /** The peer has the local inputs below this frame. */
+  unsigned mAck;
+  /** Earliest frame simulated on a wrong prediction, if mMismatch. */
+  unsigned mRollback;
+  unsigned char mInput[2][VERSUS_HISTORY];
+  State mState[VERSUS_STATE_NR];
+  /** Garbage each player is about to receive. */
+  unsigned mPending[2];
+
+  InputType mQueue[VERSUS_QUEUE_SIZE];
+  int mQueueHead;
+  int mQueueSize;
+
+  Delayed mDelayed[VERSUS_DELAY_SIZE];
+  int mDelayedHead;
+  int mDelayedSize;
+
+  unsigned long long mNext;
+  unsigned long long mLastReceive;
+  int mLinger;
+  bool mPeerLost;
+  bool mMismatch;
+
+  unsigned long long mStalls;
+  unsigned long long mSent;
+  unsigned long long mReceived;
+  unsigned long long mDropped;
+  unsigned long long mResimulated;
+  unsigned long long mOverBudget;
+  TetrisHistogram mDepth;
+  TetrisHistogram mResimulation;
+
+  InputType getInput(int player, unsigned frame) {
+    if (player != mLocal && frame >= mRemote)
+      return INPUT_TYPE_EMPTY;
+    return (InputType) mInput[player][frame % VERSUS_HISTORY];
+  }
+
+  int getHole(unsigned frame, int player);
+  void save(unsigned frame);
+  void restore(unsigned frame);
+  void simulate(unsigned frame);
+  void rollback();
+  void start();
+  void send();
+  void sendNow(const TetrisVersusPacket &packet);
+  void receive();
+  /** Frame from which both inputs are known. */
+  unsigned getConfirmed() { return std::min(mRemote, mFrame); }
+  bool isDecided();
+
+ public:
+  TetrisVersus();
+  ~TetrisVersus();
+
+  /**
+   * Bind to 127.0.0.1 and play against the process on the peer port.
+   * spec is "port:peer[:delay]", delay in milliseconds added to every
+   * packet sent.
+   */
+  bool open(const char *spec, TetrisField *local, TetrisField *remote);
+
+  /**
+   * Session for the spec in TETRIS_VERSUS against local, with a new
+   * remote field of the same size. NULL if it is unset or fails.
+   */
+  static TetrisVersus *create(TetrisField *local);
+
+  TetrisField *getRemote() { return mRemoteField; }
+
+  /** Queue a local input for the next free frame. */
+  void push(InputType type);
+
+  /**
+   * Receive, roll back if needed and simulate the frames whose time
+   * has come. Return false once the session is over.
+   */
+  bool update();
+
+  /** Microseconds until the next frame is due. */
+  unsigned getTimeout();
+
+  void print(std::ostream &os);
+};
+
+#endif /* __TETRISVERSUS_H */
@@ -0,0 +1,136 @@
+/**
+ * @file TetrisWork.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisWork.h>
+#include <unistd.h>
+
+TetrisWorkPool::TetrisWorkPool(int size)
+  : mSize(size), mWork(NULL), mRound(0), mBusy(0), mStop(false),
+    mSteals(0)
+{
+  if (mSize <= 0)
+    mSize = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (mSize <= 0)
+    mSize = 1;
+
+  mQueue = new Queue[mSize];
+  mThread = new Thread[mSize];
+  for (int worker = 1; worker < mSize; ++worker) {
+    mThread[worker].pool = this;
+    mThread[worker].worker = worker;
+    if (pthread_create(&mThread[worker].thread, NULL, threadFunction,
+                       &mThread[worker])) {
+      /** Go on with the workers made so far. */
+      mSize = worker;
+      break;
+    }
+  }
+}
+
+TetrisWorkPool::~TetrisWorkPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    mStop = true;
+  }
+  mStart.notify_all();
+  for (int worker = 1; worker < mSize; ++worker)
+    pthread_join(mThread[worker].thread, NULL);
+  delete[] mThread;
+  delete[] mQueue;
+}
+
+bool TetrisWorkPool::take(int worker, unsigned &task)
+{
+  Queue &queue = mQueue[worker];
+  std::lock_guard<std::mutex> lock(queue.lock);
+  if (queue.begin == queue.end)
+    return false;
+  task = queue.begin++;
+  return true;
+}
+
+bool TetrisWorkPool::steal(int worker, unsigned &task)
+{
+  for (int i = 1; i < mSize; ++i) {
+    Queue &victim = mQueue[(worker + i) % mSize];
+    unsigned begin, end;
+    {
+      std::lock_guard<std::mutex> lock(victim.lock);
+      if (victim.begin == victim.end)
+        continue;
+      end = victim.end;
+      begin = end - (end - victim.begin + 1) / 2;
+      victim.end = begin;
+    }
+
+    /** Only one lock is held at a time, the own queue is empty. */
+    task = begin;
+    {
+      std::lock_guard<std::mutex> lock(mQueue[worker].lock);
+      mQueue[worker].begin = begin + 1;
+      mQueue[worker].end = end;
+    }
+    mSteals++;
+    return true;
+  }
+  return false;
+}
+
+void TetrisWorkPool::work(int worker)
+{
+  unsigned task;
+  while (take(worker, task) || steal(worker, task))
+    mWork->run(task, worker);
+}
+
+void *TetrisWorkPool::threadFunction(void *data)
+{
+  Thread *thread = (Thread *) data;
+  TetrisWorkPool *pool = thread->pool;
+  unsigned round = 0;
+
+  while (1) {
+    {
+      std::unique_lock<std::mutex> lock(pool->mLock);
+      while (!pool->mStop && pool->mRound == round)
+        pool->mStart.wait(lock);
+      if (pool->mStop)
+        break;
+      round = pool->mRound;
+    }
+
+    pool->work(thread->worker);
+
+    std::lock_guard<std::mutex> lock(pool->mLock);
+    if (--pool->mBusy == 0)
+      pool->mDone.notify_one();
+  }
+  return NULL;
+}
+
+void TetrisWorkPool::run(TetrisWork *work, unsigned count)
+{
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (int worker = 0; worker < mSize; ++worker) {
+      std::lock_guard<std::mutex> queueLock(mQueue[worker].lock);
+      mQueue[worker].begin = (unsigned)
+        ((unsigned long long) count * worker / mSize);
+      mQueue[worker].end = (unsigned)
+        ((unsigned long long) count * (worker + 1) / mSize);
+    }
+    mWork = work;
+    mBusy = mSize - 1;
+    mRound++;
+  }
+  mStart.notify_all();
+
+  this->work(0);
+
+  std::unique_lock<std::mutex> lock(mLock);
+  while (mBusy)
+    mDone.wait(lock);
+  mWork = NULL;
+}
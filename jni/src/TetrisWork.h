@@ -0,0 +1,83 @@
+/**
+ * @file TetrisWork.h
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#ifndef __TETRISWORK_H
+#define __TETRISWORK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <pthread.h>
+
+/** Tasks numbered from 0 handed to TetrisWorkPool::run. */
+class TetrisWork {
+ public:
+  virtual ~TetrisWork() {}
+
+  /**
+   * Run task on the worker numbered worker, below the pool size. One
+   * worker runs one task at a time, so per-worker state needs no lock.
+   */
+  virtual void run(unsigned task, int worker) = 0;
+};
+
+/**
+ * Work-stealing thread pool. run() splits the tasks into one
+ * contiguous range per worker. A worker takes tasks from the front of
+ * its own range and, once that is empty, steals the back half of the
+ * range of another worker, so uneven tasks like games of different
+ * length still keep every core busy. The calling thread is worker 0.
+ */
+class TetrisWorkPool {
+ private:
+  enum { CACHE_LINE = 64 };
+
+  /** Tasks [begin, end) not taken yet by a worker. */
+  struct Queue {
+    alignas(CACHE_LINE) std::mutex lock;
+    unsigned begin;
+    unsigned end;
+
+    Queue() : begin(0), end(0) {}
+  };
+
+  struct Thread {
+    TetrisWorkPool *pool;
+    int worker;
+    pthread_t thread;
+  };
+
+  int mSize;
+  Queue *mQueue;
+  Thread *mThread;
+
+  std::mutex mLock;
+  std::condition_variable mStart;
+  std::condition_variable mDone;
+  TetrisWork *mWork;
+  unsigned mRound;
+  int mBusy;
+  bool mStop;
+  std::atomic<unsigned long long> mSteals;
+
+  bool take(int worker, unsigned &task);
+  bool steal(int worker, unsigned &task);
+  void work(int worker);
+  static void *threadFunction(void *data);
+
+ public:
+  /** size workers, or one per online CPU if size is 0. */
+  explicit TetrisWorkPool(int size = 0);
+  ~TetrisWorkPool();
+
+  int getSize() const { return mSize; }
+
+  /** Ranges moved between workers since the pool was made. */
+  unsigned long long getSteals() const { return mSteals; }
+
+  /** Run every task [0, count) of work and return once all are done. */
+  void run(TetrisWork *work, unsigned count);
+};
+
+#endif /* __TETRISWORK_H */
@@ -0,0 +1,26 @@
+/**
+ * @file ansi.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisAnsi.h>
+
+int main(int argc, char *argv[])
+{
+  int row = TETRIS_FIELD_ROW;
+  int col = TETRIS_FIELD_COL;
+  int boards = 1;
+
+  /**
+   * Usage: ansi [row col [boards]]
+   * Boards after the first are played by the computer.
+   */
+  if (argc >= 3) {
+    row = atoi(argv[1]);
+    col = atoi(argv[2]);
+  }
+  if (argc >= 4)
+    boards = atoi(argv[3]);
+
+  TetrisAnsi(row, col, boards).run();
+  return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file headless.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisStatic.h>
+#include <unistd.h>
+
+/** The game loop with nothing behind it but the field and autoplay. */
+typedef TetrisStatic<TetrisDrawerNull, TetrisInputerPlay, TetrisTimerFrames>
+  TetrisHeadless;
+
+static void usage()
+{
+  std::cerr << "Usage: headless [-n games] [-s seed] [-p pieces] "
+            << "[-g frames] [-r srs] [row col]\n"
+            << "  -n  games to play (default 100)\n"
+            << "  -s  seed of the first game, game i uses seed + i\n"
+            << "  -p  end a game after this many pieces (default 1000)\n"
+            << "  -g  loop iterations per gravity tick (default 8)\n"
+            << "  -r  rotation system, classic (default) or srs\n";
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long long games = 100;
+  unsigned long long seed = 1;
+  unsigned pieces = 1000;
+  unsigned frames = 8;
+  TetrisRotation rotation = TETRIS_ROTATION_CLASSIC;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:p:g:r:h")) != -1) {
+    switch (opt) {
+    case 'n': games = strtoull(optarg, NULL, 0); break;
+    case 's': seed = strtoull(optarg, NULL, 0); break;
+    case 'p': pieces = strtoul(optarg, NULL, 0); break;
+    case 'g': frames = strtoul(optarg, NULL, 0); break;
+    case 'r':
+      rotation = strcmp(optarg, "srs") ? TETRIS_ROTATION_CLASSIC :
+        TETRIS_ROTATION_SRS;
+      break;
+    default: usage(); return 1;
+    }
+  }
+
+  int row = TETRIS_FIELD_ROW;
+  int col = TETRIS_FIELD_COL;
+  if (argc - optind >= 2) {
+    row = atoi(argv[optind]);
+    col = atoi(argv[optind + 1]);
+  }
+
+  TetrisHeadless tetris(row, col);
+  TetrisField *field = tetris.getField();
+  field->setRotation(rotation);
+  tetris.getInputer().setLimit(pieces);
+  tetris.getTimer().setFrames(frames);
+
+  unsigned long long placed = 0;
+  unsigned long long lines = 0;
+  unsigned long long start = TetrisClock::nsec();
+  for (unsigned long long game = 0; game < games; ++game) {
+    field->reset(seed + game);
+    tetris.getInputer().reset();
+    tetris.run();
+    placed += field->getPieces();
+    lines += field->getLines();
+  }
+
+  double sec = (TetrisClock::nsec() - start) / 1e9;
+  std::cerr << games << " games " << placed << " pieces " << lines
+            << " lines in " << sec << "s, " << placed / sec
+            << " pieces/s\n";
+  return 0;
+}
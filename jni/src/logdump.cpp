@@ -0,0 +1,94 @@
+/**
+ * @file logdump.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisLog.h>
+#include <cctype>
+#include <cstring>
+
+static const char *inputName(int type)
+{
+  static const char *name[] = {
+    "empty", "up", "down", "right", "left", "rot_right", "rot_left",
+    "drop", "quit", "timer",
+  };
+  if (type < 0 || type >= (int) (sizeof(name) / sizeof(*name)))
+    return "unknown";
+  return name[type];
+}
+
+static void print(const TetrisLogHeader &header, const TetrisLogRecord &r)
+{
+  printf("%12.6f t%u f%u ", (r.time - header.start) / 1e9, r.thread,
+         r.field);
+  switch (r.type) {
+  case TETRIS_LOG_SPAWN:
+  case TETRIS_LOG_LOCK:
+    printf("%s ", r.type == TETRIS_LOG_SPAWN ? "spawn" : "lock");
+    printf(r.arg[0] > 0 && r.arg[0] < 128 && isgraph(r.arg[0]) ?
+           "%c" : "%d", r.arg[0]);
+    printf(" col %d row %d rot %d\n", r.arg[1], r.arg[2], r.arg[3]);
+    break;
+  case TETRIS_LOG_LINES:
+    printf("lines %d total %d score %d\n", r.arg[0], r.arg[1], r.arg[2]);
+    break;
+  case TETRIS_LOG_GAMEOVER:
+    printf("gameover score %d lines %d pieces %d\n", r.arg[0], r.arg[1],
+           r.arg[2]);
+    break;
+  case TETRIS_LOG_INPUT_DROPPED:
+    printf("input_dropped %s\n", inputName(r.arg[0]));
+    break;
+  case TETRIS_LOG_TIMER_OVERRUN:
+    printf("timer_overrun %dus\n", r.arg[0]);
+    break;
+  case TETRIS_LOG_OVERFLOW:
+    printf("overflow %d records lost\n", r.arg[0]);
+    break;
+  default:
+    printf("type %d %d %d %d %d\n", r.type, r.arg[0], r.arg[1], r.arg[2],
+           r.arg[3]);
+    break;
+  }
+}
+
+static bool dump(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    std::cerr << path << ": cannot open\n";
+    return false;
+  }
+
+  TetrisLogHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      strncmp(header.magic, TETRIS_LOG_MAGIC, sizeof(header.magic)) ||
+      header.version != TETRIS_LOG_VERSION ||
+      header.recordSize != sizeof(TetrisLogRecord)) {
+    std::cerr << path << ": not a log of version " << TETRIS_LOG_VERSION
+              << "\n";
+    fclose(file);
+    return false;
+  }
+
+  TetrisLogRecord record;
+  while (fread(&record, sizeof(record), 1, file) == 1)
+    print(header, record);
+  fclose(file);
+  return true;
+}
+
+/** Usage: logdump file... with rotated files oldest first. */
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    std::cerr << "Usage: logdump log... (oldest first, e.g. log.1 log)\n";
+    return 1;
+  }
+
+  int ret = 0;
+  for (int i = 1; i < argc; ++i)
+    if (!dump(argv[i]))
+      ret = 1;
+  return ret;
+}
@@ -4,8 +4,23 @@
  */
 #include <TetrisNcurses.h>
 
-int main()
+int main(int argc, char *argv[])
 {
-  TetrisNcurses().run();
+  int row = TETRIS_FIELD_ROW;
+  int col = TETRIS_FIELD_COL;
+  int boards = 1;
+
+  /**
+   * Usage: ncurses [row col [boards]]
+   * Boards after the first are played by the computer.
+   */
+  if (argc >= 3) {
+    row = atoi(argv[1]);
+    col = atoi(argv[2]);
+  }
+  if (argc >= 4)
+    boards = atoi(argv[3]);
+
+  TetrisNcurses(row, col, boards).run();
   return 0;
 }
@@ -0,0 +1,566 @@
+/**
+ * @file perft.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <Tetris.h>
+#include <TetrisWork.h>
+#include <string>
+
+/** Deepest search, bounding the buffers kept per ply. */
+#define PERFT_DEPTH_MAX (32)
+
+/** Place where a bar comes to rest. */
+struct TetrisPerftMove {
+  TetrisIndex index;
+  int rot;
+};
+
+static unsigned long long splitmix(unsigned long long &state)
+{
+  unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * Zobrist keys. A board hashes to the xor of the keys of its filled
+ * cells. With the bar sequence fixed, the board, the ply and the depth
+ * left identify a subtree.
+ */
+class TetrisPerftKey {
+ private:
+  int mCol;
+  std::vector<unsigned long long> mCell;
+  unsigned long long mPly[PERFT_DEPTH_MAX + 1];
+  unsigned long long mDepth[PERFT_DEPTH_MAX + 1];
+
+ public:
+  TetrisPerftKey(int row, int col) : mCol(col), mCell((size_t) row * col) {
+    unsigned long long state = 1;
+    for (size_t i = 0; i < mCell.size(); ++i)
+      mCell[i] = splitmix(state);
+    for (int i = 0; i <= PERFT_DEPTH_MAX; ++i) {
+      mPly[i] = splitmix(state);
+      mDepth[i] = splitmix(state);
+    }
+  }
+
+  unsigned long long cell(int r, int c) const {
+    return mCell[(size_t) r * mCol + c];
+  }
+
+  unsigned long long node(unsigned long long hash, int ply,
+                          int depth) const {
+    return hash ^ mPly[ply] ^ mDepth[depth];
+  }
+};
+
+/**
+ * Transposition table of subtree counts shared by every worker without
+ * locks. An entry keeps the key xor the count next to the count, so
+ * that an entry torn by two workers storing at once fails the check
+ * instead of returning a wrong count.
+ */
+class TetrisPerftTable {
+ private:
+  struct Entry {
+    std::atomic<unsigned long long> check;
+    std::atomic<unsigned long long> count;
+
+    Entry() : check(0), count(0) {}
+  };
+
+  Entry *mEntry;
+  unsigned long long mMask;
+
+ public:
+  /** Largest power of two of entries fitting in mbyte megabytes. */
+  explicit TetrisPerftTable(unsigned mbyte) {
+    unsigned long long size = 1;
+    while (size * 2 * sizeof(Entry) <= (unsigned long long) mbyte << 20)
+      size *= 2;
+    mEntry = new Entry[size];
+    mMask = size - 1;
+  }
+
+  ~TetrisPerftTable() { delete[] mEntry; }
+
+  bool probe(unsigned long long key, unsigned long long &count) {
+    Entry &entry = mEntry[key & mMask];
+    unsigned long long value = entry.count.load(std::memory_order_relaxed);
+    if ((entry.check.load(std::memory_order_relaxed) ^ value) != key)
+      return false;
+    count = value;
+    return true;
+  }
+
+  void store(unsigned long long key, unsigned long long count) {
+    Entry &entry = mEntry[key & mMask];
+    entry.check.store(key ^ count, std::memory_order_relaxed);
+    entry.count.store(count, std::memory_order_relaxed);
+  }
+};
+
+/**
+ * Depth-first counter of one worker on its own field. At every ply the
+ * bar of the sequence spawns in rotation 0 and every place it can rest
+ * is searched breadth-first by moving left, right and down and turning
+ * either way with the rotation system of the field. Places leaving the
+ * same board are counted once.
+ */
+class TetrisPerft {
+ private:
+  TetrisField *mField;
+  int mRow;
+  int mCol;
+  const std::vector<const TetrisBar *> &mSequence;
+  const TetrisPerftKey &mKey;
+  TetrisPerftTable *mTable;
+
+  /** A state was visited by the current search if its stamp matches. */
+  std::vector<unsigned> mVisit;
+  unsigned mStamp;
+  std::vector<TetrisPerftMove> mQueue;
+
+  std::vector<TetrisPerftMove> mMove[PERFT_DEPTH_MAX];
+  std::vector<unsigned long long> mSeen[PERFT_DEPTH_MAX];
+  /** Board before a move deleting lines, saved once per node. */
+  std::vector<BarType> mSave[PERFT_DEPTH_MAX];
+  bool mSaved[PERFT_DEPTH_MAX];
+
+  unsigned long long mNodes;
+  unsigned long long mHits;
+
+  const TetrisBar *getPlyBar(int ply) {
+    return mSequence[ply % mSequence.size()];
+  }
+
+  void push(const TetrisPerftMove &move) {
+    size_t state = ((size_t) move.rot * (mRow + TETRIS_BAR_ROW) +
+                    move.index.r + TETRIS_BAR_ROW) *
+      (mCol + TETRIS_BAR_COL) + move.index.c + TETRIS_BAR_COL;
+    if (mVisit[state] == mStamp)
+      return;
+    mVisit[state] = mStamp;
+    mQueue.push_back(move);
+  }
+
+  void save(int ply) {
+    std::vector<BarType> &save = mSave[ply];
+    for (int r = 0; r < mRow; ++r)
+      for (int c = 0; c < mCol; ++c)
+        save[r * mCol + c] = mField->getGrid(r, c);
+    mSaved[ply] = true;
+  }
+
+  unsigned long long hash() {
+    unsigned long long ret = 0;
+    for (int r = 0; r < mRow; ++r)
+      for (int c = 0; c < mCol; ++c)
+        if (mField->getGrid(r, c) != BAR_TYPE_E)
+          ret ^= mKey.cell(r, c);
+    return ret;
+  }
+
+ public:
+  TetrisPerft(int row, int col, TetrisRotation rotation,
+              const std::vector<const TetrisBar *> &sequence,
+              const TetrisPerftKey &key, TetrisPerftTable *table)
+    : mField(TetrisField::create(row, col)), mRow(mField->getRow()),
+      mCol(mField->getCol()), mSequence(sequence), mKey(key),
+      mTable(table),
+      mVisit((size_t) TETRIS_ROT_NR * (mRow + TETRIS_BAR_ROW) *
+             (mCol + TETRIS_BAR_COL), 0),
+      mStamp(0), mNodes(0), mHits(0) {
+    mField->setRotation(rotation);
+    mField->clear();
+    for (int ply = 0; ply < PERFT_DEPTH_MAX; ++ply) {
+      mSave[ply].resize((size_t) mRow * mCol);
+      mSaved[ply] = false;
+    }
+  }
+
+  ~TetrisPerft() { delete mField; }
+
+  TetrisField *getField() { return mField; }
+  unsigned long long getNodes() const { return mNodes; }
+  unsigned long long getHits() const { return mHits; }
+
+  /** Fill the moves of ply from the board of the field. */
+  void generate(int ply) {
+    const TetrisBar *bar = getPlyBar(ply);
+    std::vector<TetrisPerftMove> &move = mMove[ply];
+    move.clear();
+    mQueue.clear();
+    if (++mStamp == 0) {
+      std::fill(mVisit.begin(), mVisit.end(), 0);
+      mStamp = 1;
+    }
+
+    TetrisPerftMove spawn;
+    spawn.rot = 0;
+    spawn.index = TetrisIndex(mCol / 2 - TETRIS_BAR_COL / 2,
+                              -bar->getShape(0).r);
+    if (!mField->checkLocatable(bar, spawn.index, spawn.rot))
+      return;
+    push(spawn);
+
+    for (size_t head = 0; head < mQueue.size(); ++head) {
+      TetrisPerftMove from = mQueue[head];
+      TetrisPerftMove to = from;
+      to.index.r++;
+      if (mField->checkLocatable(bar, to.index, to.rot))
+        push(to);
+      else
+        move.push_back(from);
+      for (int dc = -1; dc <= 1; dc += 2) {
+        to = from;
+        to.index.c += dc;
+        if (mField->checkLocatable(bar, to.index, to.rot))
+          push(to);
+      }
+      for (int dr = -1; bar->getRotSize() > 1 && dr <= 1; dr += 2) {
+        to = from;
+        if (mField->tryRotate(bar, to.index, to.rot, dr) >= 0)
+          push(to);
+      }
+    }
+  }
+
+  /**
+   * Put the bar of ply at move on the board whose hash is given and
+   * delete the lines it fills. Return the hash of the new board.
+   */
+  unsigned long long apply(int ply, const TetrisPerftMove &move,
+                           unsigned long long hash, bool &deleted) {
+    const TetrisBar *bar = getPlyBar(ply);
+    mField->setBar(bar->getType());
+    mField->setBarIndex(move.index);
+    mField->setBarRot(move.rot);
+    mField->putBar();
+    mNodes++;
+
+    deleted = false;
+    for (int pos = 0; pos < bar->getIndexSize(); ++pos) {
+      TetrisIndex cell = bar->getIndex(pos, move.rot);
+      int r = move.index.r + cell.r;
+      hash ^= mKey.cell(r, move.index.c + cell.c);
+      deleted = deleted || mField->checkLine(r);
+    }
+    if (!deleted)
+      return hash;
+
+    /** Lines are rare, the board is saved only for them. */
+    if (!mSaved[ply]) {
+      undo(ply, move, false);
+      save(ply);
+      mField->putBar();
+    }
+    mField->deleteLine();
+    return this->hash();
+  }
+
+  void undo(int ply, const TetrisPerftMove &move, bool deleted) {
+    if (deleted) {
+      mField->clear();
+      std::vector<BarType> &save = mSave[ply];
+      for (int r = 0; r < mRow; ++r)
+        for (int c = 0; c < mCol; ++c)
+          if (save[r * mCol + c] != BAR_TYPE_E)
+            mField->setGrid(r, c, save[r * mCol + c]);
+      return;
+    }
+    const TetrisBar *bar = getPlyBar(ply);
+    for (int pos = 0; pos < bar->getIndexSize(); ++pos) {
+      TetrisIndex cell = bar->getIndex(pos, move.rot);
+      mField->setGrid(move.index.r + cell.r, move.index.c + cell.c,
+                      BAR_TYPE_E);
+    }
+  }
+
+  /**
+   * Distinct boards of the moves of ply, applied one by one. The board
+   * is restored before returning.
+   */
+  void unique(int ply, unsigned long long hash,
+              std::vector<TetrisPerftMove> &move,
+              std::vector<unsigned long long> &child) {
+    mSaved[ply] = false;
+    generate(ply);
+    for (size_t i = 0; i < mMove[ply].size(); ++i) {
+      bool deleted;
+      unsigned long long next = apply(ply, mMove[ply][i], hash, deleted);
+      if (std::find(child.begin(), child.end(), next) == child.end()) {
+        move.push_back(mMove[ply][i]);
+        child.push_back(next);
+      }
+      undo(ply, mMove[ply][i], deleted);
+    }
+  }
+
+  /** Count the sequences of depth distinct boards from the field. */
+  unsigned long long perft(int ply, int depth, unsigned long long hash) {
+    if (depth == 0)
+      return 1;
+
+    unsigned long long key = mKey.node(hash, ply, depth);
+    unsigned long long count = 0;
+    if (mTable && depth > 1 && mTable->probe(key, count)) {
+      mHits++;
+      return count;
+    }
+
+    generate(ply);
+    std::vector<unsigned long long> &seen = mSeen[ply];
+    seen.clear();
+    mSaved[ply] = false;
+    for (size_t i = 0; i < mMove[ply].size(); ++i) {
+      const TetrisPerftMove &move = mMove[ply][i];
+      bool deleted;
+      unsigned long long next = apply(ply, move, hash, deleted);
+      if (std::find(seen.begin(), seen.end(), next) == seen.end()) {
+        seen.push_back(next);
+        count += perft(ply + 1, depth - 1, next);
+      }
+      undo(ply, move, deleted);
+    }
+
+    if (mTable && depth > 1)
+      mTable->store(key, count);
+    return count;
+  }
+
+  /** perft() below move of the first ply. */
+  unsigned long long divide(const TetrisPerftMove &move,
+                            unsigned long long hash, int depth) {
+    bool deleted;
+    mSaved[0] = false;
+    unsigned long long next = apply(0, move, hash, deleted);
+    unsigned long long count = perft(1, depth - 1, next);
+    undo(0, move, deleted);
+    return count;
+  }
+};
+
+/** One task per distinct board of the first ply. */
+class TetrisPerftWork : public TetrisWork {
+ private:
+  std::vector<TetrisPerft *> &mPerft;
+  const std::vector<TetrisPerftMove> &mMove;
+  unsigned long long mHash;
+  int mDepth;
+  std::vector<unsigned long long> &mCount;
+
+ public:
+  TetrisPerftWork(std::vector<TetrisPerft *> &perft,
+                  const std::vector<TetrisPerftMove> &move,
+                  unsigned long long hash, int depth,
+                  std::vector<unsigned long long> &count)
+    : mPerft(perft), mMove(move), mHash(hash), mDepth(depth),
+      mCount(count) {}
+
+  void run(unsigned task, int worker) {
+    mCount[task] = mPerft[worker]->divide(mMove[task], mHash, mDepth);
+  }
+};
+
+/**
+ * Rows of the board from the top, '.' or ' ' for an empty cell and a
+ * bar letter or any other character for a filled one. The last line
+ * is the bottom row.
+ */
+static bool loadBoard(const char *path, TetrisField *field)
+{
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    std::cerr << "<error> fopen(" << path << ")\n";
+    return false;
+  }
+
+  std::vector<std::string> lines;
+  char buffer[1024];
+  while (fgets(buffer, sizeof(buffer), file)) {
+    std::string line(buffer);
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+      line.pop_back();
+    lines.push_back(line);
+  }
+  fclose(file);
+
+  int row = field->getRow();
+  int col = field->getCol();
+  if ((int) lines.size() > row) {
+    std::cerr << path << ": more than " << row << " rows\n";
+    return false;
+  }
+  for (size_t i = 0; i < lines.size(); ++i) {
+    int r = row - lines.size() + i;
+    for (int c = 0; c < col && c < (int) lines[i].size(); ++c) {
+      char ch = lines[i][c];
+      if (ch == '.' || ch == ' ')
+        continue;
+      BarType type = (BarType) ch;
+      if (!TetrisField::getBarFromBarType(type))
+        type = BAR_TYPE_I;
+      field->setGrid(r, c, type);
+    }
+  }
+  return true;
+}
+
+static void usage()
+{
+  std::cerr << "Usage: perft [-d depth] [-q sequence] [-b board] "
+            << "[-s bars] [-t mbyte] [-j threads]\n"
+            << "             [-r srs] [-D] [-e count] [row col]\n"
+            << "  -d  count to this depth, printing every depth "
+            << "(default 3)\n"
+            << "  -q  bars of the plies, repeated (default IJLOSTZ)\n"
+            << "  -b  starting board file, empty by default\n"
+            << "  -s  piece set definition file the sequence is from\n"
+            << "  -t  transposition table in megabytes (default 0, "
+            << "none)\n"
+            << "  -j  worker threads (default one per CPU)\n"
+            << "  -r  rotation system, classic (default) or srs\n"
+            << "  -D  also print the count below every first move\n"
+            << "  -e  exit with 1 unless the deepest count is this\n";
+}
+
+int main(int argc, char *argv[])
+{
+  int depth = 3;
+  const char *sequence = "IJLOSTZ";
+  const char *boardPath = NULL;
+  const char *barsPath = NULL;
+  unsigned mbyte = 0;
+  int threads = 0;
+  TetrisRotation rotation = TETRIS_ROTATION_CLASSIC;
+  bool divide = false;
+  const char *expected = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:q:b:s:t:j:r:De:h")) != -1) {
+    switch (opt) {
+    case 'd': depth = atoi(optarg); break;
+    case 'q': sequence = optarg; break;
+    case 'b': boardPath = optarg; break;
+    case 's': barsPath = optarg; break;
+    case 't': mbyte = strtoul(optarg, NULL, 0); break;
+    case 'j': threads = atoi(optarg); break;
+    case 'r':
+      rotation = strcmp(optarg, "srs") ? TETRIS_ROTATION_CLASSIC :
+        TETRIS_ROTATION_SRS;
+      break;
+    case 'D': divide = true; break;
+    case 'e': expected = optarg; break;
+    default: usage(); return 1;
+    }
+  }
+  if (depth < 1 || depth > PERFT_DEPTH_MAX) {
+    usage();
+    return 1;
+  }
+
+  TetrisBarSet set;
+  if (barsPath && !set.load(barsPath))
+    return 1;
+
+  std::vector<const TetrisBar *> bars;
+  for (const char *ch = sequence; *ch; ++ch) {
+    const TetrisBar *bar = barsPath ? set.find((BarType) *ch) :
+      TetrisField::getBarFromBarType((BarType) *ch, rotation);
+    if (!bar) {
+      std::cerr << sequence << ": not a bar sequence\n";
+      return 1;
+    }
+    bars.push_back(bar);
+  }
+  if (bars.empty()) {
+    usage();
+    return 1;
+  }
+
+  int row = TETRIS_FIELD_ROW;
+  int col = TETRIS_FIELD_COL;
+  if (argc - optind >= 2) {
+    row = atoi(argv[optind]);
+    col = atoi(argv[optind + 1]);
+  }
+
+  /** As TetrisField::create() enlarges smaller fields. */
+  row = std::max(row, (int) TETRIS_BAR_ROW);
+  col = std::max(col, (int) TETRIS_BAR_COL);
+
+  TetrisWorkPool pool(threads);
+  TetrisPerftKey key(row, col);
+  TetrisPerftTable *table = mbyte ? new TetrisPerftTable(mbyte) : NULL;
+  std::vector<TetrisPerft *> perft(pool.getSize());
+  for (int worker = 0; worker < pool.getSize(); ++worker) {
+    perft[worker] = new TetrisPerft(row, col, rotation, bars, key, table);
+    if (barsPath)
+      perft[worker]->getField()->setBarSet(&set);
+    if (boardPath && !loadBoard(boardPath, perft[worker]->getField()))
+      return 1;
+  }
+
+  /** The first ply is split on the calling thread, before the pool. */
+  TetrisPerft *root = perft[0];
+  unsigned long long hash = 0;
+  for (int r = 0; r < row; ++r)
+    for (int c = 0; c < col; ++c)
+      if (root->getField()->getGrid(r, c) != BAR_TYPE_E)
+        hash ^= key.cell(r, c);
+  std::vector<TetrisPerftMove> move;
+  std::vector<unsigned long long> child;
+  root->unique(0, hash, move, child);
+
+  std::cerr << pool.getSize() << " workers, " << move.size()
+            << " first moves\n";
+
+  std::vector<unsigned long long> count(move.size());
+  unsigned long long total = 0;
+  for (int d = 1; d <= depth; ++d) {
+    unsigned long long nodes = 0;
+    unsigned long long hits = 0;
+    for (size_t i = 0; i < perft.size(); ++i) {
+      nodes -= perft[i]->getNodes();
+      hits -= perft[i]->getHits();
+    }
+    unsigned long long start = TetrisClock::nsec();
+
+    TetrisPerftWork work(perft, move, hash, d, count);
+    pool.run(&work, move.size());
+
+    double sec = (TetrisClock::nsec() - start) / 1e9;
+    total = 0;
+    for (size_t i = 0; i < count.size(); ++i)
+      total += count[i];
+    for (size_t i = 0; i < perft.size(); ++i) {
+      nodes += perft[i]->getNodes();
+      hits += perft[i]->getHits();
+    }
+    printf("perft %d: %llu boards, %llu nodes in %.3fs, %.0f nodes/s",
+           d, total, nodes, sec, sec > 0 ? nodes / sec : 0);
+    if (table)
+      printf(", %llu hits", hits);
+    printf("\n");
+    fflush(stdout);
+  }
+
+  if (divide)
+    for (size_t i = 0; i < move.size(); ++i)
+      printf("rot %d col %d row %d: %llu\n", move[i].rot, move[i].index.c,
+             move[i].index.r, count[i]);
+
+  for (size_t i = 0; i < perft.size(); ++i)
+    delete perft[i];
+  delete table;
+
+  if (expected && total != strtoull(expected, NULL, 0)) {
+    std::cerr << "<error> perft " << depth << ": " << total
+              << " boards, expected " << expected << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file policy_greedy.c
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ *
+ * Example policy: drop the bar where the field is left with the fewest
+ * holes, then the lowest and smoothest surface.
+ */
+#include <TetrisPolicy.h>
+#include <stdlib.h>
+
+typedef struct Greedy {
+  int32_t row;
+  int32_t col;
+  uint8_t *cell;
+} Greedy;
+
+static void *create(int32_t row, int32_t col)
+{
+  Greedy *greedy = malloc(sizeof(*greedy));
+  if (!greedy)
+    return NULL;
+  greedy->row = row;
+  greedy->col = col;
+  greedy->cell = malloc((size_t) row * col);
+  if (!greedy->cell) {
+    free(greedy);
+    return NULL;
+  }
+  return greedy;
+}
+
+static void destroy(void *policy)
+{
+  Greedy *greedy = policy;
+  free(greedy->cell);
+  free(greedy);
+}
+
+static int32_t cost(const Greedy *greedy, int32_t lines)
+{
+  int32_t holes = 0, height = 0, bump = 0, prev = -1;
+  int32_t r, c;
+
+  for (c = 0; c < greedy->col; ++c) {
+    int32_t top = greedy->row;
+    for (r = 0; r < greedy->row; ++r) {
+      if (!greedy->cell[r * greedy->col + c])
+        continue;
+      if (top == greedy->row)
+        top = r;
+    }
+    for (r = top; r < greedy->row; ++r)
+      holes += !greedy->cell[r * greedy->col + c];
+    height += greedy->row - top;
+    if (prev >= 0)
+      bump += abs(prev - (greedy->row - top));
+    prev = greedy->row - top;
+  }
+  return 8 * holes + 2 * height + bump - 3 * lines;
+}
+
+static int32_t decide(void *policy, const TetrisPolicyField *field,
+                      TetrisPolicyDecision *decision)
+{
+  Greedy *greedy = policy;
+  int32_t best = INT32_MAX;
+  int32_t rot, col;
+
+  for (rot = 0; rot < field->rotSize; ++rot) {
+    for (col = -3; col < field->col; ++col) {
+      int32_t lines = field->place(field, rot, col, greedy->cell);
+      int32_t value;
+      if (lines < 0)
+        continue;
+      value = cost(greedy, lines);
+      if (value < best) {
+        best = value;
+        decision->kind = TETRIS_POLICY_PLACE;
+        decision->rot = rot;
+        decision->col = col;
+      }
+    }
+  }
+  return best == INT32_MAX;
+}
+
+const TetrisPolicy *tetris_policy(void)
+{
+  static const TetrisPolicy policy = {
+    TETRIS_POLICY_VERSION, "greedy", create, destroy, decide,
+  };
+  return &policy;
+}
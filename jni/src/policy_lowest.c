@@ -0,0 +1,93 @@
+/**
+ * @file policy_lowest.c
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ *
+ * Example policy answering with inputs: turn and shift the bar to
+ * where the highest column stays lowest, clearing the most lines.
+ */
+#include <TetrisPolicy.h>
+#include <stdlib.h>
+
+typedef struct Lowest {
+  int32_t row;
+  int32_t col;
+  uint8_t *cell;
+} Lowest;
+
+static void *create(int32_t row, int32_t col)
+{
+  Lowest *lowest = malloc(sizeof(*lowest));
+  if (!lowest)
+    return NULL;
+  lowest->row = row;
+  lowest->col = col;
+  lowest->cell = malloc((size_t) row * col);
+  if (!lowest->cell) {
+    free(lowest);
+    return NULL;
+  }
+  return lowest;
+}
+
+static void destroy(void *policy)
+{
+  Lowest *lowest = policy;
+  free(lowest->cell);
+  free(lowest);
+}
+
+static int32_t height(const Lowest *lowest)
+{
+  int32_t r;
+  for (r = 0; r < lowest->row * lowest->col; ++r)
+    if (lowest->cell[r])
+      return lowest->row - r / lowest->col;
+  return 0;
+}
+
+static int32_t decide(void *policy, const TetrisPolicyField *field,
+                      TetrisPolicyDecision *decision)
+{
+  Lowest *lowest = policy;
+  int32_t best = INT32_MAX, bestRot = 0, bestCol = 0;
+  int32_t rot, col, turn, shift, i;
+
+  for (rot = 0; rot < field->rotSize; ++rot) {
+    for (col = -3; col < field->col; ++col) {
+      int32_t lines = field->place(field, rot, col, lowest->cell);
+      int32_t value;
+      if (lines < 0)
+        continue;
+      value = height(lowest) * 8 - lines;
+      if (value < best) {
+        best = value;
+        bestRot = rot;
+        bestCol = col;
+      }
+    }
+  }
+  if (best == INT32_MAX)
+    return 1;
+
+  decision->kind = TETRIS_POLICY_INPUTS;
+  decision->inputSize = 0;
+  /** Step down first, so the bar has room to turn below the ceiling. */
+  decision->input[decision->inputSize++] = TETRIS_ENV_ACTION_DOWN;
+  turn = (bestRot - field->rot + field->rotSize) % field->rotSize;
+  for (i = 0; i < turn; ++i)
+    decision->input[decision->inputSize++] = TETRIS_ENV_ACTION_ROT_RIGHT;
+  shift = bestCol - field->pieceCol;
+  for (i = 0; i < abs(shift) && decision->inputSize < TETRIS_POLICY_INPUT_MAX;
+       ++i)
+    decision->input[decision->inputSize++] = shift < 0 ?
+      TETRIS_ENV_ACTION_LEFT : TETRIS_ENV_ACTION_RIGHT;
+  return 0;
+}
+
+const TetrisPolicy *tetris_policy(void)
+{
+  static const TetrisPolicy policy = {
+    TETRIS_POLICY_VERSION, "lowest", create, destroy, decide,
+  };
+  return &policy;
+}
@@ -0,0 +1,244 @@
+/**
+ * @file query.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisColumn.h>
+#include <TetrisStat.h>
+#include <cstdlib>
+#include <cmath>
+#include <unistd.h>
+
+enum {
+  QUERY_COUNT_RANGE = 1 << 24,
+  QUERY_GROUP_RANGE = 1 << 16,
+};
+
+struct QuerySummary {
+  unsigned long long count;
+  unsigned long long min;
+  unsigned long long max;
+  double mean;
+  double var;
+};
+
+/** Block sums of 8 byte values need more than 64 bits. */
+template <class T> struct QuerySum { typedef unsigned long long Type; };
+template <> struct QuerySum<unsigned long long> {
+  typedef unsigned __int128 Type;
+};
+
+/**
+ * Plain loops over the mapped values, which the compiler turns into
+ * vector code. Each block is summed exactly in integers and its spread
+ * is taken around its own mean, while it is still in the cache. The
+ * blocks are merged pairwise, with the means kept as offsets from the
+ * minimum of the first block so that large values with a small spread
+ * keep their precision.
+ */
+template <class T>
+static void summarize(const T *data, size_t count, QuerySummary &summary)
+{
+  enum { BLOCK = 1 << 16 };
+  typedef typename QuerySum<T>::Type Sum;
+  T min = (T) ~(T) 0;
+  T max = 0;
+  T ref = count ? data[0] : 0;
+  double n = 0;
+  double mean = 0;
+  double m2 = 0;
+
+  for (size_t start = 0; start < count; start += BLOCK) {
+    size_t end = start + BLOCK < count ? start + BLOCK : count;
+    T blockMin = (T) ~(T) 0;
+    T blockMax = 0;
+    Sum blockSum = 0;
+    for (size_t i = start; i < end; ++i) {
+      T value = data[i];
+      blockMin = value < blockMin ? value : blockMin;
+      blockMax = value > blockMax ? value : blockMax;
+      blockSum += value;
+    }
+    if (start == 0)
+      ref = blockMin;
+
+    double blockN = end - start;
+    double blockMean = (double) (blockSum - (Sum) blockMin * (end - start)) /
+      blockN;
+    double blockM2 = 0;
+    for (size_t i = start; i < end; ++i) {
+      double d = (double) (T) (data[i] - blockMin) - blockMean;
+      blockM2 += d * d;
+    }
+    blockMean += blockMin >= ref ? (double) (T) (blockMin - ref) :
+      -(double) (T) (ref - blockMin);
+
+    double delta = blockMean - mean;
+    double total = n + blockN;
+    mean += delta * blockN / total;
+    m2 += blockM2 + delta * delta * n * blockN / total;
+    n = total;
+    min = blockMin < min ? blockMin : min;
+    max = blockMax > max ? blockMax : max;
+  }
+
+  summary.count = count;
+  summary.min = count ? min : 0;
+  summary.max = max;
+  summary.mean = count ? ref + mean : 0;
+  summary.var = count ? m2 / count : 0;
+}
+
+/** Exact percentiles and a histogram of equal width buckets. */
+template <class T>
+static void distribute(const T *data, size_t count,
+                       const QuerySummary &summary, int buckets)
+{
+  size_t range = summary.max - summary.min + 1;
+  std::vector<unsigned long long> counts(range, 0);
+  for (size_t i = 0; i < count; ++i)
+    counts[data[i] - summary.min]++;
+
+  static const double percent[] = { 50, 90, 99, 99.9 };
+  unsigned long long seen = 0;
+  size_t value = 0;
+  for (size_t p = 0; p < sizeof(percent) / sizeof(*percent); ++p) {
+    unsigned long long rank = (unsigned long long) (percent[p] / 100 * count);
+    while (value < range && seen + counts[value] <= rank)
+      seen += counts[value++];
+    std::cout << " p" << percent[p] << " " << summary.min + value;
+  }
+  std::cout << "\n";
+
+  size_t width = (range + buckets - 1) / buckets;
+  for (size_t lo = 0; lo < range; lo += width) {
+    unsigned long long n = 0;
+    for (size_t v = lo; v < lo + width && v < range; ++v)
+      n += counts[v];
+    std::cout << "  [" << summary.min + lo << ", "
+              << summary.min + lo + width << ")\t" << n << "\n";
+  }
+}
+
+template <class T>
+static void query(const char *name, const T *data, size_t count, int buckets)
+{
+  QuerySummary summary;
+  summarize(data, count, summary);
+
+  std::cout << name << ": count " << count << " min " << summary.min
+            << " mean " << summary.mean << " stddev " << sqrt(summary.var)
+            << " max " << summary.max;
+  if (!count) {
+    std::cout << "\n";
+    return;
+  }
+
+  if (summary.max - summary.min < QUERY_COUNT_RANGE) {
+    distribute(data, count, summary, buckets);
+    return;
+  }
+
+  /** Too wide for counting, fall back to power of two buckets. */
+  TetrisHistogram histogram;
+  for (size_t i = 0; i < count; ++i)
+    histogram.add(data[i]);
+  std::cout << "\n";
+  histogram.print(std::cout, name, "");
+}
+
+/** Count and mean of data for each value of group. */
+template <class T, class G>
+static void group(const char *name, const T *data, const G *key,
+                  size_t count)
+{
+  std::vector<unsigned long long> n(QUERY_GROUP_RANGE, 0);
+  std::vector<double> sum(QUERY_GROUP_RANGE, 0);
+  for (size_t i = 0; i < count; ++i) {
+    if (key[i] >= QUERY_GROUP_RANGE)
+      continue;
+    n[key[i]]++;
+    sum[key[i]] += data[i];
+  }
+
+  std::cout << name << ":\n";
+  for (int k = 0; k < QUERY_GROUP_RANGE; ++k)
+    if (n[k])
+      std::cout << "  " << k << "\tcount " << n[k]
+                << "\tmean " << sum[k] / n[k] << "\n";
+}
+
+#define DISPATCH(width, func, ...)                                  \
+  do {                                                              \
+    switch (width) {                                                \
+    case 1: { typedef unsigned char T; func; break; }               \
+    case 2: { typedef unsigned short T; func; break; }              \
+    case 4: { typedef unsigned int T; func; break; }                \
+    default: { typedef unsigned long long T; func; break; }         \
+    }                                                               \
+  } while (0)
+
+static void usage()
+{
+  std::cerr << "Usage: query [-b buckets] [-g group.col] column.col...\n"
+            << "  -b  histogram buckets (default 16)\n"
+            << "  -g  mean of each column per value of the group column\n";
+}
+
+int main(int argc, char *argv[])
+{
+  int buckets = 16;
+  const char *groupPath = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:g:h")) != -1) {
+    switch (opt) {
+    case 'b': buckets = atoi(optarg); break;
+    case 'g': groupPath = optarg; break;
+    default: usage(); return 1;
+    }
+  }
+  if (optind >= argc || buckets <= 0) {
+    usage();
+    return 1;
+  }
+
+  TetrisColumnReader groupColumn;
+  if (groupPath && !groupColumn.open(groupPath)) {
+    std::cerr << groupPath << ": cannot open\n";
+    return 1;
+  }
+
+  for (int i = optind; i < argc; ++i) {
+    TetrisColumnReader column;
+    if (!column.open(argv[i])) {
+      std::cerr << argv[i] << ": cannot open\n";
+      return 1;
+    }
+
+    size_t count = column.getCount();
+    if (!groupPath) {
+      DISPATCH(column.getWidth(),
+               query(argv[i], (const T *) column.data(), count, buckets));
+      continue;
+    }
+
+    if (groupColumn.getCount() < count)
+      count = groupColumn.getCount();
+    const void *key = groupColumn.data();
+    DISPATCH(column.getWidth(), {
+        const T *data = (const T *) column.data();
+        switch (groupColumn.getWidth()) {
+        case 1: group(argv[i], data, (const unsigned char *) key, count);
+          break;
+        case 2: group(argv[i], data, (const unsigned short *) key, count);
+          break;
+        case 4: group(argv[i], data, (const unsigned int *) key, count);
+          break;
+        default:
+          group(argv[i], data, (const unsigned long long *) key, count);
+          break;
+        }
+      });
+  }
+  return 0;
+}
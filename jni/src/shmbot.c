@@ -0,0 +1,121 @@
+/**
+ * @file shmbot.c
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ *
+ * Example bot process for TetrisShm.h: shift the bar over the lowest
+ * column and drop it. It shows the handoff, it does not play well.
+ */
+#include <TetrisShm.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+static uint64_t now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Return once seq differs from last, or after a while. */
+static void waitSeq(uint32_t *seq, uint32_t last)
+{
+#ifdef __linux__
+  struct timespec timeout = { 1, 0 };
+  syscall(SYS_futex, seq, FUTEX_WAIT, last, &timeout, NULL, 0);
+#else
+  (void) seq;
+  (void) last;
+  usleep(100);
+#endif
+}
+
+static void push(TetrisShm *shm, uint32_t seq, int32_t action)
+{
+  uint32_t head = shm->head;
+  while (head - __atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE) >=
+         TETRIS_SHM_RING && !shm->closed)
+    sched_yield();
+  shm->ring[head % TETRIS_SHM_RING].seq = seq;
+  shm->ring[head % TETRIS_SHM_RING].action = action;
+  __atomic_store_n(&shm->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void decide(TetrisShm *shm, uint32_t seq)
+{
+  const uint8_t *cell = TETRIS_SHM_CELL(shm);
+  int32_t lowest = 0, lowestHeight = INT_MAX, r, c, shift, i;
+
+  for (c = 0; c < shm->col; ++c) {
+    for (r = 0; r < shm->row && !cell[r * shm->col + c]; ++r)
+      ;
+    if (shm->row - r < lowestHeight) {
+      lowestHeight = shm->row - r;
+      lowest = c;
+    }
+  }
+
+  /** Bars are at most 4 wide with their middle at origin + 1. */
+  shift = lowest - 1 - shm->pieceCol;
+  for (i = 0; i < abs(shift) && i < TETRIS_SHM_RING / 2; ++i)
+    push(shm, seq, shift < 0 ? TETRIS_ENV_ACTION_LEFT :
+         TETRIS_ENV_ACTION_RIGHT);
+  push(shm, seq, TETRIS_ENV_ACTION_DROP);
+}
+
+int main(int argc, char **argv)
+{
+  TetrisShm *shm;
+  struct stat st;
+  uint32_t last = 0, seq;
+  unsigned long decisions = 0;
+  int fd;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <segment>\n", argv[0]);
+    return 1;
+  }
+  fd = open(argv[1], O_RDWR);
+  if (fd < 0 || fstat(fd, &st) || (size_t) st.st_size < sizeof(*shm)) {
+    fprintf(stderr, "<error> open(%s)\n", argv[1]);
+    return 1;
+  }
+  shm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED ||
+      __atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != TETRIS_SHM_MAGIC ||
+      shm->version != TETRIS_SHM_VERSION ||
+      (size_t) st.st_size < TETRIS_SHM_SIZE(shm->row, shm->col)) {
+    fprintf(stderr, "<error> %s: no segment of version %d\n", argv[1],
+            TETRIS_SHM_VERSION);
+    return 1;
+  }
+
+  while (!shm->closed) {
+    seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+    if (seq == last) {
+      waitSeq(&shm->seq, last);
+      continue;
+    }
+    last = seq;
+    shm->wakeTime = now();
+    if (shm->closed)
+      break;
+    decide(shm, seq);
+    shm->doneTime = now();
+    __atomic_store_n(&shm->done, seq, __ATOMIC_RELEASE);
+    decisions++;
+  }
+  printf("%lu decisions\n", decisions);
+  return 0;
+}
@@ -0,0 +1,313 @@
+/**
+ * @file sim.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisAutoplay.h>
+#include <TetrisColumn.h>
+#include <TetrisAlloc.h>
+#include <string>
+#include <sys/stat.h>
+
+/**
+ * Column store of finished games. Directory games holds one row per
+ * game, directory pieces one row per placed bar whose game column is
+ * the row of its game.
+ */
+class TetrisGameStore {
+ private:
+  enum {
+    GAME_SEED = 0,
+    GAME_PIECES,
+    GAME_LINES,
+    GAME_SCORE,
+    GAME_HEIGHT,
+    GAME_CLEAR1,
+    GAME_NR = GAME_CLEAR1 + TETRIS_BAR_MAX,
+  };
+  enum {
+    PIECE_GAME = 0,
+    PIECE_TYPE,
+    PIECE_ROT,
+    PIECE_COL,
+    PIECE_LINES,
+    PIECE_HEIGHT,
+    PIECE_NR,
+  };
+
+  TetrisColumnWriter mGame[GAME_NR];
+  TetrisColumnWriter mPiece[PIECE_NR];
+  bool mPieceRecord;
+  /** Piece types are numbered in its order if set, IJLOSTZ otherwise. */
+  const TetrisBarSet *mBarSet;
+
+  static bool open(TetrisColumnWriter &column, const std::string &dir,
+                   const char *name, unsigned width) {
+    std::string path = dir + "/" + name + ".col";
+    if (column.open(path.c_str(), width))
+      return true;
+    std::cerr << path << ": cannot open\n";
+    return false;
+  }
+
+ public:
+  TetrisGameStore() : mPieceRecord(false), mBarSet(NULL) {}
+
+  bool open(const char *dir, bool pieceRecord) {
+    std::string games = std::string(dir) + "/games";
+    std::string pieces = std::string(dir) + "/pieces";
+    mkdir(dir, 0755);
+    mkdir(games.c_str(), 0755);
+
+    static const char *clear[] = { "clear1", "clear2", "clear3", "clear4",
+                                   "clear5" };
+    bool ret = open(mGame[GAME_SEED], games, "seed", 8) &&
+      open(mGame[GAME_PIECES], games, "pieces", 4) &&
+      open(mGame[GAME_LINES], games, "lines", 4) &&
+      open(mGame[GAME_SCORE], games, "score", 4) &&
+      open(mGame[GAME_HEIGHT], games, "height", 4);
+    for (int i = 0; ret && i < TETRIS_BAR_MAX; ++i)
+      ret = open(mGame[GAME_CLEAR1 + i], games, clear[i], 4);
+    if (!ret || !pieceRecord)
+      return ret;
+
+    mPieceRecord = true;
+    mkdir(pieces.c_str(), 0755);
+    return open(mPiece[PIECE_GAME], pieces, "game", 8) &&
+      open(mPiece[PIECE_TYPE], pieces, "type", 1) &&
+      open(mPiece[PIECE_ROT], pieces, "rot", 1) &&
+      open(mPiece[PIECE_COL], pieces, "col", 2) &&
+      open(mPiece[PIECE_LINES], pieces, "lines", 1) &&
+      open(mPiece[PIECE_HEIGHT], pieces, "height", 2);
+  }
+
+  bool isPieceRecord() { return mPieceRecord; }
+  void setBarSet(const TetrisBarSet *set) { mBarSet = set; }
+
+  void addPiece(const TetrisMove &move, BarType type, int lines, int height) {
+    static const char types[] = "IJLOSTZ";
+    mPiece[PIECE_GAME].append(mGame[GAME_SEED].getCount());
+    mPiece[PIECE_TYPE].append(mBarSet ? mBarSet->getIndex(type) :
+                              std::string(types).find((char) type));
+    mPiece[PIECE_ROT].append(move.rot);
+    mPiece[PIECE_COL].append(move.index.c);
+    mPiece[PIECE_LINES].append(lines);
+    mPiece[PIECE_HEIGHT].append(height);
+  }
+
+  void addGame(TetrisField *field, unsigned long long seed, int height) {
+    mGame[GAME_SEED].append(seed);
+    mGame[GAME_PIECES].append(field->getPieces());
+    mGame[GAME_LINES].append(field->getLines());
+    mGame[GAME_SCORE].append(field->getScore());
+    mGame[GAME_HEIGHT].append(height);
+    for (int i = 0; i < TETRIS_BAR_MAX; ++i)
+      mGame[GAME_CLEAR1 + i].append(field->getClears(i + 1));
+  }
+};
+
+static int maxHeight(TetrisField *field)
+{
+  int ret = 0;
+  for (int c = 0; c < field->getCol(); ++c)
+    if (field->getHeight(c) > ret)
+      ret = field->getHeight(c);
+  return ret;
+}
+
+static bool searchMove(TetrisAutoplay &autoplay, TetrisField *field,
+                       TetrisMove &move)
+{
+  TETRIS_ALLOC_SCOPE(TETRIS_ALLOC_INPUTER);
+  return autoplay.search(field, move);
+}
+
+static bool applyMove(TetrisField *field, const TetrisMove &move)
+{
+  TETRIS_ALLOC_SCOPE(TETRIS_ALLOC_FIELD);
+  return TetrisAutoplay::apply(field, move);
+}
+
+/**
+ * Time the grid instead of playing. Every round fills the lower half
+ * of the field with rows of one hole, every fourth row full, tests
+ * every bar in every rotation at every cell, then deletes the full
+ * rows.
+ */
+static void stress(TetrisField *field, unsigned long long seed,
+                   unsigned long long rounds)
+{
+  int row = field->getRow();
+  int col = field->getCol();
+  unsigned long long checks = 0, fits = 0, lines = 0;
+  unsigned long long checkNsec = 0, lineNsec = 0;
+
+  field->reset(seed);
+  for (unsigned long long round = 0; round < rounds; ++round) {
+    field->clear();
+    for (int r = row / 2; r < row; ++r) {
+      int hole = r % 4 ? field->rand(col) : -1;
+      for (int c = 0; c < col; ++c)
+        if (c != hole)
+          field->setGrid(r, c, BAR_TYPE_G);
+    }
+
+    unsigned long long start = TetrisClock::nsec();
+    for (int type = 0; type < TETRIS_BAR_NR; ++type) {
+      const TetrisBar *bar = TetrisField::getBarFromType(type);
+      for (int rot = 0; rot < bar->getRotSize(); ++rot)
+        for (int r = 0; r < row; ++r)
+          for (int c = 0; c < col; ++c) {
+            TetrisIndex index(c, r);
+            fits += field->checkLocatable(bar, index, rot);
+          }
+      checks += (unsigned long long) bar->getRotSize() * row * col;
+    }
+    unsigned long long mid = TetrisClock::nsec();
+    unsigned before = field->getLines();
+    field->deleteLine();
+    lines += field->getLines() - before;
+    lineNsec += TetrisClock::nsec() - mid;
+    checkNsec += mid - start;
+  }
+
+  std::cerr << row << "x" << col << " " << rounds << " rounds: "
+            << checks << " collision checks (" << fits << " fit) at "
+            << checks / (checkNsec / 1e9) << "/s, " << lines
+            << " lines deleted at " << lines / (lineNsec / 1e9)
+            << "/s\n";
+}
+
+static void usage()
+{
+  std::cerr << "Usage: sim [-n games] [-s seed] [-p pieces] [-P] "
+            << "[-r srs] [-b bars] [-L table] [-o dir]\n"
+            << "           [-x rounds] [row col]\n"
+            << "  -n  games to play (default 100)\n"
+            << "  -s  seed of the first game, game i uses seed + i\n"
+            << "  -p  end a game after this many pieces (default 10000)\n"
+            << "  -P  also record every placed piece\n"
+            << "  -r  rotation system, classic (default) or srs\n"
+            << "  -b  piece set definition file instead of the 7 bars\n"
+            << "  -L  surface table from surfacegen for the next bar\n"
+            << "  -o  column store directory (default stat)\n"
+            << "  -x  time collision and line deletion on the field for "
+            << "this many\n"
+            << "      rounds instead of playing, e.g. -x 10 1000 1000\n";
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long long games = 100;
+  unsigned long long seed = 1;
+  unsigned pieces = 10000;
+  bool pieceRecord = false;
+  TetrisRotation rotation = TETRIS_ROTATION_CLASSIC;
+  const char *dir = "stat";
+  const char *surfacePath = NULL;
+  const char *barsPath = NULL;
+  unsigned long long rounds = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:p:Pr:b:L:o:x:h")) != -1) {
+    switch (opt) {
+    case 'n': games = strtoull(optarg, NULL, 0); break;
+    case 's': seed = strtoull(optarg, NULL, 0); break;
+    case 'p': pieces = strtoul(optarg, NULL, 0); break;
+    case 'P': pieceRecord = true; break;
+    case 'r':
+      rotation = strcmp(optarg, "srs") ? TETRIS_ROTATION_CLASSIC :
+        TETRIS_ROTATION_SRS;
+      break;
+    case 'b': barsPath = optarg; break;
+    case 'L': surfacePath = optarg; break;
+    case 'o': dir = optarg; break;
+    case 'x': rounds = strtoull(optarg, NULL, 0); break;
+    default: usage(); return 1;
+    }
+  }
+
+  int row = TETRIS_FIELD_ROW;
+  int col = TETRIS_FIELD_COL;
+  if (argc - optind >= 2) {
+    row = atoi(argv[optind]);
+    col = atoi(argv[optind + 1]);
+  }
+
+  if (rounds) {
+    TetrisField *field = TetrisField::create(row, col);
+    stress(field, seed, rounds);
+    delete field;
+    return 0;
+  }
+
+  TetrisBarSet bars;
+  if (barsPath) {
+    if (surfacePath) {
+      std::cerr << "surface tables only cover the 7 bars, not -b\n";
+      return 1;
+    }
+    if (!bars.load(barsPath))
+      return 1;
+  }
+
+  TetrisGameStore store;
+  if (!store.open(dir, pieceRecord))
+    return 1;
+
+  if (getenv("TETRIS_LOG"))
+    TetrisLog::instance().open(getenv("TETRIS_LOG"));
+
+  TetrisField *field = TetrisField::create(row, col);
+  field->setRotation(rotation);
+  if (barsPath) {
+    field->setBarSet(&bars);
+    store.setBarSet(&bars);
+  }
+  TetrisAutoplay autoplay;
+  TetrisSurface surface;
+  if (surfacePath) {
+    if (!surface.open(surfacePath) || surface.getCol() != col) {
+      std::cerr << surfacePath << ": not a surface table for " << col
+                << " columns\n";
+      return 1;
+    }
+    autoplay.setSurface(&surface);
+  }
+#ifdef TETRIS_ALLOC
+  TetrisAlloc::open();
+#endif
+  unsigned long long placed = 0;
+  unsigned long long start = TetrisClock::nsec();
+
+  for (unsigned long long game = 0; game < games; ++game) {
+    field->reset(seed + game);
+    int height = 0;
+    TetrisMove move;
+    while (field->getPieces() < pieces && searchMove(autoplay, field, move)) {
+      BarType type = field->getBar()->getType();
+      unsigned lines = field->getLines();
+      bool alive = applyMove(field, move);
+      TETRIS_ALLOC_FRAME();
+      int now = maxHeight(field);
+      if (now > height)
+        height = now;
+      if (store.isPieceRecord())
+        store.addPiece(move, type, field->getLines() - lines, now);
+      if (!alive)
+        break;
+    }
+    placed += field->getPieces();
+    store.addGame(field, seed + game, height);
+  }
+
+  double sec = (TetrisClock::nsec() - start) / 1e9;
+#ifdef TETRIS_ALLOC
+  TetrisAlloc::print(std::cerr);
+#endif
+  std::cerr << games << " games " << placed << " pieces in " << sec
+            << "s, " << games / sec << " games/s "
+            << placed / sec << " pieces/s\n";
+  delete field;
+  TetrisLog::instance().close();
+  return 0;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file surfacegen.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisSurface.h>
+#include <cstdio>
+#include <unistd.h>
+
+static void usage()
+{
+  std::cerr << "Usage: surfacegen [-c clamp] [-w col] table\n"
+            << "  -c  clamp of the height differences (default 2)\n"
+            << "  -w  columns of the field (default 10)\n";
+}
+
+int main(int argc, char *argv[])
+{
+  int clamp = 2;
+  int col = TETRIS_FIELD_COL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:w:h")) != -1) {
+    switch (opt) {
+    case 'c': clamp = atoi(optarg); break;
+    case 'w': col = atoi(optarg); break;
+    default: usage(); return 1;
+    }
+  }
+  if (optind >= argc || clamp <= 0 || col < 2 ||
+      col > TetrisSurface::COL_MAX) {
+    usage();
+    return 1;
+  }
+
+  int base = 2 * clamp + 1;
+  unsigned long long profiles = 1;
+  for (int c = 1; c < col; ++c)
+    profiles *= base;
+
+  /** Readers map the table, so it replaces the old one at once. */
+  std::string path = argv[optind];
+  std::string tmp = path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "wb");
+  if (!file) {
+    std::cerr << tmp << ": cannot open\n";
+    return 1;
+  }
+
+  TetrisSurfaceHeader header;
+  memset(&header, 0, sizeof(header));
+  strncpy(header.magic, TETRIS_SURFACE_MAGIC, sizeof(header.magic));
+  header.version = TETRIS_SURFACE_VERSION;
+  header.col = col;
+  header.clamp = clamp;
+  header.bars = TETRIS_BAR_NR;
+  header.profiles = profiles;
+  fwrite(&header, sizeof(header), 1, file);
+
+  unsigned long long start = TetrisClock::nsec();
+  int height[TetrisSurface::COL_MAX];
+  int diff[TetrisSurface::COL_MAX];
+  unsigned char cost[TETRIS_BAR_NR];
+  std::fill(diff, diff + col, -clamp);
+
+  for (unsigned long long profile = 0; profile < profiles; ++profile) {
+    /** Heights from the differences, lifted so the lowest is 0. */
+    int low = 0;
+    height[0] = 0;
+    for (int c = 1; c < col; ++c) {
+      height[c] = height[c - 1] + diff[c - 1];
+      low = std::min(low, height[c]);
+    }
+    for (int c = 0; c < col; ++c)
+      height[c] -= low;
+
+    for (int bar = 0; bar < TETRIS_BAR_NR; ++bar)
+      cost[bar] = TetrisSurface::cost(TetrisField::getBarFromType(bar),
+                                      height, col);
+    if (fwrite(cost, sizeof(cost), 1, file) != 1) {
+      std::cerr << tmp << ": cannot write\n";
+      fclose(file);
+      return 1;
+    }
+
+    /** Next profile, leftmost difference is the lowest digit. */
+    for (int c = 0; c < col - 1 && ++diff[c] > clamp; ++c)
+      diff[c] = -clamp;
+  }
+
+  if (fclose(file) || rename(tmp.c_str(), path.c_str())) {
+    std::cerr << path << ": cannot write\n";
+    return 1;
+  }
+  std::cerr << profiles << " profiles in "
+            << (TetrisClock::nsec() - start) / 1e9 << "s\n";
+  return 0;
+}
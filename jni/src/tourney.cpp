@@ -0,0 +1,208 @@
+/**
+ * @file tourney.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisPlugin.h>
+#include <TetrisWork.h>
+#include <string>
+
+/**
+ * Every game of every policy. Task policy * seeds + game plays seed +
+ * game, so all policies meet the same bar sequences and each pair is
+ * compared game by game.
+ */
+class TetrisTourneyWork : public TetrisWork {
+ private:
+  int mPolicies;
+  int mSeeds;
+  unsigned mPieces;
+  unsigned long long mSeed;
+  /** Plugin of policy p for worker w at w * policies + p. */
+  std::vector<TetrisPlugin *> mPlugin;
+  std::vector<TetrisField *> mField;
+  /** Decision latencies in nanoseconds, indexed as mPlugin. */
+  std::vector<std::vector<unsigned long long> > mLatency;
+
+ public:
+  std::vector<unsigned> mLines;
+  std::vector<unsigned> mPlaced;
+
+  TetrisTourneyWork(int workers, int policies, int seeds, unsigned pieces,
+                    unsigned long long seed)
+    : mPolicies(policies), mSeeds(seeds), mPieces(pieces), mSeed(seed),
+      mPlugin(workers * policies), mField(workers),
+      mLatency(workers * policies), mLines(policies * seeds),
+      mPlaced(policies * seeds) {}
+
+  ~TetrisTourneyWork() {
+    for (size_t i = 0; i < mPlugin.size(); ++i)
+      delete mPlugin[i];
+    for (size_t i = 0; i < mField.size(); ++i)
+      delete mField[i];
+  }
+
+  bool open(char **path, int row, int col, TetrisRotation rotation,
+            unsigned long long budget) {
+    for (size_t worker = 0; worker < mField.size(); ++worker) {
+      mField[worker] = TetrisField::create(row, col);
+      mField[worker]->setRotation(rotation);
+      for (int p = 0; p < mPolicies; ++p) {
+        TetrisPlugin *plugin = new TetrisPlugin();
+        mPlugin[worker * mPolicies + p] = plugin;
+        if (!plugin->open(path[p], row, col))
+          return false;
+        plugin->setBudget(budget);
+      }
+    }
+    return true;
+  }
+
+  void run(unsigned task, int worker) {
+    int policy = task / mSeeds;
+    TetrisPlugin *plugin = mPlugin[worker * mPolicies + policy];
+    std::vector<unsigned long long> &latency =
+      mLatency[worker * mPolicies + policy];
+    TetrisField *field = mField[worker];
+
+    field->reset(mSeed + task % mSeeds);
+    while (field->getPieces() < mPieces && !field->isGameOver()) {
+      plugin->play(field);
+      latency.push_back(plugin->getLast());
+    }
+    mLines[task] = field->getLines();
+    mPlaced[task] = field->getPieces();
+  }
+
+  const char *getName(int policy) { return mPlugin[policy]->getName(); }
+
+  /** Latencies of policy over all workers, sorted. */
+  void getLatency(int policy, std::vector<unsigned long long> &latency) {
+    latency.clear();
+    for (size_t worker = 0; worker < mField.size(); ++worker) {
+      std::vector<unsigned long long> &part =
+        mLatency[worker * mPolicies + policy];
+      latency.insert(latency.end(), part.begin(), part.end());
+    }
+    std::sort(latency.begin(), latency.end());
+  }
+
+  void getCount(int policy, unsigned long long &timeouts,
+                unsigned long long &failures) {
+    timeouts = failures = 0;
+    for (size_t worker = 0; worker < mField.size(); ++worker) {
+      timeouts += mPlugin[worker * mPolicies + policy]->getTimeouts();
+      failures += mPlugin[worker * mPolicies + policy]->getFailures();
+    }
+  }
+};
+
+static double percentile(const std::vector<unsigned long long> &sorted,
+                         double p)
+{
+  if (sorted.empty())
+    return 0;
+  return sorted[(size_t) (p / 100.0 * (sorted.size() - 1))] / 1e3;
+}
+
+static void usage()
+{
+  std::cerr << "Usage: tourney [-n games] [-s seed] [-p pieces] [-t usec] "
+            << "[-j threads] [-r srs]\n"
+            << "               [-R row] [-C col] policy.so...\n"
+            << "  -n  games per policy, the same seeds for every policy "
+            << "(default 20)\n"
+            << "  -s  seed of the first game, game i uses seed + i\n"
+            << "  -p  end a game after this many pieces (default 2000)\n"
+            << "  -t  budget of a decision; a later one is thrown away "
+            << "and the bar\n"
+            << "      dropped where it spawned (default 10000)\n"
+            << "  -j  worker threads (default one per CPU)\n"
+            << "  -r  rotation system, classic (default) or srs\n"
+            << "  -R  rows of the field\n"
+            << "  -C  columns of the field\n";
+}
+
+int main(int argc, char *argv[])
+{
+  int seeds = 20;
+  unsigned long long seed = 1;
+  unsigned pieces = 2000;
+  unsigned long long budget = 10000;
+  int threads = 0;
+  TetrisRotation rotation = TETRIS_ROTATION_CLASSIC;
+  int row = TETRIS_FIELD_ROW;
+  int col = TETRIS_FIELD_COL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:p:t:j:r:R:C:h")) != -1) {
+    switch (opt) {
+    case 'n': seeds = atoi(optarg); break;
+    case 's': seed = strtoull(optarg, NULL, 0); break;
+    case 'p': pieces = strtoul(optarg, NULL, 0); break;
+    case 't': budget = strtoull(optarg, NULL, 0); break;
+    case 'j': threads = atoi(optarg); break;
+    case 'r':
+      rotation = strcmp(optarg, "srs") ? TETRIS_ROTATION_CLASSIC :
+        TETRIS_ROTATION_SRS;
+      break;
+    case 'R': row = atoi(optarg); break;
+    case 'C': col = atoi(optarg); break;
+    default: usage(); return 1;
+    }
+  }
+  int policies = argc - optind;
+  if (policies < 1 || seeds < 1) {
+    usage();
+    return 1;
+  }
+
+  TetrisWorkPool pool(threads);
+  TetrisTourneyWork work(pool.getSize(), policies, seeds, pieces, seed);
+  if (!work.open(argv + optind, row, col, rotation, budget * 1000))
+    return 1;
+
+  unsigned long long start = TetrisClock::nsec();
+  pool.run(&work, policies * seeds);
+  double sec = (TetrisClock::nsec() - start) / 1e9;
+  std::cerr << policies * seeds << " games on " << pool.getSize()
+            << " workers in " << sec << "s\n";
+
+  printf("%-16s %10s %10s %8s %8s %8s %8s %8s %8s\n", "policy",
+         "lines", "pieces", "p50us", "p90us", "p99us", "maxus",
+         "timeouts", "failures");
+  std::vector<unsigned long long> latency;
+  for (int p = 0; p < policies; ++p) {
+    unsigned long long lines = 0, placed = 0, timeouts, failures;
+    for (int game = 0; game < seeds; ++game) {
+      lines += work.mLines[p * seeds + game];
+      placed += work.mPlaced[p * seeds + game];
+    }
+    work.getLatency(p, latency);
+    work.getCount(p, timeouts, failures);
+    printf("%-16s %10.1f %10.1f %8.1f %8.1f %8.1f %8.1f %8llu %8llu\n",
+           work.getName(p), (double) lines / seeds, (double) placed / seeds,
+           percentile(latency, 50), percentile(latency, 90),
+           percentile(latency, 99), percentile(latency, 100), timeouts,
+           failures);
+  }
+
+  /** Wins, losses and draws by lines cleared on the same seed. */
+  for (int a = 0; a < policies; ++a) {
+    for (int b = a + 1; b < policies; ++b) {
+      int win = 0, loss = 0, draw = 0;
+      for (int game = 0; game < seeds; ++game) {
+        unsigned la = work.mLines[a * seeds + game];
+        unsigned lb = work.mLines[b * seeds + game];
+        if (la > lb)
+          win++;
+        else if (la < lb)
+          loss++;
+        else
+          draw++;
+      }
+      printf("%s vs %s: %d-%d-%d\n", work.getName(a), work.getName(b), win,
+             loss, draw);
+    }
+  }
+  return 0;
+}
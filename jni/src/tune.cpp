@@ -0,0 +1,301 @@
+/**
+ * @file tune.cpp
+ * @author Hiroo MATSUMOTO <hiroom2.mail@gmail.com>
+ */
+#include <TetrisAutoplay.h>
+#include <TetrisWork.h>
+#include <cmath>
+#include <random>
+#include <string>
+
+#define TUNE_CHECKPOINT_VERSION (1)
+/** Variance added to every weight, fading out over TUNE_NOISE_GEN. */
+#define TUNE_NOISE (4.0)
+#define TUNE_NOISE_GEN (40)
+
+/**
+ * One generation: every game of every candidate. Task candidate *
+ * games + game plays seed + game with the weights of candidate, so all
+ * candidates of a generation meet the same bar sequences.
+ */
+class TetrisTuneWork : public TetrisWork {
+ private:
+  int mGames;
+  unsigned mPieces;
+  unsigned long long mSeed;
+  const std::vector<double> &mWeight;
+  std::vector<double> &mLines;
+  std::vector<unsigned> &mPlaced;
+  std::vector<TetrisField *> mField;
+  std::vector<TetrisAutoplay> mAutoplay;
+
+ public:
+  TetrisTuneWork(int workers, int row, int col, TetrisRotation rotation,
+                 int games, unsigned pieces, unsigned long long seed,
+                 const std::vector<double> &weight,
+                 std::vector<double> &lines, std::vector<unsigned> &placed)
+    : mGames(games), mPieces(pieces), mSeed(seed), mWeight(weight),
+      mLines(lines), mPlaced(placed), mField(workers), mAutoplay(workers) {
+    for (int worker = 0; worker < workers; ++worker) {
+      mField[worker] = TetrisField::create(row, col);
+      mField[worker]->setRotation(rotation);
+    }
+  }
+
+  ~TetrisTuneWork() {
+    for (size_t worker = 0; worker < mField.size(); ++worker)
+      delete mField[worker];
+  }
+
+  void run(unsigned task, int worker) {
+    TetrisField *field = mField[worker];
+    TetrisAutoplay &autoplay = mAutoplay[worker];
+    int candidate = task / mGames;
+
+    autoplay.setWeight(&mWeight[candidate * TETRIS_FEATURE_NR]);
+    field->reset(mSeed + task % mGames);
+    while (field->getPieces() < mPieces && autoplay.play(field))
+      ;
+    mLines[task] = field->getLines();
+    mPlaced[task] = field->getPieces();
+  }
+};
+
+/** Search distribution of the cross-entropy method, and the best seen. */
+struct TetrisTuneState {
+  int generation;
+  double mean[TETRIS_FEATURE_NR];
+  double sigma[TETRIS_FEATURE_NR];
+  double bestFitness;
+  double best[TETRIS_FEATURE_NR];
+};
+
+static bool saveState(const char *path, const TetrisTuneState &state)
+{
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "w");
+  if (!file)
+    return false;
+
+  fprintf(file, "tune %d\ngeneration %d\nmean", TUNE_CHECKPOINT_VERSION,
+          state.generation);
+  for (int i = 0; i < TETRIS_FEATURE_NR; ++i)
+    fprintf(file, " %.17g", state.mean[i]);
+  fprintf(file, "\nsigma");
+  for (int i = 0; i < TETRIS_FEATURE_NR; ++i)
+    fprintf(file, " %.17g", state.sigma[i]);
+  fprintf(file, "\nbest %.17g", state.bestFitness);
+  for (int i = 0; i < TETRIS_FEATURE_NR; ++i)
+    fprintf(file, " %.17g", state.best[i]);
+  fprintf(file, "\n");
+
+  /** A crash leaves either the old or the new checkpoint. */
+  bool ret = !ferror(file) && !fflush(file) && !fsync(fileno(file));
+  ret = !fclose(file) && ret;
+  return ret && !rename(tmp.c_str(), path);
+}
+
+static bool loadState(const char *path, TetrisTuneState &state)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return false;
+
+  int version = 0;
+  bool ret = fscanf(file, "tune %d generation %d mean", &version,
+                    &state.generation) == 2 &&
+    version == TUNE_CHECKPOINT_VERSION;
+  for (int i = 0; ret && i < TETRIS_FEATURE_NR; ++i)
+    ret = fscanf(file, "%lf", &state.mean[i]) == 1;
+  ret = ret && fscanf(file, " sigma") == 0;
+  for (int i = 0; ret && i < TETRIS_FEATURE_NR; ++i)
+    ret = fscanf(file, "%lf", &state.sigma[i]) == 1;
+  ret = ret && fscanf(file, " best %lf", &state.bestFitness) == 1;
+  for (int i = 0; ret && i < TETRIS_FEATURE_NR; ++i)
+    ret = fscanf(file, "%lf", &state.best[i]) == 1;
+  fclose(file);
+  return ret;
+}
+
+static void printWeight(const char *name, const double *weight)
+{
+  fprintf(stderr, "%s", name);
+  for (int i = 0; i < TETRIS_FEATURE_NR; ++i)
+    fprintf(stderr, " %.4f", weight[i]);
+  fprintf(stderr, "\n");
+}
+
+static bool higher(const std::pair<double, int> &a,
+                   const std::pair<double, int> &b)
+{
+  return a.first > b.first;
+}
+
+static void usage()
+{
+  std::cerr << "Usage: tune [-g generations] [-N population] [-e elite] "
+            << "[-n games] [-p pieces]\n"
+            << "            [-s seed] [-S sigma] [-j threads] [-r srs] "
+            << "[-c checkpoint] [row col]\n"
+            << "  -g  generations to run (default 50)\n"
+            << "  -N  weight vectors per generation (default 100)\n"
+            << "  -e  best vectors the next generation is fitted to "
+            << "(default 10)\n"
+            << "  -n  games per vector, the same seeds for every vector "
+            << "(default 20)\n"
+            << "  -p  end a game after this many pieces (default 2000)\n"
+            << "  -s  seed, generation g plays seed + g * games onward\n"
+            << "  -S  initial deviation of every weight (default 10)\n"
+            << "  -j  worker threads (default one per CPU)\n"
+            << "  -r  rotation system, classic (default) or srs\n"
+            << "  -c  checkpoint rewritten every generation and resumed "
+            << "from (default tune.ckpt)\n";
+}
+
+int main(int argc, char *argv[])
+{
+  int generations = 50;
+  int population = 100;
+  int elite = 10;
+  int games = 20;
+  unsigned pieces = 2000;
+  unsigned long long seed = 1;
+  double sigma = 10;
+  int threads = 0;
+  TetrisRotation rotation = TETRIS_ROTATION_CLASSIC;
+  const char *checkpoint = "tune.ckpt";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "g:N:e:n:p:s:S:j:r:c:h")) != -1) {
+    switch (opt) {
+    case 'g': generations = atoi(optarg); break;
+    case 'N': population = atoi(optarg); break;
+    case 'e': elite = atoi(optarg); break;
+    case 'n': games = atoi(optarg); break;
+    case 'p': pieces = strtoul(optarg, NULL, 0); break;
+    case 's': seed = strtoull(optarg, NULL, 0); break;
+    case 'S': sigma = atof(optarg); break;
+    case 'j': threads = atoi(optarg); break;
+    case 'r':
+      rotation = strcmp(optarg, "srs") ? TETRIS_ROTATION_CLASSIC :
+        TETRIS_ROTATION_SRS;
+      break;
+    case 'c': checkpoint = optarg; break;
+    default: usage(); return 1;
+    }
+  }
+  if (population < 1 || elite < 1 || elite > population || games < 1) {
+    usage();
+    return 1;
+  }
+
+  int row = TETRIS_FIELD_ROW;
+  int col = TETRIS_FIELD_COL;
+  if (argc - optind >= 2) {
+    row = atoi(argv[optind]);
+    col = atoi(argv[optind + 1]);
+  }
+
+  TetrisTuneState state;
+  if (loadState(checkpoint, state)) {
+    std::cerr << checkpoint << ": resume at generation "
+              << state.generation << "\n";
+  } else {
+    state.generation = 0;
+    state.bestFitness = -1;
+    for (int i = 0; i < TETRIS_FEATURE_NR; ++i) {
+      state.mean[i] = 0;
+      state.sigma[i] = sigma;
+      state.best[i] = 0;
+    }
+  }
+
+  TetrisWorkPool pool(threads);
+  unsigned tasks = (unsigned) population * games;
+  std::vector<double> weight((size_t) population * TETRIS_FEATURE_NR);
+  std::vector<double> lines(tasks);
+  std::vector<unsigned> placed(tasks);
+  std::vector<std::pair<double, int> > fitness(population);
+  unsigned long long start = TetrisClock::nsec();
+  int first = state.generation;
+
+  std::cerr << pool.getSize() << " workers, " << tasks
+            << " games per generation\n";
+
+  for (; state.generation < generations; ++state.generation) {
+    int gen = state.generation;
+    unsigned long long genStart = TetrisClock::nsec();
+    unsigned long long steals = pool.getSteals();
+
+    /** Resuming samples the same candidates as an uninterrupted run. */
+    std::mt19937_64 random(seed * 1000003ULL + gen);
+    std::normal_distribution<double> normal;
+    for (int k = 0; k < population; ++k)
+      for (int i = 0; i < TETRIS_FEATURE_NR; ++i)
+        weight[k * TETRIS_FEATURE_NR + i] =
+          state.mean[i] + state.sigma[i] * normal(random);
+
+    TetrisTuneWork work(pool.getSize(), row, col, rotation, games, pieces,
+                        seed + (unsigned long long) gen * games, weight,
+                        lines, placed);
+    pool.run(&work, tasks);
+
+    unsigned long long genPlaced = 0;
+    double total = 0;
+    for (int k = 0; k < population; ++k) {
+      double sum = 0;
+      for (int game = 0; game < games; ++game) {
+        sum += lines[k * games + game];
+        genPlaced += placed[k * games + game];
+      }
+      fitness[k] = std::make_pair(sum / games, k);
+      total += sum / games;
+    }
+    std::stable_sort(fitness.begin(), fitness.end(), higher);
+
+    /** Fit the distribution to the elite, plus the decreasing noise. */
+    double noise = TUNE_NOISE * std::max(0, TUNE_NOISE_GEN - gen) /
+      TUNE_NOISE_GEN;
+    for (int i = 0; i < TETRIS_FEATURE_NR; ++i) {
+      double mean = 0;
+      for (int e = 0; e < elite; ++e)
+        mean += weight[fitness[e].second * TETRIS_FEATURE_NR + i];
+      mean /= elite;
+      double var = 0;
+      for (int e = 0; e < elite; ++e) {
+        double d = weight[fitness[e].second * TETRIS_FEATURE_NR + i] - mean;
+        var += d * d;
+      }
+      state.mean[i] = mean;
+      state.sigma[i] = sqrt(var / elite + noise);
+    }
+
+    if (fitness[0].first > state.bestFitness) {
+      state.bestFitness = fitness[0].first;
+      std::copy(&weight[fitness[0].second * TETRIS_FEATURE_NR],
+                &weight[(fitness[0].second + 1) * TETRIS_FEATURE_NR],
+                state.best);
+    }
+
+    /** Continue with the next generation on restart. */
+    state.generation++;
+    if (!saveState(checkpoint, state))
+      std::cerr << checkpoint << ": cannot write\n";
+    state.generation--;
+
+    unsigned long long now = TetrisClock::nsec();
+    double sec = (now - genStart) / 1e9;
+    double eta = (now - start) / 1e9 / (gen + 1 - first) *
+      (generations - gen - 1);
+    fprintf(stderr, "gen %d best %.1f mean %.1f lines, %.3gs %.1f games/s "
+            "%.0f pieces/s, %llu steals, eta %.0fs\n", gen,
+            fitness[0].first, total / population, sec, tasks / sec,
+            genPlaced / sec, pool.getSteals() - steals, eta);
+  }
+
+  printWeight("mean", state.mean);
+  printWeight("sigma", state.sigma);
+  fprintf(stderr, "best %.1f lines per game\n", state.bestFitness);
+  printWeight("weight", state.best);
+  return 0;
+}